@@ -0,0 +1,72 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <string.h>
+#include "cmap.h"
+#include "attrcache.h"
+#include "stats.h"
+
+struct attr {
+    struct stat st;
+    double seen;
+};
+
+static cmap_t *attrs = NULL;
+
+int attrcache_init(void)
+{
+    attrs = cmap_create(sizeof(struct attr), 0);
+    return attrs == NULL ? -1 : 0;
+}
+
+void attrcache_free(void)
+{
+    cmap_destroy(attrs);
+    attrs = NULL;
+}
+
+void attrcache_put(const char *url, const struct stat *st)
+{
+    struct attr a;
+
+    if (attrs == NULL)
+        return;
+    a.st = *st;
+    a.seen = stats_now_ms();
+    cmap_put(attrs, url, &a);
+}
+
+int attrcache_get(const char *url, struct stat *st, double *seen,
+                  int max_ms)
+{
+    struct attr a;
+
+    if (attrs == NULL || -1 == cmap_get(attrs, url, &a) ||
+        stats_now_ms() - a.seen > max_ms)
+        return -1;
+    *st = a.st;
+    if (seen != NULL)
+        *seen = a.seen;
+    return 0;
+}
+
+static int expired(const char *key, void *value, void *arg)
+{
+    struct attr *a = (struct attr *)value;
+    double *before = (double *)arg;
+    (void)key;
+
+    return a->seen < *before;
+}
+
+void attrcache_expire(int max_ms)
+{
+    double before = stats_now_ms() - max_ms;
+
+    if (attrs != NULL)
+        cmap_remove_if(attrs, expired, &before);
+}
@@ -0,0 +1,44 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Attributes of files as the last getattr found them. The kernel asks for
+   them right before opening a file, so an open can tell how large the file
+   is without asking the server again. Nothing invalidates them, they are
+   only a hint that expires after a moment.
+*/
+
+#ifndef ATTRCACHE_H
+#define ATTRCACHE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+int attrcache_init(void);
+void attrcache_free(void);
+
+void attrcache_put(const char *url, const struct stat *st);
+
+/* Returns 0 and fills st, and seen with when that was in milliseconds
+   since the epoch unless it is NULL, when url was seen in the last max_ms.
+   Returns -1 otherwise. */
+int attrcache_get(const char *url, struct stat *st, double *seen,
+    int max_ms);
+
+/* Forget the attributes that have expired */
+void attrcache_expire(int max_ms);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // ATTRCACHE_H
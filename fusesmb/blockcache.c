@@ -0,0 +1,343 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ohash.h"
+#include "blockcache.h"
+#include "blocksum.h"
+
+struct cached_file;
+
+struct block {
+    off_t index;                /* offset / BLOCKCACHE_BLOCK, the key */
+    struct cached_file *file;
+    char *data;
+    size_t len;                 /* less than a block only at the end */
+    struct block *prev;         /* least recently used list */
+    struct block *next;
+};
+
+struct cached_file {
+    char *url;                  /* the key */
+    struct blockcache_version version;
+    ohash_t *blocks;
+};
+
+static ohash_t *files = NULL;
+static struct block *newest = NULL;
+static struct block *oldest = NULL;
+static size_t used = 0;
+static size_t limit = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static int compare_index(const void *a, const void *b)
+{
+    return *(const off_t *)a != *(const off_t *)b;
+}
+
+static hash_val_t hash_index(const void *key)
+{
+    /* The table takes the low 7 bits apart, spread the index over all */
+    unsigned long long h = (unsigned long long)*(const off_t *)key;
+    h *= 0x9e3779b97f4a7c15ULL;
+    return (hash_val_t)(h ^ (h >> 29));
+}
+
+/*
+ * Called with cache_mutex held, as are the functions below
+ */
+static void unlink_block(struct block *b)
+{
+    if (b->prev != NULL)
+        b->prev->next = b->next;
+    else
+        newest = b->next;
+    if (b->next != NULL)
+        b->next->prev = b->prev;
+    else
+        oldest = b->prev;
+}
+
+static void push_block(struct block *b)
+{
+    b->prev = NULL;
+    b->next = newest;
+    if (newest != NULL)
+        newest->prev = b;
+    newest = b;
+    if (oldest == NULL)
+        oldest = b;
+}
+
+static void free_block(struct block *b)
+{
+    ohnode_t *node = ohash_lookup(b->file->blocks, &b->index);
+    if (node != NULL)
+        ohash_delete(b->file->blocks, node);
+    unlink_block(b);
+    used -= b->len;
+    free(b->data);
+    free(b);
+}
+
+static void free_file(struct cached_file *f)
+{
+    ohscan_t scan;
+    ohnode_t *node;
+
+    ohash_scan_begin(&scan, f->blocks);
+    while (NULL != (node = ohash_scan_next(&scan)))
+    {
+        struct block *b = (struct block *)ohnode_get(node);
+        ohash_delete(f->blocks, node);
+        unlink_block(b);
+        used -= b->len;
+        free(b->data);
+        free(b);
+    }
+    node = ohash_lookup(files, f->url);
+    if (node != NULL)
+        ohash_delete(files, node);
+    ohash_destroy(f->blocks);
+    free(f->url);
+    free(f);
+}
+
+static struct cached_file *find_file(const char *url)
+{
+    if (files == NULL)
+        return NULL;
+    ohnode_t *node = ohash_lookup(files, url);
+    return node != NULL ? (struct cached_file *)ohnode_get(node) : NULL;
+}
+
+static int same_version(const struct blockcache_version *a,
+                        const struct blockcache_version *b)
+{
+    return a->mtime == b->mtime && a->size == b->size;
+}
+
+static void free_all(void)
+{
+    ohscan_t scan;
+    ohnode_t *node;
+
+    if (files == NULL)
+        return;
+    ohash_scan_begin(&scan, files);
+    while (NULL != (node = ohash_scan_next(&scan)))
+        free_file((struct cached_file *)ohnode_get(node));
+    ohash_destroy(files);
+    files = NULL;
+}
+
+void blockcache_set_size(size_t size)
+{
+    pthread_mutex_lock(&cache_mutex);
+    limit = size;
+    while (oldest != NULL && used > limit)
+    {
+        struct cached_file *f = oldest->file;
+        free_block(oldest);
+        if (ohash_isempty(f->blocks))
+            free_file(f);
+    }
+    if (limit == 0)
+        free_all();
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int blockcache_enabled(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    int enabled = limit > 0;
+    pthread_mutex_unlock(&cache_mutex);
+    return enabled;
+}
+
+void blockcache_free(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    free_all();
+    limit = 0;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/*
+ * Returns 1 when the blocks of f up to end are all there
+ */
+static int all_cached(struct cached_file *f, off_t offset, off_t end)
+{
+    off_t i;
+
+    for (i = offset / BLOCKCACHE_BLOCK; (off_t)(i * BLOCKCACHE_BLOCK) < end; i++)
+        if (NULL == ohash_lookup(f->blocks, &i))
+            return 0;
+    return 1;
+}
+
+int blockcache_has(const char *url, const struct blockcache_version *v,
+                   size_t size, off_t offset)
+{
+    off_t end = offset + (off_t)size;
+
+    if (end > v->size)
+        end = v->size;
+    pthread_mutex_lock(&cache_mutex);
+    struct cached_file *f = find_file(url);
+    int has = f != NULL && same_version(&f->version, v) &&
+        all_cached(f, offset, end);
+    pthread_mutex_unlock(&cache_mutex);
+    return has;
+}
+
+ssize_t blockcache_get(const char *url, const struct blockcache_version *v,
+                       char *buf, size_t size, off_t offset)
+{
+    off_t end = offset + (off_t)size, i;
+    ssize_t done = 0;
+
+    if (end > v->size)
+        end = v->size;
+    pthread_mutex_lock(&cache_mutex);
+    struct cached_file *f = find_file(url);
+    if (f == NULL || !same_version(&f->version, v))
+    {
+        if (f != NULL)
+            free_file(f);
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+
+    /* All or nothing, a partial hit would still need the server */
+    if (!all_cached(f, offset, end))
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+    for (i = offset / BLOCKCACHE_BLOCK; (off_t)(i * BLOCKCACHE_BLOCK) < end; i++)
+    {
+        struct block *b =
+            (struct block *)ohnode_get(ohash_lookup(f->blocks, &i));
+        off_t start = i * BLOCKCACHE_BLOCK;
+        off_t from = offset > start ? offset - start : 0;
+        off_t to = end - start < (off_t)b->len ? end - start : (off_t)b->len;
+        if (to > from)
+        {
+            memcpy(buf + done, b->data + from, to - from);
+            done += to - from;
+        }
+        unlink_block(b);
+        push_block(b);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return done;
+}
+
+void blockcache_put(const char *url, const struct blockcache_version *v,
+                    const char *buf, size_t len, off_t offset)
+{
+    off_t end = offset + (off_t)len, i;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (limit == 0)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+    if (files == NULL &&
+        NULL == (files = ohash_create(HASHCOUNT_T_MAX, NULL, NULL)))
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return;
+    }
+    struct cached_file *f = find_file(url);
+    if (f != NULL && !same_version(&f->version, v))
+    {
+        free_file(f);
+        f = NULL;
+    }
+    if (f == NULL)
+    {
+        f = (struct cached_file *)malloc(sizeof(struct cached_file));
+        if (f == NULL || NULL == (f->url = strdup(url)))
+        {
+            free(f);
+            pthread_mutex_unlock(&cache_mutex);
+            return;
+        }
+        f->version = *v;
+        f->blocks = ohash_create(HASHCOUNT_T_MAX, compare_index, hash_index);
+        if (f->blocks == NULL || !ohash_insert(files, f->url, f))
+        {
+            if (f->blocks != NULL)
+                ohash_destroy(f->blocks);
+            free(f->url);
+            free(f);
+            pthread_mutex_unlock(&cache_mutex);
+            return;
+        }
+    }
+
+    for (i = (offset + BLOCKCACHE_BLOCK - 1) / BLOCKCACHE_BLOCK;
+         (off_t)(i * BLOCKCACHE_BLOCK) < end; i++)
+    {
+        off_t start = i * BLOCKCACHE_BLOCK;
+        if (start >= v->size)
+            break;
+        size_t size = v->size - start < BLOCKCACHE_BLOCK ?
+            v->size - start : BLOCKCACHE_BLOCK;
+        if (start + (off_t)size > end || size > limit)
+            break;
+        if (NULL != ohash_lookup(f->blocks, &i))
+            continue;
+
+        while (oldest != NULL && used + size > limit)
+        {
+            struct cached_file *old = oldest->file;
+            free_block(oldest);
+            if (old != f && ohash_isempty(old->blocks))
+                free_file(old);
+        }
+        struct block *b = (struct block *)malloc(sizeof(struct block));
+        if (b == NULL || NULL == (b->data = (char *)malloc(size)))
+        {
+            free(b);
+            break;
+        }
+        b->index = i;
+        b->file = f;
+        b->len = size;
+        memcpy(b->data, buf + (start - offset), size);
+        if (!ohash_insert(f->blocks, &b->index, b))
+        {
+            free(b->data);
+            free(b);
+            break;
+        }
+        push_block(b);
+        used += size;
+
+        struct blocksum sum;
+        blocksum_compute(b->data, size, &sum);
+        blocksum_put(url, v, i, &sum);
+    }
+    if (ohash_isempty(f->blocks))
+        free_file(f);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void blockcache_drop(const char *url)
+{
+    pthread_mutex_lock(&cache_mutex);
+    struct cached_file *f = find_file(url);
+    if (f != NULL)
+        free_file(f);
+    pthread_mutex_unlock(&cache_mutex);
+}
@@ -0,0 +1,63 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Blocks of file data read from the servers, kept across opens. Every file
+   has the version (modification time and size) its blocks were read at,
+   blocks of another version are never returned. Least recently used blocks
+   go first once the cache is full.
+
+   Whether the version is still current is up to the caller, see the lease
+   of a handle in handle.h. The checksums of the blocks are kept longer,
+   see blocksum.h.
+*/
+
+#ifndef BLOCKCACHE_H
+#define BLOCKCACHE_H
+
+#include <sys/types.h>
+#include <time.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define BLOCKCACHE_BLOCK (64 * 1024)
+
+struct blockcache_version {
+    time_t mtime;
+    off_t size;
+};
+
+/* The cache holds up to size bytes, 0 turns it off */
+void blockcache_set_size(size_t size);
+int blockcache_enabled(void);
+void blockcache_free(void);
+
+/* Copies size bytes at offset, fewer at the end of the file. Returns the
+   number of bytes copied, or -1 when any of them is not cached. */
+ssize_t blockcache_get(const char *url, const struct blockcache_version *v,
+    char *buf, size_t size, off_t offset);
+
+/* Returns 1 when all of the size bytes at offset are cached */
+int blockcache_has(const char *url, const struct blockcache_version *v,
+    size_t size, off_t offset);
+
+/* Keeps the whole blocks in the len bytes at offset, and the last block of
+   the file */
+void blockcache_put(const char *url, const struct blockcache_version *v,
+    const char *buf, size_t len, off_t offset);
+
+/* Forget the blocks of url */
+void blockcache_drop(const char *url);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // BLOCKCACHE_H
@@ -0,0 +1,183 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "blocksum.h"
+
+struct file_sums {
+    char *url;                  /* NULL when the slot is free */
+    struct blockcache_version version;
+    struct blocksum *sums;
+    size_t count;
+    unsigned long used;         /* for evicting the least recently used */
+};
+
+static struct file_sums files[BLOCKSUM_FILES];
+static unsigned long uses = 0;
+static pthread_mutex_t sums_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+void blocksum_compute(const char *data, size_t len, struct blocksum *sum)
+{
+    uint32_t a = 0, b = 0;
+    uint64_t h = 0xcbf29ce484222325ULL;
+    size_t i;
+
+    for (i = 0; i < len; i++)
+    {
+        unsigned char c = (unsigned char)data[i];
+        a += c;
+        b += (uint32_t)(len - i) * c;
+        h = (h ^ c) * 0x100000001b3ULL;
+    }
+    sum->weak = (a & 0xffff) | (b << 16);
+    sum->known = 1;
+    sum->strong = h;
+}
+
+int blocksum_equal(const struct blocksum *a, const struct blocksum *b)
+{
+    return a->known && b->known && a->weak == b->weak &&
+        a->strong == b->strong;
+}
+
+/*
+ * Called with sums_mutex held, as are the functions below
+ */
+static void clear(struct file_sums *f)
+{
+    free(f->url);
+    free(f->sums);
+    f->url = NULL;
+    f->sums = NULL;
+    f->count = 0;
+}
+
+static struct file_sums *find(const char *url)
+{
+    int i;
+
+    for (i = 0; i < BLOCKSUM_FILES; i++)
+        if (files[i].url != NULL && strcmp(files[i].url, url) == 0)
+        {
+            files[i].used = ++uses;
+            return &files[i];
+        }
+    return NULL;
+}
+
+/*
+ * The entry of url for version v, emptied when it was of another version
+ */
+static struct file_sums *find_version(const char *url,
+                                      const struct blockcache_version *v)
+{
+    struct file_sums *f = find(url);
+    int i;
+
+    if (f == NULL)
+    {
+        f = &files[0];
+        for (i = 0; i < BLOCKSUM_FILES && f->url != NULL; i++)
+            if (files[i].url == NULL || files[i].used < f->used)
+                f = &files[i];
+        clear(f);
+        if (NULL == (f->url = strdup(url)))
+            return NULL;
+        f->used = ++uses;
+    }
+    else if (f->version.mtime != v->mtime || f->version.size != v->size)
+    {
+        free(f->sums);
+        f->sums = NULL;
+        f->count = 0;
+    }
+    f->version = *v;
+    return f;
+}
+
+void blocksum_put(const char *url, const struct blockcache_version *v,
+                  off_t index, const struct blocksum *sum)
+{
+    pthread_mutex_lock(&sums_mutex);
+    struct file_sums *f = find_version(url, v);
+    if (f != NULL && index >= (off_t)f->count)
+    {
+        struct blocksum *sums = (struct blocksum *)realloc(f->sums,
+            (index + 1) * sizeof(struct blocksum));
+        if (sums == NULL)
+            f = NULL;
+        else
+        {
+            memset(sums + f->count, 0,
+                   (index + 1 - f->count) * sizeof(struct blocksum));
+            f->sums = sums;
+            f->count = index + 1;
+        }
+    }
+    if (f != NULL)
+        f->sums[index] = *sum;
+    pthread_mutex_unlock(&sums_mutex);
+}
+
+void blocksum_set(const char *url, const struct blockcache_version *v,
+                  const struct blocksum *sums, size_t count)
+{
+    pthread_mutex_lock(&sums_mutex);
+    struct file_sums *f = find_version(url, v);
+    if (f != NULL)
+    {
+        free(f->sums);
+        f->sums = NULL;
+        f->count = 0;
+        if (count > 0 && NULL != (f->sums = (struct blocksum *)malloc(
+                count * sizeof(struct blocksum))))
+        {
+            memcpy(f->sums, sums, count * sizeof(struct blocksum));
+            f->count = count;
+        }
+    }
+    pthread_mutex_unlock(&sums_mutex);
+}
+
+ssize_t blocksum_get(const char *url, struct blockcache_version *v,
+                     struct blocksum **sums)
+{
+    ssize_t count = -1;
+
+    pthread_mutex_lock(&sums_mutex);
+    struct file_sums *f = find(url);
+    if (f != NULL && f->count > 0 && NULL != (*sums = (struct blocksum *)
+            malloc(f->count * sizeof(struct blocksum))))
+    {
+        memcpy(*sums, f->sums, f->count * sizeof(struct blocksum));
+        *v = f->version;
+        count = f->count;
+    }
+    pthread_mutex_unlock(&sums_mutex);
+    return count;
+}
+
+void blocksum_drop(const char *url)
+{
+    pthread_mutex_lock(&sums_mutex);
+    struct file_sums *f = find(url);
+    if (f != NULL)
+        clear(f);
+    pthread_mutex_unlock(&sums_mutex);
+}
+
+void blocksum_free(void)
+{
+    int i;
+
+    pthread_mutex_lock(&sums_mutex);
+    for (i = 0; i < BLOCKSUM_FILES; i++)
+        clear(&files[i]);
+    pthread_mutex_unlock(&sums_mutex);
+}
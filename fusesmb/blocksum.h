@@ -0,0 +1,67 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Checksums of the blocks of files as they are on the server, for the
+   version (see blockcache.h) they were seen at. The block cache adds them
+   for the blocks it keeps, and they stay after the blocks are evicted; the
+   write-back journal adds them for what it uploads. When a file is
+   rewritten, blocks whose checksums match are not sent again (see
+   journal.h).
+
+   A block is BLOCKCACHE_BLOCK bytes, the last one of a file may be
+   shorter. Checksums are a rolling checksum as rsync's weak one, to
+   compare quickly, and a 64-bit FNV-1a hash to be sure.
+*/
+
+#ifndef BLOCKSUM_H
+#define BLOCKSUM_H
+
+#include <sys/types.h>
+#include <stdint.h>
+#include "blockcache.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define BLOCKSUM_FILES 64       /* files checksums are kept for */
+
+struct blocksum {
+    uint32_t weak;
+    uint32_t known;             /* 0 for a block not seen */
+    uint64_t strong;
+};
+
+void blocksum_compute(const char *data, size_t len, struct blocksum *sum);
+
+/* Returns 1 when both are known and equal */
+int blocksum_equal(const struct blocksum *a, const struct blocksum *b);
+
+/* The block at index of version v of url, forgetting checksums of other
+   versions */
+void blocksum_put(const char *url, const struct blockcache_version *v,
+    off_t index, const struct blocksum *sum);
+
+/* Replace the checksums of url with count of them for version v */
+void blocksum_set(const char *url, const struct blockcache_version *v,
+    const struct blocksum *sums, size_t count);
+
+/* A copy of the checksums of url in sums, to be freed, and their version
+   in v. Returns their number or -1 when there are none. */
+ssize_t blocksum_get(const char *url, struct blockcache_version *v,
+    struct blocksum **sums);
+
+void blocksum_drop(const char *url);
+void blocksum_free(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // BLOCKSUM_H
@@ -0,0 +1,219 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/types.h>
+#include "brlock.h"
+
+#define OFF_MAX ((off_t)(~(unsigned long long)0 >> 1))
+
+/* A locked range, end included */
+struct range {
+    char *url;
+    uint64_t owner;
+    pid_t pid;
+    int type;                   /* F_RDLCK or F_WRLCK */
+    off_t start;
+    off_t end;
+    struct range *next;
+};
+
+/* Few files are locked at a time, a list will do */
+static struct range *ranges = NULL;
+static pthread_mutex_t brlock_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t brlock_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * Called with brlock_mutex held, as are the functions below
+ */
+static struct range *conflict(const char *url, uint64_t owner, int type,
+                              off_t start, off_t end)
+{
+    struct range *r;
+
+    for (r = ranges; r != NULL; r = r->next)
+    {
+        if (r->owner == owner || strcmp(r->url, url) != 0)
+            continue;
+        if (r->end < start || r->start > end)
+            continue;
+        if (type == F_WRLCK || r->type == F_WRLCK)
+            return r;
+    }
+    return NULL;
+}
+
+static struct range *new_range(const char *url, uint64_t owner, pid_t pid,
+                               int type, off_t start, off_t end)
+{
+    struct range *r = (struct range *)malloc(sizeof(struct range));
+    if (r == NULL || NULL == (r->url = strdup(url)))
+    {
+        free(r);
+        return NULL;
+    }
+    r->owner = owner;
+    r->pid = pid;
+    r->type = type;
+    r->start = start;
+    r->end = end;
+    r->next = NULL;
+    return r;
+}
+
+/*
+ * Take [start, end] out of the ranges of owner, splitting a range that
+ * reaches past both sides. Returns -1 when that split is out of memory.
+ */
+static int unlock_range(const char *url, uint64_t owner, off_t start,
+                        off_t end)
+{
+    struct range **p = &ranges;
+
+    while (*p != NULL)
+    {
+        struct range *r = *p;
+        if (r->owner != owner || strcmp(r->url, url) != 0 ||
+            r->end < start || r->start > end)
+        {
+            p = &r->next;
+            continue;
+        }
+        if (r->start < start && r->end > end)
+        {
+            struct range *tail = new_range(url, owner, r->pid, r->type,
+                                           end + 1, r->end);
+            if (tail == NULL)
+                return -1;
+            r->end = start - 1;
+            tail->next = r->next;
+            r->next = tail;
+            return 0;
+        }
+        if (r->start < start)
+            r->end = start - 1;
+        else if (r->end > end)
+            r->start = end + 1;
+        else
+        {
+            *p = r->next;
+            free(r->url);
+            free(r);
+            continue;
+        }
+        p = &r->next;
+    }
+    return 0;
+}
+
+int brlock_lock(const char *url, uint64_t owner, int cmd,
+                struct flock *lock)
+{
+    off_t start = lock->l_start, end;
+    struct range *r;
+
+    if (lock->l_len < 0)
+    {
+        start += lock->l_len;
+        end = lock->l_start - 1;
+    }
+    else
+        end = lock->l_len == 0 ? OFF_MAX : start + lock->l_len - 1;
+    if (start < 0 || end < start)
+    {
+        errno = EINVAL;
+        return -1;
+    }
+
+    pthread_mutex_lock(&brlock_mutex);
+    if (cmd == F_GETLK)
+    {
+        r = conflict(url, owner, lock->l_type, start, end);
+        if (r == NULL)
+            lock->l_type = F_UNLCK;
+        else
+        {
+            lock->l_type = r->type;
+            lock->l_whence = SEEK_SET;
+            lock->l_start = r->start;
+            lock->l_len = r->end == OFF_MAX ? 0 : r->end - r->start + 1;
+            lock->l_pid = r->pid;
+        }
+        pthread_mutex_unlock(&brlock_mutex);
+        return 0;
+    }
+
+    if (lock->l_type == F_UNLCK)
+    {
+        int ret = unlock_range(url, owner, start, end);
+        pthread_cond_broadcast(&brlock_cond);
+        pthread_mutex_unlock(&brlock_mutex);
+        if (ret == -1)
+            errno = ENOLCK;
+        return ret;
+    }
+
+    while (NULL != conflict(url, owner, lock->l_type, start, end))
+    {
+        if (cmd != F_SETLKW)
+        {
+            pthread_mutex_unlock(&brlock_mutex);
+            errno = EAGAIN;
+            return -1;
+        }
+        pthread_cond_wait(&brlock_cond, &brlock_mutex);
+    }
+
+    /* A new lock replaces what the owner held of the range */
+    r = new_range(url, owner, lock->l_pid, lock->l_type, start, end);
+    if (r == NULL || -1 == unlock_range(url, owner, start, end))
+    {
+        if (r != NULL)
+        {
+            free(r->url);
+            free(r);
+        }
+        pthread_mutex_unlock(&brlock_mutex);
+        errno = ENOLCK;
+        return -1;
+    }
+    r->next = ranges;
+    ranges = r;
+    /* A write lock turned into a read lock may let others in */
+    pthread_cond_broadcast(&brlock_cond);
+    pthread_mutex_unlock(&brlock_mutex);
+    return 0;
+}
+
+void brlock_release(const char *url, uint64_t owner)
+{
+    pthread_mutex_lock(&brlock_mutex);
+    unlock_range(url, owner, 0, OFF_MAX);
+    pthread_cond_broadcast(&brlock_cond);
+    pthread_mutex_unlock(&brlock_mutex);
+}
+
+void brlock_rename(const char *url, const char *new_url)
+{
+    struct range *r;
+
+    pthread_mutex_lock(&brlock_mutex);
+    for (r = ranges; r != NULL; r = r->next)
+    {
+        if (strcmp(r->url, url) != 0)
+            continue;
+        char *copy = strdup(new_url);
+        if (copy == NULL)
+            continue;
+        free(r->url);
+        r->url = copy;
+    }
+    pthread_mutex_unlock(&brlock_mutex);
+}
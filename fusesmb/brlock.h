@@ -0,0 +1,44 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* POSIX byte-range locks (fcntl F_GETLK, F_SETLK and F_SETLKW) on the files
+   of the mount. libsmbclient has no call for SMB byte-range locks, so the
+   locks are kept here: they hold between the processes using the mount,
+   but other clients of the server don't see them.
+
+   Ranges of one owner are not merged, and waiting for a lock does not
+   detect deadlocks.
+*/
+
+#ifndef BRLOCK_H
+#define BRLOCK_H
+
+#include <fcntl.h>
+#include <stdint.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* cmd and lock as for fcntl(), l_start relative to the start of the file.
+   Returns 0 or -1 with errno set, EAGAIN when a range is taken. */
+int brlock_lock(const char *url, uint64_t owner, int cmd,
+    struct flock *lock);
+
+/* Release all locks of owner on url */
+void brlock_release(const char *url, uint64_t owner);
+
+/* The file was renamed */
+void brlock_rename(const char *url, const char *new_url);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // BRLOCK_H
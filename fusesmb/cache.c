@@ -35,6 +35,7 @@
 #include "stringlist.h"
 #include "smbctx.h"
 #include "hash.h"
+#include "hashpool.h"
 #include "configfile.h"
 #include "debug.h"
 
@@ -45,6 +46,14 @@
 stringlist_t *cache;
 pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
 
+/*
+ * Shares are appended to the journal as soon as a server has been listed, so
+ * fusesmb can show them before the whole scan has finished. The journal is
+ * removed again once the complete cache file has been written.
+ * Protected by cache_mutex.
+ */
+FILE *journal = NULL;
+
 struct fusesmb_cache_opt {
     stringlist_t *ignore_servers;
     stringlist_t *ignore_workgroups;
@@ -85,7 +94,8 @@ static void options_free(struct fusesmb_cache_opt *opt)
  * Some servers refuse to return a server list using libsmbclient, so using
  *  broadcast lookup through nmblookup
  */
-static int nmblookup(const char *wg, stringlist_t *sl, hash_t *ipcache)
+static int nmblookup(const char *wg, stringlist_t *sl, hash_t *ipcache,
+                     hashpool_t *pool)
 {
     /* Find all ips for the workgroup by running :
     $ nmblookup 'workgroup_name'
@@ -215,7 +225,12 @@ static int nmblookup(const char *wg, stringlist_t *sl, hash_t *ipcache)
             }
             sl_add(sl, start, 1);
             if (NULL == hash_lookup(ipcache, start))
-                hash_alloc_insert(ipcache, strdup(start), strdup(ip));
+            {
+                const char *key = hashpool_intern(pool, start);
+                const char *value = hashpool_intern(pool, ip);
+                if (key != NULL && value != NULL)
+                    hash_alloc_insert(ipcache, key, (void *)value);
+            }
             debug("%s : %s", ip, start);
         }
 
@@ -225,6 +240,30 @@ static int nmblookup(const char *wg, stringlist_t *sl, hash_t *ipcache)
     return 0;
 }
 
+static void journal_open(void)
+{
+    char journalfile[1024];
+    get_path_in_settings_dir(&journalfile[0], sizeof(journalfile),
+        "fusesmb.cache.journal");
+    mode_t oldmask;
+    oldmask = umask(022);
+    journal = fopen(journalfile, "w");
+    umask(oldmask);
+}
+
+static void journal_close(void)
+{
+    if (journal == NULL)
+        return;
+    fclose(journal);
+    journal = NULL;
+
+    char journalfile[1024];
+    get_path_in_settings_dir(&journalfile[0], sizeof(journalfile),
+        "fusesmb.cache.journal");
+    unlink(journalfile);
+}
+
 static int server_listing(SMBCCTX *ctx, stringlist_t *cache, const char *wg, const char *sv, const char *ip)
 {
     //return 0;
@@ -271,9 +310,16 @@ static int server_listing(SMBCCTX *ctx, stringlist_t *cache, const char *wg, con
             //smbc_free_context(ctx, 1);
             return -1;
         }
+        if (journal != NULL)
+            fprintf(journal, "%s\n", tmp);
         pthread_mutex_unlock(&cache_mutex);
 
     }
+    /* Publish all shares of this server at once */
+    pthread_mutex_lock(&cache_mutex);
+    if (journal != NULL)
+        fflush(journal);
+    pthread_mutex_unlock(&cache_mutex);
     ctx->closedir(ctx, dir);
     //smbc_free_context(ctx, 1);
     return 0;
@@ -284,14 +330,25 @@ static void *workgroup_listing_thread(void *args)
     char *wg = (char *)args;
     //SMBCCTX *ctx, stringlist_t *cache, hash_t *ip_cache, const char *wg
 
+    /* Nodes, names and ips all come from the pool, so the table is thrown
+       away at once when the workgroup is done */
+    hashpool_t *ip_pool = hashpool_create();
+    if (NULL == ip_pool)
+        return NULL;
     hash_t *ip_cache = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
     if (NULL == ip_cache)
+    {
+        hashpool_destroy(ip_pool);
         return NULL;
+    }
+    hashpool_attach(ip_pool, ip_cache);
 
     stringlist_t *servers = sl_init();
     if (NULL == servers)
     {
         fprintf(stderr, "Malloc failed\n");
+        hash_destroy(ip_cache);
+        hashpool_destroy(ip_pool);
         return NULL;
     }
     SMBCCTX *ctx = fusesmb_cache_new_context(&cfg);
@@ -325,7 +382,7 @@ static void *workgroup_listing_thread(void *args)
 use_popen:
 
 
-    nmblookup(wg, servers, ip_cache);
+    nmblookup(wg, servers, ip_cache, ip_pool);
     sl_casesort(servers);
 
     size_t i;
@@ -338,7 +395,11 @@ use_popen:
         /* Check if this server is in the ignore list in fusesmb.conf */
         if (NULL != opts.ignore_servers)
         {
-            if (NULL != sl_find(opts.ignore_servers, sl_item(servers, i)))
+            /* sl_casefind builds its index on first use, so serialize */
+            pthread_mutex_lock(&cache_mutex);
+            char *ignored = sl_casefind(opts.ignore_servers, sl_item(servers, i));
+            pthread_mutex_unlock(&cache_mutex);
+            if (NULL != ignored)
             {
                 debug("Ignoring %s", sl_item(servers, i));
                 continue;
@@ -362,19 +423,9 @@ use_popen:
             server_listing(ctx, cache, wg, sl_item(servers, i), (const char*)hnode_get(node));
     }
 
-    hscan_t sc;
-    hnode_t *n;
-    hash_scan_begin(&sc, ip_cache);
-    while (NULL != (n = hash_scan_next(&sc)))
-    {
-        void *data = hnode_get(n);
-        const void *key = hnode_getkey(n);
-        hash_scan_delfree(ip_cache, n);
-        free((void *)key);
-        free(data);
-
-    }
+    hash_forget_nodes(ip_cache);
     hash_destroy(ip_cache);
+    hashpool_destroy(ip_pool);
     sl_free(servers);
     smbc_free_context(ctx, 1);
     return 0;
@@ -409,10 +460,15 @@ int cache_servers(SMBCCTX *ctx)
         return -1;
     }
 
+    journal_open();
+
     pthread_t *threads;
     threads = (pthread_t *)malloc(sizeof(pthread_t));
     if (NULL == threads)
+    {
+        journal_close();
         return -1;
+    }
     pthread_attr_t thread_attr;
     pthread_attr_init(&thread_attr);
     pthread_attr_setdetachstate(&thread_attr, PTHREAD_CREATE_JOINABLE);
@@ -432,7 +488,7 @@ int cache_servers(SMBCCTX *ctx)
 
         if (opts.ignore_workgroups != NULL)
         {
-            if (NULL != sl_find(opts.ignore_workgroups, workgroup_dirent->name))
+            if (NULL != sl_casefind(opts.ignore_workgroups, workgroup_dirent->name))
             {
                 debug("Ignoring Workgroup: %s", workgroup_dirent->name);
                 continue;
@@ -486,6 +542,7 @@ int cache_servers(SMBCCTX *ctx)
     umask(oldmask);
     if (fp == NULL)
     {
+        journal_close();
         sl_free(cache);
         return -1;
     }
@@ -497,10 +554,105 @@ int cache_servers(SMBCCTX *ctx)
     fclose(fp);
     /* Make refreshing cache file atomic */
     rename(tmp_cachefile, cachefile);
+    journal_close();
     sl_free(cache);
     return 0;
 }
 
+/*
+ * fusesmb-scan -p server: print the newest SMB dialect server accepts, for
+ * the dialect probe of fusesmb (see dialect.h). The protocol range is global
+ * to libsmbclient, so the steps down from the newest dialect are tried in a
+ * process of their own and nothing in fusesmb waits for them.
+ */
+#define PROBE_TIMEOUT 5000      /* ms */
+#define PROBE_STEP_TIMEOUT 1000 /* ms, the server answered already */
+
+/* Newest first */
+static const char *probe_protocols[] = {
+    "SMB3_11", "SMB3_02", "SMB3_00", "SMB2_10", "SMB2_02", "NT1", NULL
+};
+
+/*
+ * Errors after which trying an older dialect makes no sense
+ */
+static int probe_unreachable(int error)
+{
+    switch (error)
+    {
+        case EHOSTDOWN:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+        case ENETDOWN:
+        case ECONNREFUSED:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Whether server negotiates a dialect from min to max. Failing to log in or
+ * list the shares still means the negotiation went fine. Returns 0 or the
+ * errno.
+ */
+static int probe_range(SMBCCTX *ctx, const char *server, const char *min,
+                       const char *max)
+{
+    char url[1024];
+    int error = 0;
+
+    snprintf(url, sizeof(url), "smb://%s", server);
+#ifdef HAVE_LIBSMBCLIENT_PROTOCOLS
+    smbc_setOptionProtocols(ctx, min, max);
+#endif
+    SMBCFILE *dir = ctx->opendir(ctx, url);
+    if (dir == NULL)
+        error = errno;
+    else
+        ctx->closedir(ctx, dir);
+    /* Nothing negotiated in the range may be left for the next step */
+    ctx->callbacks.purge_cached_fn(ctx);
+
+    debug("%s with %s-%s: %s", server, min, max,
+          error ? strerror(error) : "ok");
+    return error == EACCES || error == EPERM ? 0 : error;
+}
+
+/*
+ * Whether the server answers at all is tried with the default range first,
+ * only then come the steps, each with a shorter timeout
+ */
+static int probe_dialect(const char *server)
+{
+    int i, found = -1;
+
+    SMBCCTX *ctx = fusesmb_cache_new_context(&cfg);
+    if (ctx == NULL)
+        return -1;
+    ctx->timeout = PROBE_TIMEOUT;
+    if (0 != probe_range(ctx, server, "NT1", "SMB3"))
+    {
+        smbc_free_context(ctx, 1);
+        return -1;
+    }
+    ctx->timeout = PROBE_STEP_TIMEOUT;
+    for (i = 0; probe_protocols[i] != NULL; i++)
+    {
+        int error = probe_range(ctx, server, probe_protocols[i],
+                                probe_protocols[i]);
+        if (error == 0)
+            found = i;
+        if (error == 0 || probe_unreachable(error))
+            break;
+    }
+    smbc_free_context(ctx, 1);
+    if (found == -1)
+        return -1;
+    printf("%s\n", probe_protocols[found]);
+    return fflush(stdout) == 0 ? 0 : -1;
+}
+
 int main(int argc, char *argv[])
 {
     char pidfile[1024];
@@ -516,6 +668,13 @@ int main(int argc, char *argv[])
     }
     options_read(&cfg, &opts);
 
+    if (argc == 3 && 0 == strcmp(argv[1], "-p"))
+    {
+        int ret = probe_dialect(argv[2]);
+        options_free(&opts);
+        exit(ret == 0 ? EXIT_SUCCESS : EXIT_FAILURE);
+    }
+
     struct stat st;
     if (argc == 1)
     {
@@ -0,0 +1,412 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "ohash.h"
+#include "cmap.h"
+
+#define DEFAULT_STRIPES 64
+#define MAX_STRIPES 4096
+#define CACHE_LINE 64
+
+/*
+ * Each stripe sits on its own cache line, otherwise readers of different
+ * stripes would still bounce the line holding their locks between cores
+ */
+typedef union cmap_stripe {
+    struct {
+        pthread_rwlock_t lock;
+        ohash_t *table;
+    } s;
+    char pad[CACHE_LINE * ((sizeof(pthread_rwlock_t) + sizeof(ohash_t *)
+        + CACHE_LINE - 1) / CACHE_LINE)];
+} cmap_stripe_t;
+
+struct cmap {
+    cmap_stripe_t *stripes;
+    void *stripes_mem;
+    unsigned int nstripes;
+    unsigned int shift;
+    size_t value_size;
+    size_t key_offset;          /* value_size rounded up to pointer size */
+};
+
+/*
+ * An entry is one allocation, the value followed by the key. The ohash node
+ * points at both.
+ */
+static void *entry_new(cmap_t *map, const char *key, const void *value)
+{
+    size_t keylen = strlen(key) + 1;
+    char *entry = (char *)malloc(map->key_offset + keylen);
+    if (entry == NULL)
+        return NULL;
+    memcpy(entry, value, map->value_size);
+    memcpy(entry + map->key_offset, key, keylen);
+    return entry;
+}
+
+static cmap_stripe_t *stripe_of(cmap_t *map, const char *key)
+{
+    /* ohash indexes on the low bits, so pick the stripe from the high ones */
+    hash_val_t hkey = ohash_fun_string(key);
+    if (map->nstripes == 1)
+        return map->stripes;
+    return &map->stripes[hkey >> map->shift];
+}
+
+cmap_t *cmap_create(size_t value_size, unsigned int nstripes)
+{
+    unsigned int i, bits = 0;
+
+    if (nstripes == 0)
+        nstripes = DEFAULT_STRIPES;
+    if (nstripes > MAX_STRIPES)
+        nstripes = MAX_STRIPES;
+    while ((1U << bits) < nstripes)
+        bits++;
+    nstripes = 1U << bits;
+
+    cmap_t *map = (cmap_t *)malloc(sizeof(cmap_t));
+    if (map == NULL)
+        return NULL;
+
+    map->stripes_mem = malloc((nstripes + 1) * sizeof(cmap_stripe_t));
+    if (map->stripes_mem == NULL)
+    {
+        free(map);
+        return NULL;
+    }
+    map->stripes = (cmap_stripe_t *)(((unsigned long)map->stripes_mem
+        + CACHE_LINE - 1) & ~(unsigned long)(CACHE_LINE - 1));
+    map->nstripes = nstripes;
+    map->shift = sizeof(hash_val_t) * 8 - bits;
+    map->value_size = value_size;
+    map->key_offset = (value_size + sizeof(void *) - 1)
+        & ~(sizeof(void *) - 1);
+
+    for (i = 0; i < nstripes; i++)
+    {
+        cmap_stripe_t *stripe = &map->stripes[i];
+        stripe->s.table = ohash_create(HASHCOUNT_T_MAX, NULL, NULL);
+        if (stripe->s.table == NULL
+            || 0 != pthread_rwlock_init(&stripe->s.lock, NULL))
+        {
+            if (stripe->s.table != NULL)
+                ohash_destroy(stripe->s.table);
+            map->nstripes = i;
+            cmap_destroy(map);
+            return NULL;
+        }
+    }
+    return map;
+}
+
+static void stripe_clear(cmap_stripe_t *stripe)
+{
+    ohscan_t scan;
+    ohnode_t *node;
+
+    ohash_scan_begin(&scan, stripe->s.table);
+    while (NULL != (node = ohash_scan_next(&scan)))
+        free(ohnode_get(node));
+    ohash_clear(stripe->s.table);
+}
+
+void cmap_destroy(cmap_t *map)
+{
+    unsigned int i;
+
+    if (map == NULL)
+        return;
+    for (i = 0; i < map->nstripes; i++)
+    {
+        stripe_clear(&map->stripes[i]);
+        ohash_destroy(map->stripes[i].s.table);
+        pthread_rwlock_destroy(&map->stripes[i].s.lock);
+    }
+    free(map->stripes_mem);
+    free(map);
+}
+
+int cmap_put(cmap_t *map, const char *key, const void *value)
+{
+    cmap_stripe_t *stripe = stripe_of(map, key);
+    int ret = 0;
+
+    pthread_rwlock_wrlock(&stripe->s.lock);
+    ohnode_t *node = ohash_lookup(stripe->s.table, key);
+    if (node != NULL)
+    {
+        memcpy(ohnode_get(node), value, map->value_size);
+    }
+    else
+    {
+        char *entry = (char *)entry_new(map, key, value);
+        if (entry == NULL
+            || !ohash_insert(stripe->s.table, entry + map->key_offset, entry))
+        {
+            free(entry);
+            ret = -1;
+        }
+    }
+    pthread_rwlock_unlock(&stripe->s.lock);
+    return ret;
+}
+
+int cmap_get(cmap_t *map, const char *key, void *value)
+{
+    cmap_stripe_t *stripe = stripe_of(map, key);
+    int ret = -1;
+
+    pthread_rwlock_rdlock(&stripe->s.lock);
+    ohnode_t *node = ohash_lookup(stripe->s.table, key);
+    if (node != NULL)
+    {
+        if (value != NULL)
+            memcpy(value, ohnode_get(node), map->value_size);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&stripe->s.lock);
+    return ret;
+}
+
+int cmap_update(cmap_t *map, const char *key, cmap_visit_t fun, void *arg)
+{
+    cmap_stripe_t *stripe = stripe_of(map, key);
+
+    pthread_rwlock_wrlock(&stripe->s.lock);
+    ohnode_t *node = ohash_lookup(stripe->s.table, key);
+    if (node == NULL)
+    {
+        char *entry = (char *)malloc(map->key_offset + strlen(key) + 1);
+        if (entry == NULL)
+        {
+            pthread_rwlock_unlock(&stripe->s.lock);
+            return -1;
+        }
+        memset(entry, 0, map->value_size);
+        strcpy(entry + map->key_offset, key);
+        if (!ohash_insert(stripe->s.table, entry + map->key_offset, entry))
+        {
+            free(entry);
+            pthread_rwlock_unlock(&stripe->s.lock);
+            return -1;
+        }
+        node = ohash_lookup(stripe->s.table, key);
+    }
+    if (fun((const char *)ohnode_getkey(node), ohnode_get(node), arg))
+    {
+        free(ohnode_get(node));
+        ohash_delete(stripe->s.table, node);
+    }
+    pthread_rwlock_unlock(&stripe->s.lock);
+    return 0;
+}
+
+int cmap_remove(cmap_t *map, const char *key)
+{
+    cmap_stripe_t *stripe = stripe_of(map, key);
+    int ret = -1;
+
+    pthread_rwlock_wrlock(&stripe->s.lock);
+    ohnode_t *node = ohash_lookup(stripe->s.table, key);
+    if (node != NULL)
+    {
+        free(ohnode_get(node));
+        ohash_delete(stripe->s.table, node);
+        ret = 0;
+    }
+    pthread_rwlock_unlock(&stripe->s.lock);
+    return ret;
+}
+
+static int match_prefix(const char *key, void *value, void *arg)
+{
+    const char *prefix = (const char *)arg;
+    size_t len = strlen(prefix);
+    (void)value;
+
+    if (strncmp(key, prefix, len) != 0)
+        return 0;
+    return key[len] == '\0' || key[len] == '/';
+}
+
+size_t cmap_remove_prefix(cmap_t *map, const char *key)
+{
+    return cmap_remove_if(map, match_prefix, (void *)key);
+}
+
+size_t cmap_remove_if(cmap_t *map, cmap_visit_t fun, void *arg)
+{
+    size_t removed = 0;
+    unsigned int i;
+
+    for (i = 0; i < map->nstripes; i++)
+    {
+        cmap_stripe_t *stripe = &map->stripes[i];
+        ohscan_t scan;
+        ohnode_t *node;
+
+        pthread_rwlock_wrlock(&stripe->s.lock);
+        ohash_scan_begin(&scan, stripe->s.table);
+        while (NULL != (node = ohash_scan_next(&scan)))
+        {
+            if (fun((const char *)ohnode_getkey(node), ohnode_get(node), arg))
+            {
+                free(ohnode_get(node));
+                ohash_delete(stripe->s.table, node);
+                removed++;
+            }
+        }
+        pthread_rwlock_unlock(&stripe->s.lock);
+    }
+    return removed;
+}
+
+void cmap_clear(cmap_t *map)
+{
+    unsigned int i;
+
+    for (i = 0; i < map->nstripes; i++)
+    {
+        pthread_rwlock_wrlock(&map->stripes[i].s.lock);
+        stripe_clear(&map->stripes[i]);
+        pthread_rwlock_unlock(&map->stripes[i].s.lock);
+    }
+}
+
+size_t cmap_count(cmap_t *map)
+{
+    size_t count = 0;
+    unsigned int i;
+
+    for (i = 0; i < map->nstripes; i++)
+    {
+        pthread_rwlock_rdlock(&map->stripes[i].s.lock);
+        count += ohash_count(map->stripes[i].s.table);
+        pthread_rwlock_unlock(&map->stripes[i].s.lock);
+    }
+    return count;
+}
+
+#ifdef RUN_BENCHMARK
+
+/*
+ * Read scaling across threads, against one table behind one mutex (what the
+ * FUSE callbacks do with ctx_mutex today). Build with:
+ *  gcc -O2 -c ohash.c
+ *  gcc -O2 -DRUN_BENCHMARK -o cmap-bench cmap.c ohash.o -lpthread
+ *
+ * Runs up to as many threads as there are cores, or as given on the command
+ * line. On one core cmap is slower than the single mutex (finding the stripe
+ * and copying the value cost more than an uncontended lock): the stripes
+ * only pay off with readers on several cores.
+ */
+
+#include <stdio.h>
+#include <unistd.h>
+#include <sys/time.h>
+
+#define BENCH_KEYS 50000
+#define BENCH_LOOKUPS 2000000
+
+static char *bench_keys[BENCH_KEYS];
+static ohash_t *bench_table;
+static pthread_mutex_t bench_mutex = PTHREAD_MUTEX_INITIALIZER;
+static cmap_t *bench_map;
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static void *mutex_reader(void *arg)
+{
+    unsigned long i, found = 0, seed = (unsigned long)arg;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        pthread_mutex_lock(&bench_mutex);
+        ohnode_t *node = ohash_lookup(bench_table,
+            bench_keys[(seed >> 33) % BENCH_KEYS]);
+        if (node != NULL)
+            found += *(long *)ohnode_get(node) >= 0;
+        pthread_mutex_unlock(&bench_mutex);
+    }
+    return (void *)found;
+}
+
+static void *cmap_reader(void *arg)
+{
+    unsigned long i, found = 0, seed = (unsigned long)arg;
+    long value;
+
+    for (i = 0; i < BENCH_LOOKUPS; i++)
+    {
+        seed = seed * 6364136223846793005UL + 1442695040888963407UL;
+        if (0 == cmap_get(bench_map, bench_keys[(seed >> 33) % BENCH_KEYS],
+            &value))
+            found += value >= 0;
+    }
+    return (void *)found;
+}
+
+static double run(void *(*reader)(void *), int nthreads)
+{
+    pthread_t threads[64];
+    double t = now_ms();
+    long i;
+
+    for (i = 0; i < nthreads; i++)
+        pthread_create(&threads[i], NULL, reader, (void *)(i + 1));
+    for (i = 0; i < nthreads; i++)
+        pthread_join(threads[i], NULL);
+    t = now_ms() - t;
+    /* million lookups per second */
+    return nthreads * (double)BENCH_LOOKUPS / t / 1000.0;
+}
+
+int main(int argc, char *argv[])
+{
+    char buf[256];
+    long i;
+    int n, ncpu = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    int nthreads = argc > 1 ? atoi(argv[1]) : ncpu;
+
+    if (nthreads < 1)
+        nthreads = 1;
+    if (nthreads > 64)
+        nthreads = 64;
+    bench_table = ohash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    bench_map = cmap_create(sizeof(long), 0);
+    for (i = 0; i < BENCH_KEYS; i++)
+    {
+        snprintf(buf, sizeof(buf), "/WORKGROUP/SERVER%ld/share/file%ld",
+            i % 37, i);
+        bench_keys[i] = strdup(buf);
+        ohash_insert(bench_table, bench_keys[i], &bench_keys[i]);
+        cmap_put(bench_map, bench_keys[i], &i);
+    }
+
+    printf("%d cores\n", ncpu);
+    printf("threads   mutex Mops/s   cmap Mops/s\n");
+    for (n = 1; n <= nthreads; n *= 2)
+        printf("%7d   %12.2f   %11.2f\n", n, run(mutex_reader, n),
+            run(cmap_reader, n));
+
+    cmap_destroy(bench_map);
+    ohash_destroy(bench_table);
+    for (i = 0; i < BENCH_KEYS; i++)
+        free(bench_keys[i]);
+    return 0;
+}
+
+#endif /* RUN_BENCHMARK */
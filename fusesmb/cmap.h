@@ -0,0 +1,65 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Thread safe string keyed map for caches shared by the FUSE threads. Keys
+   are spread over a number of stripes, each one an ohash table behind its own
+   read/write lock, so readers of different (or even the same) keys do not
+   serialize on one mutex. Values have a fixed size and are copied in and out,
+   a caller never holds a pointer into the map once the call returns.
+*/
+
+#ifndef CMAP_H
+#define CMAP_H
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct cmap cmap_t;
+
+/* Called with the stripe write locked, return nonzero to remove the entry.
+   The value may be modified in place. */
+typedef int (*cmap_visit_t)(const char *key, void *value, void *arg);
+
+/* nstripes is rounded up to a power of two, 0 picks the default */
+cmap_t *cmap_create(size_t value_size, unsigned int nstripes);
+void cmap_destroy(cmap_t *map);
+
+/* Returns 0 on success, -1 when out of memory. Replaces an existing value. */
+int cmap_put(cmap_t *map, const char *key, const void *value);
+
+/* Returns 0 and copies the value when found, -1 otherwise. value may be
+   NULL to only test for the key. */
+int cmap_get(cmap_t *map, const char *key, void *value);
+
+/* Call fun on the value of key under the stripe lock, a missing key is added
+   with a zeroed value first. The entry is removed when fun returns nonzero.
+   Returns 0 on success, -1 when out of memory. */
+int cmap_update(cmap_t *map, const char *key, cmap_visit_t fun, void *arg);
+
+/* Returns 0 when the key was removed, -1 when it was not there */
+int cmap_remove(cmap_t *map, const char *key);
+
+/* Remove the key and every key below it, i.e. "key/...". Returns the number
+   of entries removed. */
+size_t cmap_remove_prefix(cmap_t *map, const char *key);
+
+/* Visit every entry, one stripe at a time. Returns the number removed. */
+size_t cmap_remove_if(cmap_t *map, cmap_visit_t fun, void *arg);
+
+void cmap_clear(cmap_t *map);
+size_t cmap_count(cmap_t *map);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // CMAP_H
@@ -1,4 +1,8 @@
 #define HAVE_LIBSMBCLIENT_CLOSE_FN
+#define HAVE_LIBSMBCLIENT_PROTOCOLS
+#define HAVE_LIBSMBCLIENT_THREAD_POSIX
+#define HAVE_LIBSMBCLIENT_NOTIFY
+#define HAVE_LIBSMBCLIENT_SPLICE
 #define FUSESMB_SCAN_BINDIR "/bin"
 
 #define FUSE_USE_VERSION 26
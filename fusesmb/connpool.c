@@ -0,0 +1,390 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "connpool.h"
+#include "debug.h"
+
+#define PREWARM_NAME 256
+
+/*
+ * One cached connection. libsmbclient keeps one per server and share, keyed
+ * the same way as its own cache: server, share, workgroup and username.
+ */
+struct connpool_entry {
+    struct connpool_entry *next;
+    SMBCCTX *ctx;
+    SMBCSRV *srv;
+    char *server;
+    char *share;
+    char *workgroup;
+    char *username;
+    time_t last_used;
+    time_t last_keepalive;
+};
+
+static struct connpool_entry *entries = NULL;
+static pthread_mutex_t pool_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static const char *nonnull(const char *str)
+{
+    return str == NULL ? "" : str;
+}
+
+static int pool_add(SMBCCTX *c, SMBCSRV *srv, const char *server,
+                    const char *share, const char *workgroup,
+                    const char *username)
+{
+    size_t server_len = strlen(nonnull(server)) + 1;
+    size_t share_len = strlen(nonnull(share)) + 1;
+    size_t workgroup_len = strlen(nonnull(workgroup)) + 1;
+    size_t username_len = strlen(nonnull(username)) + 1;
+
+    /* The strings follow the entry in the same allocation */
+    struct connpool_entry *entry = (struct connpool_entry *)malloc(
+        sizeof(struct connpool_entry) + server_len + share_len
+        + workgroup_len + username_len);
+    if (entry == NULL)
+        return 1;
+
+    entry->server = (char *)(entry + 1);
+    entry->share = entry->server + server_len;
+    entry->workgroup = entry->share + share_len;
+    entry->username = entry->workgroup + workgroup_len;
+    memcpy(entry->server, nonnull(server), server_len);
+    memcpy(entry->share, nonnull(share), share_len);
+    memcpy(entry->workgroup, nonnull(workgroup), workgroup_len);
+    memcpy(entry->username, nonnull(username), username_len);
+    entry->ctx = c;
+    entry->srv = srv;
+    entry->last_used = entry->last_keepalive = time(NULL);
+
+    pthread_mutex_lock(&pool_mutex);
+    entry->next = entries;
+    entries = entry;
+    pthread_mutex_unlock(&pool_mutex);
+    debug("connected to //%s/%s", entry->server, entry->share);
+    return 0;
+}
+
+/*
+ * libsmbclient looks up the connection for every path based call, which makes
+ * this the place to record when a server was last used
+ */
+static SMBCSRV *pool_get(SMBCCTX *c, const char *server, const char *share,
+                         const char *workgroup, const char *username)
+{
+    struct connpool_entry *entry;
+    SMBCSRV *srv = NULL;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (entry = entries; entry != NULL; entry = entry->next)
+    {
+        if (entry->ctx == c &&
+            strcmp(entry->server, nonnull(server)) == 0 &&
+            strcmp(entry->share, nonnull(share)) == 0 &&
+            strcmp(entry->workgroup, nonnull(workgroup)) == 0 &&
+            strcmp(entry->username, nonnull(username)) == 0)
+        {
+            entry->last_used = time(NULL);
+            srv = entry->srv;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return srv;
+}
+
+static int pool_remove(SMBCCTX *c, SMBCSRV *srv)
+{
+    struct connpool_entry **prev, *entry;
+    int ret = 1;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (prev = &entries; (entry = *prev) != NULL; prev = &entry->next)
+    {
+        if (entry->ctx == c && entry->srv == srv)
+        {
+            *prev = entry->next;
+            debug("disconnected from //%s/%s", entry->server, entry->share);
+            free(entry);
+            ret = 0;
+            break;
+        }
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return ret;
+}
+
+/*
+ * Copy the connections of a context, removing one only frees its own entry
+ * so the others stay valid while the caller walks the array
+ */
+static struct connpool_entry **pool_snapshot(SMBCCTX *c, size_t *count)
+{
+    struct connpool_entry *entry, **snapshot;
+    size_t n = 0;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (entry = entries; entry != NULL; entry = entry->next)
+        if (entry->ctx == c)
+            n++;
+    snapshot = (struct connpool_entry **)malloc(
+        (n + 1) * sizeof(struct connpool_entry *));
+    if (snapshot != NULL)
+    {
+        n = 0;
+        for (entry = entries; entry != NULL; entry = entry->next)
+            if (entry->ctx == c)
+                snapshot[n++] = entry;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    *count = n;
+    return snapshot;
+}
+
+/* Used by smbc_free_context(), returns 1 while connections are busy */
+static int pool_purge(SMBCCTX *c)
+{
+    size_t i, count;
+    int busy = 0;
+    struct connpool_entry **snapshot = pool_snapshot(c, &count);
+    if (snapshot == NULL)
+        return 1;
+
+    for (i = 0; i < count; i++)
+        if (0 != c->callbacks.remove_unused_server_fn(c, snapshot[i]->srv))
+            busy = 1;
+    free(snapshot);
+    return busy;
+}
+
+void connpool_attach(SMBCCTX *ctx)
+{
+    ctx->callbacks.add_cached_srv_fn = pool_add;
+    ctx->callbacks.get_cached_srv_fn = pool_get;
+    ctx->callbacks.remove_cached_srv_fn = pool_remove;
+    ctx->callbacks.purge_cached_fn = pool_purge;
+}
+
+int connpool_maintain(SMBCCTX *ctx, connpool_idle_fn idle_timeout,
+                      int keepalive)
+{
+    size_t i, count;
+    int open = 0;
+    struct connpool_entry **snapshot = pool_snapshot(ctx, &count);
+    if (snapshot == NULL)
+        return -1;
+
+    for (i = 0; i < count; i++)
+    {
+        struct connpool_entry *entry = snapshot[i];
+        time_t now = time(NULL);
+
+        pthread_mutex_lock(&pool_mutex);
+        time_t idle = now - entry->last_used;
+        time_t since_keepalive = now - entry->last_keepalive;
+        pthread_mutex_unlock(&pool_mutex);
+
+        if (idle >= idle_timeout(entry->server))
+        {
+            /* Fails when files are still open on it, so it is in use */
+            if (0 == ctx->callbacks.remove_unused_server_fn(ctx, entry->srv))
+                continue;
+            pthread_mutex_lock(&pool_mutex);
+            entry->last_used = now;
+            pthread_mutex_unlock(&pool_mutex);
+        }
+        else if (keepalive > 0 && since_keepalive >= keepalive)
+        {
+            /* Sends an SMB echo, so the server doesn't drop the session */
+            if (0 != ctx->callbacks.check_server_fn(ctx, entry->srv) &&
+                0 == ctx->callbacks.remove_unused_server_fn(ctx, entry->srv))
+                continue;
+            pthread_mutex_lock(&pool_mutex);
+            entry->last_keepalive = now;
+            pthread_mutex_unlock(&pool_mutex);
+        }
+        open++;
+    }
+    free(snapshot);
+    return open;
+}
+
+int connpool_idle_time(const char *server, const char *share)
+{
+    struct connpool_entry *entry;
+    time_t now = time(NULL);
+    int idle = -1;
+
+    pthread_mutex_lock(&pool_mutex);
+    for (entry = entries; entry != NULL; entry = entry->next)
+    {
+        if (strcasecmp(entry->server, server) == 0 &&
+            (share == NULL || strcasecmp(entry->share, share) == 0) &&
+            (idle == -1 || now - entry->last_used < idle))
+            idle = now - entry->last_used;
+    }
+    pthread_mutex_unlock(&pool_mutex);
+    return idle;
+}
+
+/*
+ * Prewarming: a single worker sets up connections for a small queue of
+ * servers and shares. When the queue is full the oldest request is dropped,
+ * the user has most likely moved on from it. Every cancel starts a new
+ * generation, requests of an older one are skipped even when the worker
+ * already picked them up.
+ */
+struct prewarm_request {
+    char server[PREWARM_NAME];
+    char share[PREWARM_NAME];
+    unsigned int generation;
+};
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    connpool_begin_fn begin;
+    connpool_end_fn end;
+    struct prewarm_request queue[CONNPOOL_PREWARM_QUEUE];
+    int head;
+    int count;
+    unsigned int generation;
+    int running;
+} prewarm;
+
+static int prewarm_current(unsigned int generation)
+{
+    pthread_mutex_lock(&prewarm.mutex);
+    int current = prewarm.running && generation == prewarm.generation;
+    pthread_mutex_unlock(&prewarm.mutex);
+    return current;
+}
+
+static void *prewarm_thread(void *data)
+{
+    (void)data;
+    struct prewarm_request request;
+    char url[2 * PREWARM_NAME + 8];
+
+    pthread_mutex_lock(&prewarm.mutex);
+    while (1)
+    {
+        while (prewarm.running && prewarm.count == 0)
+            pthread_cond_wait(&prewarm.cond, &prewarm.mutex);
+        if (!prewarm.running)
+            break;
+        request = prewarm.queue[prewarm.head];
+        prewarm.head = (prewarm.head + 1) % CONNPOOL_PREWARM_QUEUE;
+        prewarm.count--;
+        pthread_mutex_unlock(&prewarm.mutex);
+
+        const char *share = request.share[0] != '\0' ? request.share : NULL;
+        if (connpool_idle_time(request.server, share) == -1)
+        {
+            snprintf(url, sizeof(url), "smb://%s%s%s", request.server,
+                     share != NULL ? "/" : "", request.share);
+            SMBCCTX *ctx = prewarm.begin(request.server);
+            /* Checked again, the wait for the context can be long */
+            if (prewarm_current(request.generation))
+            {
+                debug("prewarming %s", url);
+                SMBCFILE *dir = ctx->opendir(ctx, url);
+                if (dir != NULL)
+                    ctx->closedir(ctx, dir);
+            }
+            prewarm.end(ctx);
+        }
+        pthread_mutex_lock(&prewarm.mutex);
+    }
+    pthread_mutex_unlock(&prewarm.mutex);
+    return NULL;
+}
+
+int connpool_prewarm_init(connpool_begin_fn begin, connpool_end_fn end)
+{
+    pthread_mutex_init(&prewarm.mutex, NULL);
+    pthread_cond_init(&prewarm.cond, NULL);
+    prewarm.begin = begin;
+    prewarm.end = end;
+    prewarm.head = prewarm.count = 0;
+    prewarm.generation = 0;
+    prewarm.running = 1;
+    if (0 != pthread_create(&prewarm.thread, NULL, prewarm_thread, NULL))
+    {
+        prewarm.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void connpool_prewarm_shutdown(void)
+{
+    pthread_mutex_lock(&prewarm.mutex);
+    if (!prewarm.running)
+    {
+        pthread_mutex_unlock(&prewarm.mutex);
+        return;
+    }
+    prewarm.running = 0;
+    pthread_cond_signal(&prewarm.cond);
+    pthread_mutex_unlock(&prewarm.mutex);
+    pthread_join(prewarm.thread, NULL);
+}
+
+void connpool_prewarm_cancel(void)
+{
+    pthread_mutex_lock(&prewarm.mutex);
+    prewarm.generation++;
+    prewarm.count = 0;
+    pthread_mutex_unlock(&prewarm.mutex);
+}
+
+void connpool_prewarm(const char *server, const char *share)
+{
+    int i;
+
+    if (share == NULL)
+        share = "";
+    if (strlen(server) >= PREWARM_NAME || strlen(share) >= PREWARM_NAME ||
+        connpool_idle_time(server, share[0] != '\0' ? share : NULL) != -1)
+        return;
+
+    pthread_mutex_lock(&prewarm.mutex);
+    if (!prewarm.running)
+    {
+        pthread_mutex_unlock(&prewarm.mutex);
+        return;
+    }
+    for (i = 0; i < prewarm.count; i++)
+    {
+        struct prewarm_request *queued =
+            &prewarm.queue[(prewarm.head + i) % CONNPOOL_PREWARM_QUEUE];
+        if (strcasecmp(queued->server, server) == 0 &&
+            strcasecmp(queued->share, share) == 0)
+        {
+            pthread_mutex_unlock(&prewarm.mutex);
+            return;
+        }
+    }
+    if (prewarm.count == CONNPOOL_PREWARM_QUEUE)
+    {
+        prewarm.head = (prewarm.head + 1) % CONNPOOL_PREWARM_QUEUE;
+        prewarm.count--;
+    }
+    struct prewarm_request *request =
+        &prewarm.queue[(prewarm.head + prewarm.count) % CONNPOOL_PREWARM_QUEUE];
+    strcpy(request->server, server);
+    strcpy(request->share, share);
+    request->generation = prewarm.generation;
+    prewarm.count++;
+    pthread_cond_signal(&prewarm.cond);
+    pthread_mutex_unlock(&prewarm.mutex);
+}
@@ -0,0 +1,70 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Connection manager for the libsmbclient contexts of fusesmb. It replaces
+   the server cache of a context, so it knows every open connection and when
+   it was last used. Idle connections are closed after a per server timeout,
+   connections in use get a keepalive, and connections to a server the user
+   is browsing can be set up in the background before they are needed.
+
+   All functions taking a context must be called with that context locked,
+   like any other libsmbclient call.
+*/
+
+#ifndef CONNPOOL_H
+#define CONNPOOL_H
+
+#include <libsmbclient.h>
+#include <pthread.h>
+#include <time.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Returns the idle timeout in seconds for a server, 0 closes it whenever it
+   is unused */
+typedef int (*connpool_idle_fn)(const char *server);
+
+/* Install the connection cache, right after the context was created */
+void connpool_attach(SMBCCTX *ctx);
+
+/* Close idle connections and send keepalives on the others, for the periodic
+   cleanup. Returns the number of connections still open. */
+int connpool_maintain(SMBCCTX *ctx, connpool_idle_fn idle_timeout,
+    int keepalive);
+
+/* Seconds since a connection to a share of server was last used in any
+   context, -1 if there is none. share NULL matches any share. */
+int connpool_idle_time(const char *server, const char *share);
+
+/* Context for a connection to server, locked, and giving it back */
+typedef SMBCCTX *(*connpool_begin_fn)(const char *server);
+typedef void (*connpool_end_fn)(SMBCCTX *ctx);
+
+/* Connections queued at most, more are dropped */
+#define CONNPOOL_PREWARM_QUEUE 16
+
+/* Background connection setup, the worker takes the context to connect on
+   with begin for each connection */
+int connpool_prewarm_init(connpool_begin_fn begin, connpool_end_fn end);
+void connpool_prewarm_shutdown(void);
+
+/* Queue a connection to smb://server/share, if there is none yet. share may
+   be NULL to only connect to the server. */
+void connpool_prewarm(const char *server, const char *share);
+
+/* Drop everything queued so far, the user went somewhere else */
+void connpool_prewarm_cancel(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // CONNPOOL_H
@@ -0,0 +1,232 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/*
+ * fusesmb-cp source target
+ *
+ * Copies a file. When both are in the same share of a fusesmb mount the
+ * server copies it itself, at the speed of its disks instead of that of
+ * the network (see server_copy() in fusesmb.c). Otherwise, or when the
+ * server can't, the data is copied the usual way.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/param.h>
+#include <sys/stat.h>
+#include <fs_attr.h>
+#include <fs_info.h>
+#include <TypeConstants.h>
+
+/* As in fusesmb.c */
+#define COPY_ATTRIBUTE "fusesmb:copy-to"
+#define BUFFER_SIZE (256 * 1024)
+
+/*
+ * The directory the volume of path is mounted on, path has to be absolute
+ */
+static int mount_root(const char *path, char *root, size_t size)
+{
+    char parent[MAXPATHLEN];
+    struct stat st, parent_st;
+
+    if (strlen(path) >= size || strlen(path) >= sizeof(parent))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (stat(path, &st) < 0)
+        return -1;
+    strcpy(root, path);
+    while (strcmp(root, "/") != 0)
+    {
+        strcpy(parent, root);
+        char *slash = strrchr(parent, '/');
+        if (slash == parent)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+        if (stat(parent, &parent_st) < 0)
+            return -1;
+        if (parent_st.st_dev != st.st_dev)
+            break;
+        strcpy(root, parent);
+    }
+    return 0;
+}
+
+/*
+ * FUSE file systems like fusesmb are mounted through userlandfs, which one
+ * it is shows once it handled the copy attribute, see copy_on_server()
+ */
+static int on_userlandfs(dev_t dev)
+{
+    fs_info info;
+
+    return fs_stat_dev(dev, &info) == 0 &&
+        strcmp(info.fsh_name, "userlandfs") == 0;
+}
+
+/*
+ * Asks fusesmb to copy source to target on the server. Returns 0 or -1 with
+ * errno set, ENOTSUP when the volume is not fusesmb.
+ */
+static int copy_on_server(const char *source, const char *target)
+{
+    char src[MAXPATHLEN], dir[MAXPATHLEN], dst[MAXPATHLEN], root[MAXPATHLEN];
+    struct stat src_st, dir_st;
+    const char *name;
+
+    /* The target need not exist yet, its directory does */
+    if (strlen(target) >= sizeof(dir))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    strcpy(dir, target);
+    char *slash = strrchr(dir, '/');
+    if (slash == NULL)
+    {
+        strcpy(dir, ".");
+        name = target;
+    }
+    else
+    {
+        name = target + (slash - dir) + 1;
+        if (slash == dir)
+            slash[1] = '\0';
+        else
+            *slash = '\0';
+    }
+    if (NULL == realpath(source, src) || NULL == realpath(dir, dst) ||
+        stat(src, &src_st) < 0 || stat(dst, &dir_st) < 0)
+        return -1;
+    if (src_st.st_dev != dir_st.st_dev)
+    {
+        errno = EXDEV;
+        return -1;
+    }
+    if (!on_userlandfs(src_st.st_dev))
+    {
+        errno = ENOTSUP;
+        return -1;
+    }
+    if (strlen(dst) + strlen(name) + 2 > sizeof(dst))
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    if (strcmp(dst, "/") != 0)
+        strcat(dst, "/");
+    strcat(dst, name);
+
+    /* fusesmb sees paths from the root of its mount */
+    if (-1 == mount_root(src, root, sizeof(root)))
+        return -1;
+    const char *value = dst + (strcmp(root, "/") == 0 ? 0 : strlen(root));
+
+    int fd = open(src, O_RDONLY);
+    if (fd < 0)
+        return -1;
+    ssize_t ret = fs_write_attr(fd, COPY_ATTRIBUTE, B_STRING_TYPE, 0, value,
+                                strlen(value) + 1);
+    int error = errno;
+    /* fusesmb copies instead of keeping the attribute, another file system
+       stored it and nothing was copied */
+    struct attr_info info;
+    if (ret >= 0 && 0 == fs_stat_attr(fd, COPY_ATTRIBUTE, &info))
+    {
+        fs_remove_attr(fd, COPY_ATTRIBUTE);
+        ret = -1;
+        error = ENOTSUP;
+    }
+    close(fd);
+    errno = error;
+    return ret < 0 ? -1 : 0;
+}
+
+/*
+ * Returns 0 or -1 with errno set
+ */
+static int copy_data(const char *source, const char *target)
+{
+    struct stat st;
+    int error = 0;
+
+    int in = open(source, O_RDONLY);
+    if (in < 0)
+        return -1;
+    if (fstat(in, &st) < 0)
+    {
+        error = errno;
+        close(in);
+        errno = error;
+        return -1;
+    }
+    int out = open(target, O_WRONLY | O_CREAT | O_TRUNC, st.st_mode & 0777);
+    char *buf = (char *)malloc(BUFFER_SIZE);
+    if (out < 0 || buf == NULL)
+        error = out < 0 ? errno : ENOMEM;
+    while (error == 0)
+    {
+        ssize_t len = read(in, buf, BUFFER_SIZE), pos = 0;
+        if (len <= 0)
+        {
+            error = len < 0 ? errno : 0;
+            break;
+        }
+        while (error == 0 && pos < len)
+        {
+            ssize_t ret = write(out, buf + pos, len - pos);
+            if (ret < 0)
+                error = errno;
+            else
+                pos += ret;
+        }
+    }
+    free(buf);
+    if (out >= 0 && close(out) < 0 && error == 0)
+        error = errno;
+    close(in);
+    errno = error;
+    return error == 0 ? 0 : -1;
+}
+
+int main(int argc, char *argv[])
+{
+    char target[MAXPATHLEN];
+    struct stat st;
+
+    if (argc != 3)
+    {
+        fprintf(stderr, "Usage: %s source target\n", argv[0]);
+        return 1;
+    }
+
+    /* Into a directory under the name of the source */
+    snprintf(target, sizeof(target), "%s", argv[2]);
+    if (0 == stat(argv[2], &st) && S_ISDIR(st.st_mode))
+    {
+        const char *name = strrchr(argv[1], '/');
+        snprintf(target, sizeof(target), "%s/%s", argv[2],
+                 name != NULL ? name + 1 : argv[1]);
+    }
+
+    if (0 == copy_on_server(argv[1], target))
+        return 0;
+    if (-1 == copy_data(argv[1], target))
+    {
+        fprintf(stderr, "%s: copying %s to %s failed (%s)\n", argv[0],
+                argv[1], target, strerror(errno));
+        return 1;
+    }
+    return 0;
+}
@@ -0,0 +1,174 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <time.h>
+#include "cmap.h"
+#include "dialect.h"
+#include "stats.h"
+#include "debug.h"
+
+#define DIALECT_MIN "NT1"           /* range when the dialect is not known */
+#define DIALECT_MAX "SMB3"
+#define DIALECT_RETRY 60            /* seconds before probing a server again */
+#define SMALL_IOSIZE (64 * 1024)
+#define LARGE_IOSIZE (1024 * 1024)
+#define MAX_IOSIZE (8 * 1024 * 1024)
+
+struct server_dialect {
+    struct dialect_info info;
+    time_t probed;
+    int failed;                 /* no dialect worked, retry later */
+};
+
+static cmap_t *servers = NULL;
+static dialect_probe_fn probe_fn;
+static dialect_config_fn config_fn;
+
+int dialect_init(dialect_probe_fn probe, dialect_config_fn config)
+{
+    servers = cmap_create(sizeof(struct server_dialect), 4);
+    if (servers == NULL)
+        return -1;
+    probe_fn = probe;
+    config_fn = config;
+    return 0;
+}
+
+void dialect_shutdown(void)
+{
+    cmap_destroy(servers);
+    servers = NULL;
+}
+
+void dialect_forget(void)
+{
+    if (servers != NULL)
+        cmap_clear(servers);
+}
+
+size_t dialect_iosize(const char *protocol)
+{
+    /* SMB 2.1 brought multi credit requests, larger ones than 64 KiB. A
+       plain SMB2 means up to SMB2_10 for libsmbclient. */
+    if (0 == strncmp(protocol, "SMB3", 4) || 0 == strcmp(protocol, "SMB2_10")
+        || 0 == strcmp(protocol, "SMB2"))
+        return LARGE_IOSIZE;
+    return SMALL_IOSIZE;
+}
+
+static void set_protocols(SMBCCTX *c, const char *min, const char *max)
+{
+#ifdef HAVE_LIBSMBCLIENT_PROTOCOLS
+    smbc_setOptionProtocols(c, min, max);
+#else
+    (void)c;
+    (void)min;
+    (void)max;
+#endif
+}
+
+static void upper(const char *server, char *key, size_t size)
+{
+    size_t i;
+
+    for (i = 0; server[i] != '\0' && i < size - 1; i++)
+        key[i] = toupper((unsigned char)server[i]);
+    key[i] = '\0';
+}
+
+int dialect_lookup(const char *server, struct dialect_info *info)
+{
+    char key[256];
+    struct server_dialect sd;
+
+    upper(server, key, sizeof(key));
+    if (servers == NULL || -1 == cmap_get(servers, key, &sd))
+        return -1;
+    *info = sd.info;
+    if (sd.failed && time(NULL) - sd.probed >= DIALECT_RETRY)
+        return -1;
+    return 0;
+}
+
+void dialect_get(const char *server, struct dialect_info *info)
+{
+    char key[256];
+    struct server_dialect sd;
+    size_t iosize = 0;
+
+    upper(server, key, sizeof(key));
+    if (servers != NULL && 0 == cmap_get(servers, key, &sd) &&
+        (!sd.failed || time(NULL) - sd.probed < DIALECT_RETRY))
+    {
+        *info = sd.info;
+        return;
+    }
+
+    memset(&sd, 0, sizeof(sd));
+    if (config_fn != NULL)
+        config_fn(key, sd.info.protocol, sizeof(sd.info.protocol), &iosize);
+    sd.info.pinned = sd.info.protocol[0] != '\0';
+    if (sd.info.protocol[0] == '\0' && key[0] != '\0' &&
+        (probe_fn == NULL ||
+         -1 == probe_fn(key, sd.info.protocol, sizeof(sd.info.protocol))))
+    {
+        debug("no dialect found for %s", key);
+        sd.failed = 1;
+    }
+
+    if (iosize == 0)
+        iosize = sd.info.protocol[0] ? dialect_iosize(sd.info.protocol)
+                                     : SMALL_IOSIZE;
+    if (iosize < 4096)
+        iosize = 4096;
+    if (iosize > MAX_IOSIZE)
+        iosize = MAX_IOSIZE;
+    sd.info.iosize = iosize;
+    sd.probed = time(NULL);
+
+    if (servers != NULL && key[0] != '\0')
+    {
+        cmap_put(servers, key, &sd);
+        stats_server_dialect(key, sd.info.protocol, sd.info.iosize);
+    }
+    *info = sd.info;
+}
+
+void dialect_range(const char *server, char *range, size_t size)
+{
+    char key[256];
+    struct dialect_info info;
+    size_t iosize;
+
+    range[0] = '\0';
+    if (server[0] == '\0')
+        return;
+    /* Configured ones hold before the first request, too */
+    if (0 == dialect_lookup(server, &info))
+    {
+        if (info.pinned)
+        {
+            strncpy(range, info.protocol, size - 1);
+            range[size - 1] = '\0';
+        }
+    }
+    else if (config_fn != NULL)
+    {
+        upper(server, key, sizeof(key));
+        config_fn(key, range, size, &iosize);
+    }
+}
+
+void dialect_set_range(SMBCCTX *ctx, const char *range)
+{
+    if (range[0] != '\0')
+        set_protocols(ctx, range, range);
+    else
+        set_protocols(ctx, DIALECT_MIN, DIALECT_MAX);
+}
@@ -0,0 +1,79 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* SMB dialect and I/O size of each server. The first request to a server
+   probes the dialects from the newest down, and the first one the server
+   accepts is used for all later connections to it. The I/O size follows from the dialect: SMB 2.1 and later allow large
+   requests, older ones are limited to 64 KiB. Both can be set per server in
+   fusesmb.conf instead.
+
+   A probed dialect is what the default protocol range negotiates anyway, a
+   configured one is pinned. The protocol range of libsmbclient is a global
+   setting, the scheduler changes it for the servers that need another one
+   (see scheduler.h). The steps of a probe each need a range of their own,
+   so they run in another process, fusesmb-scan -p, and neither drain the
+   range of this one nor wait for it.
+*/
+
+#ifndef DIALECT_H
+#define DIALECT_H
+
+#include <sys/types.h>
+#include <libsmbclient.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define DIALECT_NAME 16
+
+struct dialect_info {
+    char protocol[DIALECT_NAME];    /* "" when it could not be probed */
+    size_t iosize;
+    int pinned;                     /* configured, not probed */
+};
+
+/* Configured protocol and I/O size of server, protocol[0] is '\0' and
+   iosize 0 for what is not configured */
+typedef void (*dialect_config_fn)(const char *server, char *protocol,
+    size_t size, size_t *iosize);
+
+/* Newest dialect server accepts into protocol, -1 when none or it does not
+   answer */
+typedef int (*dialect_probe_fn)(const char *server, char *protocol,
+    size_t size);
+
+int dialect_init(dialect_probe_fn probe, dialect_config_fn config);
+void dialect_shutdown(void);
+
+/* Settings of server, probing it first if needed */
+void dialect_get(const char *server, struct dialect_info *info);
+
+/* Settings of server without probing, returns -1 when it is not known yet
+   or should be probed again */
+int dialect_lookup(const char *server, struct dialect_info *info);
+
+/* Protocol range connections to server need: its pinned protocol, or ""
+   for the default range. A sched_range_fn. */
+void dialect_range(const char *server, char *range, size_t size);
+
+/* Make range the protocol range of libsmbclient, a sched_apply_fn */
+void dialect_set_range(SMBCCTX *ctx, const char *range);
+
+/* Probe all servers again, after the configuration changed */
+void dialect_forget(void);
+
+/* Largest request for a dialect */
+size_t dialect_iosize(const char *protocol);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // DIALECT_H
@@ -0,0 +1,605 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include "cmap.h"
+#include "dircache.h"
+#include "limit.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "debug.h"
+
+#define DIRCACHE_SIZE 128       /* listings kept */
+#define URL_MAX 1024
+#define NOTIFY_TICK_MS 1000     /* how often a watcher checks for a stop */
+#define NONOTIFY_MAX 16         /* servers remembered as not notifying */
+
+/* Entries are a type byte ('d' or 'f') and the name, NUL terminated */
+struct dircache_listing {
+    unsigned int generation;    /* of the cache at dircache_begin() */
+    char *names;
+    size_t len;
+    size_t size;
+    int failed;
+};
+
+struct dir {
+    char *url;                  /* NULL when the slot is free */
+    dircache_listing_t *listing;
+    double fetched;
+    double used;
+    double changed;             /* last change reported in the directory */
+};
+
+struct watcher {
+    pthread_t thread;
+    int started;
+    SMBCCTX *ctx;
+    char url[URL_MAX];          /* watched now, "" when idle */
+    char next[URL_MAX];         /* to watch next, "" for none */
+    double since;               /* the watch is in place, 0 before */
+    int stop;
+};
+
+static struct dir dirs[DIRCACHE_SIZE];
+static struct watcher watchers[DIRCACHE_WATCHERS];
+static char nonotify[NONOTIFY_MAX][256];
+static int nonotify_next = 0;
+static dircache_context_fn new_watch_context;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t watch_cond = PTHREAD_COND_INITIALIZER;
+static cmap_t *opens = NULL;   /* url to when it was last opened watched */
+static unsigned int generation = 0;
+static double ttl_ms = 5000;
+static int running = 0;
+
+static void listing_free(dircache_listing_t *listing)
+{
+    if (listing == NULL)
+        return;
+    free(listing->names);
+    free(listing);
+}
+
+/*
+ * Called with cache_mutex held, as are the functions below
+ */
+static struct dir *find_dir(const char *url)
+{
+    int i;
+
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+        if (dirs[i].url != NULL && strcmp(dirs[i].url, url) == 0)
+            return &dirs[i];
+    return NULL;
+}
+
+static void drop_dir(struct dir *d)
+{
+    if (opens != NULL)
+        cmap_remove_prefix(opens, d->url);
+    free(d->url);
+    listing_free(d->listing);
+    d->url = NULL;
+    d->listing = NULL;
+    generation++;
+}
+
+static struct watcher *find_watcher(const char *url)
+{
+    int i;
+
+    for (i = 0; i < DIRCACHE_WATCHERS; i++)
+        if (strcmp(watchers[i].url, url) == 0)
+            return &watchers[i];
+    return NULL;
+}
+
+static int is_fresh(struct dir *d)
+{
+    if (ttl_ms <= 0)
+        return 0;
+    if (stats_now_ms() - d->fetched < ttl_ms)
+        return 1;
+    /* Read after the watch was in place, so no change went unnoticed */
+    struct watcher *w = find_watcher(d->url);
+    return w != NULL && w->since > 0 && d->fetched >= w->since;
+}
+
+#ifdef HAVE_LIBSMBCLIENT_NOTIFY
+static int notifies(const char *url)
+{
+    char server[256];
+    int i;
+
+    limit_url_server(url, server, sizeof(server));
+    for (i = 0; i < NONOTIFY_MAX; i++)
+        if (strcasecmp(nonotify[i], server) == 0)
+            return 0;
+    return 1;
+}
+#endif
+
+/*
+ * Hand url to an idle watcher, or take the one of the directory used least
+ * recently when that is older
+ */
+static void watch(struct dir *d)
+{
+#ifdef HAVE_LIBSMBCLIENT_NOTIFY
+    struct watcher *victim = NULL;
+    double oldest = d->used;
+    int i;
+
+    if (!running || strlen(d->url) >= URL_MAX || !notifies(d->url))
+        return;
+    for (i = 0; i < DIRCACHE_WATCHERS; i++)
+        if (strcmp(watchers[i].url, d->url) == 0 ||
+            strcmp(watchers[i].next, d->url) == 0)
+            return;
+    for (i = 0; i < DIRCACHE_WATCHERS; i++)
+    {
+        struct watcher *w = &watchers[i];
+        if (w->url[0] == '\0' && w->next[0] == '\0')
+        {
+            victim = w;
+            break;
+        }
+        struct dir *other = find_dir(w->next[0] != '\0' ? w->next : w->url);
+        double used = other != NULL ? other->used : 0;
+        if (used < oldest)
+        {
+            oldest = used;
+            victim = w;
+        }
+    }
+    if (victim == NULL)
+        return;
+    strcpy(victim->next, d->url);
+    victim->stop = victim->url[0] != '\0';
+    pthread_cond_broadcast(&watch_cond);
+#else
+    (void)d;
+#endif
+}
+
+#ifdef HAVE_LIBSMBCLIENT_NOTIFY
+static void remove_name(dircache_listing_t *listing, const char *name)
+{
+    size_t pos = 0;
+
+    while (pos < listing->len)
+    {
+        size_t len = strlen(listing->names + pos) + 1;
+        if (strcasecmp(listing->names + pos + 1, name) == 0)
+        {
+            memmove(listing->names + pos, listing->names + pos + len,
+                    listing->len - pos - len);
+            listing->len -= len;
+            return;
+        }
+        pos += len;
+    }
+}
+
+/*
+ * Called by libsmbclient with the changes, or with none every tick. A
+ * nonzero return ends the watch.
+ */
+static int notified(const struct smbc_notify_callback_action *actions,
+                    size_t count, void *data)
+{
+    struct watcher *w = (struct watcher *)data;
+    size_t i;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct dir *d = find_dir(w->url);
+    if (!running || w->stop || d == NULL)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return 1;
+    }
+    if (count == 0 && w->since == 0)
+        w->since = stats_now_ms();
+    if (count > 0)
+        d->changed = stats_now_ms();
+    for (i = 0; i < count; i++)
+    {
+        switch (actions[i].action)
+        {
+        case SMBC_NOTIFY_ACTION_REMOVED:
+        case SMBC_NOTIFY_ACTION_OLD_NAME:
+            remove_name(d->listing, actions[i].filename);
+            generation++;
+            break;
+        case SMBC_NOTIFY_ACTION_ADDED:
+        case SMBC_NOTIFY_ACTION_NEW_NAME:
+            /* Whether it is a directory is not known, read it again */
+            drop_dir(d);
+            pthread_mutex_unlock(&cache_mutex);
+            return 1;
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return 0;
+}
+
+/*
+ * Returns 0 when the watch was stopped, -1 with errno set when it failed
+ */
+static int run_watch(struct watcher *w)
+{
+    char server[256];
+    int ret, error;
+
+    if (w->ctx == NULL && NULL == (w->ctx = new_watch_context()))
+    {
+        errno = ENOMEM;
+        return -1;
+    }
+    /* Only connecting depends on the protocol range, not the watch */
+    limit_url_server(w->url, server, sizeof(server));
+    sched_enter(server);
+    SMBCFILE *dir = w->ctx->opendir(w->ctx, w->url);
+    error = errno;
+    sched_leave();
+    if (dir == NULL)
+    {
+        errno = error;
+        return -1;
+    }
+    ret = smbc_getFunctionNotify(w->ctx)(w->ctx, dir, 0,
+        SMBC_NOTIFY_CHANGE_FILE_NAME | SMBC_NOTIFY_CHANGE_DIR_NAME |
+        SMBC_NOTIFY_CHANGE_SIZE | SMBC_NOTIFY_CHANGE_LAST_WRITE,
+        NOTIFY_TICK_MS, notified, w);
+    error = errno;
+    w->ctx->closedir(w->ctx, dir);
+    if (ret < 0)
+    {
+        /* Start over on a new connection next time */
+        smbc_free_context(w->ctx, 1);
+        w->ctx = NULL;
+    }
+    errno = error;
+    return ret < 0 ? -1 : 0;
+}
+
+static void *watch_thread(void *data)
+{
+    struct watcher *w = (struct watcher *)data;
+
+    pthread_mutex_lock(&cache_mutex);
+    while (running)
+    {
+        if (w->next[0] == '\0')
+        {
+            pthread_cond_wait(&watch_cond, &cache_mutex);
+            continue;
+        }
+        strcpy(w->url, w->next);
+        w->next[0] = '\0';
+        w->since = 0;
+        w->stop = 0;
+        pthread_mutex_unlock(&cache_mutex);
+
+        int ret = run_watch(w);
+        int error = errno;
+
+        pthread_mutex_lock(&cache_mutex);
+        struct dir *d = find_dir(w->url);
+        if (d != NULL && w->since > 0 && d->fetched >= w->since)
+        {
+            /* Right until now, changes from here on may go unnoticed */
+            if (ret == 0)
+                d->fetched = stats_now_ms();
+            else
+                drop_dir(d);
+        }
+        if (ret < 0)
+        {
+            debug("watching %s failed (%s)", w->url, strerror(error));
+            if (error == ENOTSUP || error == EOPNOTSUPP || error == ENOSYS ||
+                error == EINVAL)
+            {
+                char *server = nonotify[nonotify_next];
+                limit_url_server(w->url, server, sizeof(nonotify[0]));
+                nonotify_next = (nonotify_next + 1) % NONOTIFY_MAX;
+            }
+        }
+        w->url[0] = '\0';
+        w->since = 0;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return NULL;
+}
+#endif
+
+int dircache_init(dircache_context_fn new_context)
+{
+    int i;
+
+    pthread_mutex_lock(&cache_mutex);
+    if (opens == NULL && NULL == (opens = cmap_create(sizeof(double), 0)))
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+    new_watch_context = new_context;
+    running = 1;
+#ifdef HAVE_LIBSMBCLIENT_NOTIFY
+    for (i = 0; i < DIRCACHE_WATCHERS; i++)
+    {
+        watchers[i].ctx = NULL;
+        watchers[i].url[0] = '\0';
+        watchers[i].next[0] = '\0';
+        watchers[i].since = 0;
+        watchers[i].stop = 0;
+        watchers[i].started = 0 == pthread_create(&watchers[i].thread, NULL,
+                                                  watch_thread, &watchers[i]);
+    }
+#else
+    (void)i;
+#endif
+    pthread_mutex_unlock(&cache_mutex);
+    return 0;
+}
+
+void dircache_shutdown(void)
+{
+    int i;
+
+    pthread_mutex_lock(&cache_mutex);
+    running = 0;
+    pthread_cond_broadcast(&watch_cond);
+    pthread_mutex_unlock(&cache_mutex);
+
+    /* A watch ends at its next tick */
+    for (i = 0; i < DIRCACHE_WATCHERS; i++)
+    {
+        if (watchers[i].started)
+            pthread_join(watchers[i].thread, NULL);
+        watchers[i].started = 0;
+        if (watchers[i].ctx != NULL)
+            smbc_free_context(watchers[i].ctx, 1);
+        watchers[i].ctx = NULL;
+    }
+
+    pthread_mutex_lock(&cache_mutex);
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+        if (dirs[i].url != NULL)
+            drop_dir(&dirs[i]);
+    cmap_destroy(opens);
+    opens = NULL;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void dircache_set_ttl(int seconds)
+{
+    int i;
+
+    pthread_mutex_lock(&cache_mutex);
+    ttl_ms = seconds > 0 ? seconds * 1000.0 : 0;
+    if (ttl_ms == 0)
+        for (i = 0; i < DIRCACHE_SIZE; i++)
+            if (dirs[i].url != NULL)
+                drop_dir(&dirs[i]);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+int dircache_has(const char *url)
+{
+    pthread_mutex_lock(&cache_mutex);
+    struct dir *d = find_dir(url);
+    int ret = d != NULL && is_fresh(d) ? 0 : -1;
+    pthread_mutex_unlock(&cache_mutex);
+    return ret;
+}
+
+int dircache_list(const char *url, dircache_fill_fn fill, void *arg)
+{
+    char *names = NULL;
+    size_t pos, len = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct dir *d = find_dir(url);
+    if (d != NULL && is_fresh(d))
+    {
+        len = d->listing->len;
+        names = (char *)malloc(len + 1);
+        if (names != NULL)
+        {
+            memcpy(names, d->listing->names, len);
+            d->used = stats_now_ms();
+        }
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    if (names == NULL)
+        return -1;
+
+    /* fill is not called with the cache locked */
+    for (pos = 0; pos < len; pos += strlen(names + pos) + 1)
+        fill(arg, names + pos + 1, names[pos] == 'd');
+    free(names);
+    return 0;
+}
+
+dircache_listing_t *dircache_begin(void)
+{
+    pthread_mutex_lock(&cache_mutex);
+    int off = ttl_ms == 0;
+    unsigned int current = generation;
+    pthread_mutex_unlock(&cache_mutex);
+    if (off)
+        return NULL;
+
+    dircache_listing_t *listing =
+        (dircache_listing_t *)malloc(sizeof(dircache_listing_t));
+    if (listing == NULL)
+        return NULL;
+    listing->generation = current;
+    listing->names = NULL;
+    listing->len = 0;
+    listing->size = 0;
+    listing->failed = 0;
+    return listing;
+}
+
+void dircache_add(dircache_listing_t *listing, const char *name, int is_dir)
+{
+    size_t need = strlen(name) + 2;
+
+    if (listing == NULL || listing->failed)
+        return;
+    if (listing->len + need > listing->size)
+    {
+        size_t size = listing->size > 0 ? listing->size * 2 : 4096;
+        while (size < listing->len + need)
+            size *= 2;
+        char *names = (char *)realloc(listing->names, size);
+        if (names == NULL)
+        {
+            listing->failed = 1;
+            return;
+        }
+        listing->names = names;
+        listing->size = size;
+    }
+    listing->names[listing->len] = is_dir ? 'd' : 'f';
+    strcpy(listing->names + listing->len + 1, name);
+    listing->len += need;
+}
+
+void dircache_store(const char *url, dircache_listing_t *listing)
+{
+    int i;
+
+    if (listing == NULL)
+        return;
+    pthread_mutex_lock(&cache_mutex);
+    /* A change may have been missed while reading */
+    if (listing->failed || listing->generation != generation ||
+        ttl_ms == 0)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        listing_free(listing);
+        return;
+    }
+
+    struct dir *d = find_dir(url);
+    if (d == NULL)
+    {
+        char *copy = strdup(url);
+        if (copy == NULL)
+        {
+            pthread_mutex_unlock(&cache_mutex);
+            listing_free(listing);
+            return;
+        }
+        d = &dirs[0];
+        for (i = 0; i < DIRCACHE_SIZE; i++)
+        {
+            if (dirs[i].url == NULL)
+            {
+                d = &dirs[i];
+                break;
+            }
+            if (dirs[i].used < d->used)
+                d = &dirs[i];
+        }
+        if (d->url != NULL)
+            drop_dir(d);
+        d->url = copy;
+    }
+    listing_free(d->listing);
+    d->listing = listing;
+    d->fetched = stats_now_ms();
+    d->used = d->fetched;
+    d->changed = 0;
+    watch(d);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void dircache_abort(dircache_listing_t *listing)
+{
+    listing_free(listing);
+}
+
+void dircache_invalidate(const char *url)
+{
+    size_t len = strlen(url);
+    const char *slash = strrchr(url, '/');
+    size_t parent = slash != NULL ? (size_t)(slash - url) : 0;
+    int i;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (i = 0; i < DIRCACHE_SIZE; i++)
+    {
+        const char *dir = dirs[i].url;
+        if (dir == NULL)
+            continue;
+        if ((strlen(dir) == parent && strncmp(dir, url, parent) == 0) ||
+            (strncmp(dir, url, len) == 0 &&
+             (dir[len] == '\0' || dir[len] == '/')))
+            drop_dir(&dirs[i]);
+    }
+    /* Listings being read may already hold the old state */
+    generation++;
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+/*
+ * The watched directory holding url, or NULL
+ */
+static struct dir *watched_parent(const char *url, struct watcher **w)
+{
+    const char *slash = strrchr(url, '/');
+    char parent[URL_MAX];
+
+    if (slash == NULL || (size_t)(slash - url) >= sizeof(parent))
+        return NULL;
+    memcpy(parent, url, slash - url);
+    parent[slash - url] = '\0';
+
+    struct dir *d = find_dir(parent);
+    *w = d != NULL ? find_watcher(parent) : NULL;
+    return *w != NULL && (*w)->since > 0 ? d : NULL;
+}
+
+int dircache_unchanged(const char *url, double since)
+{
+    struct watcher *w;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct dir *d = watched_parent(url, &w);
+    int unchanged = d != NULL && w->since <= since && d->changed < since;
+    pthread_mutex_unlock(&cache_mutex);
+    return unchanged;
+}
+
+int dircache_opened(const char *url)
+{
+    struct watcher *w;
+    double now = stats_now_ms(), last;
+    int unchanged = 0;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct dir *d = watched_parent(url, &w);
+    if (opens != NULL && d != NULL)
+    {
+        /* Opened before within this watch, and nothing changed since */
+        unchanged = 0 == cmap_get(opens, url, &last) &&
+            last >= w->since && last > d->changed;
+        cmap_put(opens, url, &now);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return unchanged;
+}
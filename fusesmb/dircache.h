@@ -0,0 +1,87 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Listings of directories inside shares, so listing a folder again doesn't
+   go to the server. The most recently used directories are watched with
+   change notifications, each from a libsmbclient context of its own as a
+   notification request blocks its connection. A listing read while its
+   directory is watched stays until the server reports a change: removals
+   are patched in, anything added drops it. Other listings, and all of them
+   where the server or libsmbclient doesn't notify, expire after the TTL.
+
+   Changes made through fusesmb itself drop the listings they affect right
+   away, see dircache_invalidate().
+
+   The watches also report writes, so for a file in a watched directory it
+   is known whether the copy the kernel kept from the last open still
+   holds, see dircache_opened().
+*/
+
+#ifndef DIRCACHE_H
+#define DIRCACHE_H
+
+#include <libsmbclient.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define DIRCACHE_WATCHERS 4
+
+typedef SMBCCTX *(*dircache_context_fn)(void);
+
+/* Called for every entry of a cached listing */
+typedef void (*dircache_fill_fn)(void *arg, const char *name, int is_dir);
+
+typedef struct dircache_listing dircache_listing_t;
+
+int dircache_init(dircache_context_fn new_context);
+void dircache_shutdown(void);
+
+/* Seconds an unwatched listing is used, 0 turns the cache off */
+void dircache_set_ttl(int seconds);
+
+/* Returns 0 when a listing of url is cached, -1 otherwise */
+int dircache_has(const char *url);
+
+/* Calls fill for every entry and returns 0 when a listing of url is
+   cached, returns -1 otherwise */
+int dircache_list(const char *url, dircache_fill_fn fill, void *arg);
+
+/* Collect a listing while reading the directory from the server. Returns
+   NULL while the cache is off. */
+dircache_listing_t *dircache_begin(void);
+void dircache_add(dircache_listing_t *listing, const char *name, int is_dir);
+
+/* Cache the listing of url and start watching it, unless something changed
+   since dircache_begin(). Frees the listing. */
+void dircache_store(const char *url, dircache_listing_t *listing);
+
+/* Frees the listing of a read that failed */
+void dircache_abort(dircache_listing_t *listing);
+
+/* url was created, removed or renamed: drop the listing of the directory
+   holding it, and of url itself and everything below it */
+void dircache_invalidate(const char *url);
+
+/* The file url is being opened. Returns 1 when it was opened before while
+   its directory was watched, as it still is, and no change in the
+   directory was reported since, 0 otherwise. */
+int dircache_opened(const char *url);
+
+/* Returns 1 when the directory holding url has been watched since at least
+   since (in milliseconds since the epoch) and no change in it was reported
+   after that */
+int dircache_unchanged(const char *url, double since);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // DIRCACHE_H
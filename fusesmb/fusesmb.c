@@ -30,6 +30,7 @@
 #include <fuse.h>
 #include <stdio.h>
 #include <string.h>
+#include <strings.h>
 #include <stdlib.h>
 #include <stddef.h>
 #include <unistd.h>
@@ -39,12 +40,30 @@
 #include <sys/param.h>
 #include <sys/statvfs.h>
 #include <sys/time.h>
+#include <sys/wait.h>
 #include <pthread.h>
 #include <libsmbclient.h>
 #include <time.h>
 #include "debug.h"
 #include "hash.h"
 #include "smbctx.h"
+#include "connpool.h"
+#include "stats.h"
+#include "health.h"
+#include "handle.h"
+#include "stripe.h"
+#include "dialect.h"
+#include "scheduler.h"
+#include "limit.h"
+#include "throughput.h"
+#include "dircache.h"
+#include "blockcache.h"
+#include "brlock.h"
+#include "attrcache.h"
+#include "prefetch.h"
+#include "handlecache.h"
+#include "journal.h"
+#include "blocksum.h"
 
 #define MY_MAXPATHLEN (MAXPATHLEN + 256)
 
@@ -52,17 +71,42 @@
 	/* fusesmb uses the file handle to store pointers, so this is just
 	   a unique value which will never be a valid pointer (and also not
 	   NULL) */
+/* A directory opened while its listing was cached, see dircache.h */
+#define FILE_HANDLE_CACHED_LISTING 0x8
 
-/* Mutex for locking the Samba context */
+/* The Samba contexts are the slots of the scheduler, see scheduler.h.
+   Directories are listed on the first one. */
+#define DIR_SLOT 0
+
+/* How long the size from getattr is trusted when opening */
+#define ATTR_HINT_MS 2000
 
 /* To prevent deadlock, locking order should be:
 
-[rwd]ctx_mutex -> cfg_mutex -> opts_mutex
-[rwd]ctx_mutex -> opts_mutex
+handle mutex -> slot mutex -> cfg_mutex -> opts_mutex
+slot mutex -> opts_mutex
+slot mutex -> dircache, blockcache
+opts_mutex -> dircache, blockcache
+handlecache -> dircache, parked handles are closed without it
+handle mutex -> slot mutex -> journal
+blockcache -> blocksum
+
+Nothing waits for another slot or for room in the journal while holding a
+slot, changing the protocol range waits for all of them to be given back.
 */
 
-static pthread_mutex_t ctx_mutex = PTHREAD_MUTEX_INITIALIZER;
-static SMBCCTX *ctx, *rwd_ctx;
+/* A request in progress, on the context of its slot */
+struct request {
+    struct health_op health;
+    int slot;
+    SMBCCTX *ctx;
+    int limited;                /* counted by limit_begin() */
+    const char *path;           /* of metadata requests, for timing */
+    double start;
+};
+
+/* Only used by the health probe thread, so not locked */
+static SMBCCTX *probe_ctx;
 pthread_t cleanup_thread;
 
 
@@ -70,6 +114,21 @@ struct fusesmb_opt {
     int global_showhiddenshares;
     int global_interval;
     int global_timeout;
+    int global_idletimeout;
+    int global_keepalive;
+    int global_prewarmshares;
+    int global_stripes;
+    int global_connections;
+    int global_reserved;
+    int global_bandwidth;
+    int global_maxrequests;
+    int global_dircachettl;
+    int global_kernelcache;
+    int global_blockcache;
+    int global_smallfile;
+    int global_kernelcachetimeout;
+    int global_handlecache;
+    int global_writeback;
     char *global_username;
     char *global_password;
 };
@@ -81,6 +140,9 @@ pthread_mutex_t opts_mutex = PTHREAD_MUTEX_INITIALIZER;
 char fusesmb_scan_bin[MAXPATHLEN];
 
 static const char kMimeTypeAttributeName[] = "BEOS:TYPE";
+/* Written on a file, copies it on the server to the path in the value, see
+   server_copy() */
+static const char kServerCopyAttributeName[] = "fusesmb:copy-to";
 
 static void options_read(config_t *cfg, struct fusesmb_opt *opt)
 {
@@ -98,6 +160,88 @@ static void options_read(config_t *cfg, struct fusesmb_opt *opt)
     if (opt->global_interval <= 0)
         opt->global_interval = 0;
 
+    /* Seconds a server connection may stay unused before it is closed */
+    if (-1 == config_read_int(cfg, "global", "idletimeout", &(opt->global_idletimeout)))
+        opt->global_idletimeout = 300;
+    if (opt->global_idletimeout < 0)
+        opt->global_idletimeout = 0;
+
+    /* Seconds between keepalives on connections that are not idle */
+    if (-1 == config_read_int(cfg, "global", "keepalive", &(opt->global_keepalive)))
+        opt->global_keepalive = 60;
+
+    /* Shares connected in the background when a server is listed */
+    if (-1 == config_read_int(cfg, "global", "prewarmshares", &(opt->global_prewarmshares)))
+        opt->global_prewarmshares = 4;
+    if (opt->global_prewarmshares < 0)
+        opt->global_prewarmshares = 0;
+    if (opt->global_prewarmshares > CONNPOOL_PREWARM_QUEUE)
+    {
+        fprintf(stderr, "prewarmshares %d is more than the %d that can be "
+                "queued, using %d\n", opt->global_prewarmshares,
+                CONNPOOL_PREWARM_QUEUE, CONNPOOL_PREWARM_QUEUE);
+        opt->global_prewarmshares = CONNPOOL_PREWARM_QUEUE;
+    }
+
+    /* Connections used for large sequential transfers, 1 is off */
+    if (-1 == config_read_int(cfg, "global", "stripes", &(opt->global_stripes)))
+        opt->global_stripes = 1;
+
+    /* Contexts for requests, and how many of them only serve metadata and
+       listings. Only read at startup. */
+    if (-1 == config_read_int(cfg, "global", "connections", &(opt->global_connections)))
+        opt->global_connections = 3;
+    if (-1 == config_read_int(cfg, "global", "reserved", &(opt->global_reserved)))
+        opt->global_reserved = 1;
+
+    /* Limits for all servers together, KiB/s and requests in flight, 0 is
+       unlimited. Server sections can set their own. */
+    if (-1 == config_read_int(cfg, "global", "bandwidth", &(opt->global_bandwidth)))
+        opt->global_bandwidth = 0;
+    if (-1 == config_read_int(cfg, "global", "maxrequests", &(opt->global_maxrequests)))
+        opt->global_maxrequests = 0;
+
+    /* Seconds a listing of a directory that is not watched for changes is
+       used, 0 turns the directory cache off */
+    if (-1 == config_read_int(cfg, "global", "dircachettl", &(opt->global_dircachettl)))
+        opt->global_dircachettl = 5;
+
+    /* Let the kernel keep attributes, entries and file data. Only read at
+       startup. */
+    if (-1 == config_read_bool(cfg, "global", "kernelcache", &(opt->global_kernelcache)))
+        opt->global_kernelcache = 0;
+    if (-1 == config_read_int(cfg, "global", "kernelcachetimeout", &(opt->global_kernelcachetimeout)))
+        opt->global_kernelcachetimeout = 10;
+    if (opt->global_kernelcachetimeout < 0)
+        opt->global_kernelcachetimeout = 0;
+
+    /* MiB of file data kept from files in watched directories, 0 is off.
+       Not safe with writers on other clients, see handle.h. */
+    if (-1 == config_read_int(cfg, "global", "blockcache", &(opt->global_blockcache)))
+        opt->global_blockcache = 32;
+    if (opt->global_blockcache < 0)
+        opt->global_blockcache = 0;
+
+    /* Files up to this many KiB are read whole when opened for reading */
+    if (-1 == config_read_int(cfg, "global", "smallfile", &(opt->global_smallfile)))
+        opt->global_smallfile = 64;
+    if (opt->global_smallfile < 0)
+        opt->global_smallfile = 0;
+
+    /* Milliseconds a file opened for reading stays open after it was
+       closed, for opening it again, 0 is off */
+    if (-1 == config_read_int(cfg, "global", "handlecache", &(opt->global_handlecache)))
+        opt->global_handlecache = 1000;
+    if (opt->global_handlecache < 0)
+        opt->global_handlecache = 0;
+
+    /* MiB of writes to files opened for writing only kept in a local
+       journal and uploaded in the background, 0 is off */
+    if (-1 == config_read_int(cfg, "global", "writeback", &(opt->global_writeback)))
+        opt->global_writeback = 0;
+    if (opt->global_writeback < 0)
+        opt->global_writeback = 0;
+
     if (-1 == config_read_string(cfg, "global", "username", &(opt->global_username)))
         opt->global_username = NULL;
     if (-1 == config_read_string(cfg, "global", "password", &(opt->global_password)))
@@ -118,21 +262,125 @@ get_smbcfile(struct fuse_file_info* file_info)
 	return (SMBCFILE*)((uintptr_t)file_info->fh);
 }
 
+static smb_handle_t*
+get_handle(struct fuse_file_info* file_info)
+{
+	return (smb_handle_t*)((uintptr_t)file_info->fh);
+}
+
+
+/*
+ * Idle timeout of a server, the server section of fusesmb.conf overrides the
+ * global one
+ */
+static int server_idle_timeout(const char *server)
+{
+    char sv[1024] = "/";
+    int idletimeout;
+
+    strncat(sv, server, sizeof(sv) - 2);
+    pthread_mutex_lock(&cfg_mutex);
+    if (0 == config_read_int(&cfg, sv, "idletimeout", &idletimeout))
+    {
+        pthread_mutex_unlock(&cfg_mutex);
+        return idletimeout;
+    }
+    pthread_mutex_unlock(&cfg_mutex);
+
+    pthread_mutex_lock(&opts_mutex);
+    idletimeout = opts.global_idletimeout;
+    pthread_mutex_unlock(&opts_mutex);
+    return idletimeout;
+}
+
+/*
+ * Bandwidth (in KiB/s) and requests in flight allowed for a server
+ */
+static void server_limits(const char *server, long *bandwidth, int *requests)
+{
+    char sv[HEALTH_SERVER_NAME + 1] = "/";
+    int kb;
+
+    strncat(sv, server, sizeof(sv) - 2);
+    pthread_mutex_lock(&cfg_mutex);
+    if (0 == config_read_int(&cfg, sv, "bandwidth", &kb) && kb > 0)
+        *bandwidth = kb * 1024L;
+    if (-1 == config_read_int(&cfg, sv, "maxrequests", requests) ||
+        *requests < 0)
+        *requests = 0;
+    pthread_mutex_unlock(&cfg_mutex);
+}
+
+static void global_limits(void)
+{
+    pthread_mutex_lock(&opts_mutex);
+    long bandwidth = opts.global_bandwidth > 0 ?
+        opts.global_bandwidth * 1024L : 0;
+    int requests = opts.global_maxrequests > 0 ? opts.global_maxrequests : 0;
+    pthread_mutex_unlock(&opts_mutex);
+    limit_set_global(bandwidth, requests);
+}
+
+/*
+ * Prefetch profiles from the [prefetch] section, "ext = head,tail" in KiB
+ */
+static void prefetch_profiles(void)
+{
+    stringlist_t *keys;
+    char *value;
+    size_t i;
+    int head, tail;
+
+    prefetch_reset();
+    pthread_mutex_lock(&cfg_mutex);
+    if (0 == config_read_section_keys(&cfg, "prefetch", &keys))
+    {
+        for (i = 0; i < sl_count(keys); i++)
+        {
+            if (-1 == config_read_string(&cfg, "prefetch", sl_item(keys, i), &value))
+                continue;
+            if (2 == sscanf(value, "%d , %d", &head, &tail) &&
+                head >= 0 && tail >= 0)
+                prefetch_set(sl_item(keys, i), head * 1024, tail * 1024);
+            free(value);
+        }
+        sl_free(keys);
+    }
+    pthread_mutex_unlock(&cfg_mutex);
+}
 
 /*
  * Thread for cleaning up connections to hosts, current interval of
- * 15 seconds looks reasonable
+ * 15 seconds looks reasonable. Only connections idle for longer than their
+ * idletimeout are closed, the others get a keepalive.
  */
 static void *smb_purge_thread(void *data)
 {
     (void)data;
     while (1)
     {
+        pthread_mutex_lock(&opts_mutex);
+        int keepalive = opts.global_keepalive;
+        pthread_mutex_unlock(&opts_mutex);
+
+        int i;
+        for (i = 0; i < sched_slots(); i++)
+        {
+            sched_begin(NULL, SCHED_BACKGROUND, i, 0);
+            connpool_maintain(sched_context(i), server_idle_timeout, keepalive);
+            sched_end(i);
+        }
+
+        pthread_mutex_lock(&opts_mutex);
+        int idletimeout = opts.global_idletimeout;
+        pthread_mutex_unlock(&opts_mutex);
+        stripe_maintain(idletimeout);
+        attrcache_expire(ATTR_HINT_MS);
 
-        pthread_mutex_lock(&ctx_mutex);
-        ctx->callbacks.purge_cached_fn(ctx);
-        rwd_ctx->callbacks.purge_cached_fn(rwd_ctx);
-        pthread_mutex_unlock(&ctx_mutex);
+        char statsfile[1024];
+        get_path_in_settings_dir(&statsfile[0], sizeof(statsfile),
+            "fusesmb.stats");
+        stats_write(statsfile);
 
         char cachefile[1024];
         get_path_in_settings_dir(&cachefile[0], sizeof(cachefile),
@@ -172,10 +420,23 @@ static void *smb_purge_thread(void *data)
         /* Prevent unnecessary locks within locks */
         if (changed == 0)
         {
-            pthread_mutex_lock(&ctx_mutex);
-            ctx->timeout = opts.global_timeout * 1000;
-            rwd_ctx->timeout = opts.global_timeout * 1000;
-            pthread_mutex_unlock(&ctx_mutex);
+            for (i = 0; i < sched_slots(); i++)
+            {
+                sched_begin(NULL, SCHED_BACKGROUND, i, 0);
+                sched_context(i)->timeout = opts.global_timeout * 1000;
+                sched_end(i);
+            }
+            /* protocol or iosize may have changed */
+            dialect_forget();
+            global_limits();
+            pthread_mutex_lock(&opts_mutex);
+            dircache_set_ttl(opts.global_dircachettl);
+            blockcache_set_size((size_t)opts.global_blockcache << 20);
+            handlecache_set_ttl(opts.global_handlecache);
+            journal_set_size((size_t)opts.global_writeback << 20);
+            pthread_mutex_unlock(&opts_mutex);
+            prefetch_profiles();
+            limit_reload();
         }
 
 
@@ -217,45 +478,324 @@ static unsigned int slashcount(const char *file)
     return count;
 }
 
-static int fusesmb_getattr(const char *path, struct stat *stbuf)
+/*
+ * fusesmb-scan appends the shares of every server to fusesmb.cache.journal as
+ * soon as they are listed, and removes the journal after the complete
+ * fusesmb.cache has been written. Until then both files are merged, so
+ * servers show up while a scan is still running. A journal older than the
+ * cache file is left over from an aborted scan and is ignored.
+ * Returns the number of files stored in cache_files.
+ */
+static int get_cache_files(char cache_files[2][1024])
+{
+    struct stat cache_st, journal_st;
+    int count = 0;
+
+    get_path_in_settings_dir(&cache_files[0][0], sizeof(cache_files[0]),
+        "fusesmb.cache");
+    if (0 == stat(cache_files[0], &cache_st))
+        count++;
+
+    get_path_in_settings_dir(&cache_files[count][0], sizeof(cache_files[0]),
+        "fusesmb.cache.journal");
+    if (0 == stat(cache_files[count], &journal_st))
+    {
+        if (count == 0 || journal_st.st_mtime >= cache_st.st_mtime)
+            count++;
+    }
+    return count;
+}
+
+static int cache_file_has_path(const char *cache_file, const char *path)
 {
-    char smb_path[MY_MAXPATHLEN] = "smb:/", buf[MY_MAXPATHLEN], cache_file[1024];
+    char buf[MY_MAXPATHLEN];
+    size_t path_len = strlen(path);
     int path_exists = 0;
     FILE *fp;
+
+    fp = fopen(cache_file, "r");
+    if (!fp)
+        return 0;
+
+    while (!feof(fp))
+    {
+        if (NULL == fgets(buf, MY_MAXPATHLEN, fp))
+            continue;
+        if (strncmp(buf, path, path_len) == 0 &&
+            (buf[path_len] == '/' || buf[path_len] == '\n'))
+        {
+            path_exists = 1;
+            break;
+        }
+    }
+    fclose(fp);
+    return path_exists;
+}
+
+/*
+ * Server name of /WORKGROUP/SERVER/...
+ */
+static void path_server(const char *path, char *server, size_t size)
+{
+    const char *start = stripworkgroup(path) + 1;
+    size_t len = strcspn(start, "/");
+
+    if (len >= size)
+        len = size - 1;
+    memcpy(server, start, len);
+    server[len] = '\0';
+}
+
+/*
+ * Number of stripes for large transfers with a server, the server section
+ * of fusesmb.conf overrides the global one
+ */
+static int server_stripes(const char *path)
+{
+    char sv[HEALTH_SERVER_NAME + 1] = "/";
+    int stripes;
+
+    path_server(path, sv + 1, sizeof(sv) - 1);
+    pthread_mutex_lock(&cfg_mutex);
+    if (0 == config_read_int(&cfg, sv, "stripes", &stripes))
+    {
+        pthread_mutex_unlock(&cfg_mutex);
+        return stripes;
+    }
+    pthread_mutex_unlock(&cfg_mutex);
+
+    pthread_mutex_lock(&opts_mutex);
+    stripes = opts.global_stripes;
+    pthread_mutex_unlock(&opts_mutex);
+    return stripes;
+}
+
+/*
+ * Protocol and I/O size (in KiB) set for a server, the server section of
+ * fusesmb.conf overrides the global one
+ */
+static void server_dialect_config(const char *server, char *protocol,
+                                  size_t size, size_t *iosize)
+{
+    char sv[HEALTH_SERVER_NAME + 1] = "/";
+    char *value;
+    int kb;
+
+    strncat(sv, server, sizeof(sv) - 2);
+    protocol[0] = '\0';
+    *iosize = 0;
+    pthread_mutex_lock(&cfg_mutex);
+    if (0 == config_read_string(&cfg, sv, "protocol", &value) ||
+        0 == config_read_string(&cfg, "global", "protocol", &value))
+    {
+        strncpy(protocol, value, size - 1);
+        protocol[size - 1] = '\0';
+        free(value);
+    }
+    if ((0 == config_read_int(&cfg, sv, "iosize", &kb) ||
+         0 == config_read_int(&cfg, "global", "iosize", &kb)) && kb > 0)
+        *iosize = (size_t)kb * 1024;
+    pthread_mutex_unlock(&cfg_mutex);
+}
+
+/*
+ * Probe the dialect of server in fusesmb-scan -p, whose protocol range is
+ * its own (see dialect.h). The server name comes from a path, it is passed
+ * without a shell.
+ */
+static int probe_dialect(const char *server, char *protocol, size_t size)
+{
+    char buf[64];
+    size_t len = 0;
+    ssize_t n;
+    int fds[2], status;
+
+    if (-1 == pipe(fds))
+        return -1;
+    pid_t waited, pid = fork();
+    if (pid == 0)
+    {
+        dup2(fds[1], STDOUT_FILENO);
+        close(fds[0]);
+        close(fds[1]);
+        execlp(fusesmb_scan_bin, fusesmb_scan_bin, "-p", server, (char *)NULL);
+        _exit(EXIT_FAILURE);
+    }
+    close(fds[1]);
+    if (pid < 0)
+    {
+        close(fds[0]);
+        return -1;
+    }
+    while (len < sizeof(buf) - 1 &&
+           ((n = read(fds[0], buf + len, sizeof(buf) - 1 - len)) > 0 ||
+            (n == -1 && errno == EINTR)))
+        if (n > 0)
+            len += n;
+    close(fds[0]);
+    while (-1 == (waited = waitpid(pid, &status, 0)) && errno == EINTR)
+        ;
+    buf[len] = '\0';
+    buf[strcspn(buf, "\n")] = '\0';
+    if (waited != pid || !WIFEXITED(status) || WEXITSTATUS(status) != 0 ||
+        buf[0] == '\0')
+        return -1;
+    strncpy(protocol, buf, size - 1);
+    protocol[size - 1] = '\0';
+    return 0;
+}
+
+/*
+ * Wait for a slot for a request to server name. Fails while the server is
+ * known to be down, otherwise the timeout follows the latency of the
+ * server, but never exceeds the configured one. New connections use the
+ * dialect of the server, which the first request probes, the scheduler
+ * sees to the protocol range.
+ */
+static int server_begin(const char *name, struct request *req,
+                        enum sched_class cls, int slot, size_t cost)
+{
+    struct dialect_info info;
+
+    pthread_mutex_lock(&opts_mutex);
+    int max_timeout = opts.global_timeout * 1000;
+    pthread_mutex_unlock(&opts_mutex);
+
+    if (-1 == health_begin(&req->health, name, max_timeout))
+        return -1;
+
+    const char *server = req->health.server;
+    if (server[0] != '\0' && -1 == dialect_lookup(server, &info))
+        dialect_get(server, &info);
+
+    req->slot = sched_begin(server, cls, slot, cost);
+    req->ctx = sched_context(req->slot);
+    req->ctx->timeout = req->health.timeout;
+    /* Transfers are limited by the handle, read by read */
+    req->limited = cls == SCHED_INTERACTIVE;
+    if (req->limited)
+        limit_begin(server, 0);
+    req->path = NULL;
+    req->start = stats_now_ms();
+    return 0;
+}
+
+/*
+ * The same for the server of path
+ */
+static int request_begin(const char *path, struct request *req,
+                         enum sched_class cls, int slot, size_t cost)
+{
+    char name[HEALTH_SERVER_NAME];
+
+    path_server(path, name, sizeof(name));
+    if (-1 == server_begin(name, req, cls, slot, cost))
+        return -1;
+    if (cls == SCHED_INTERACTIVE)
+        req->path = path;
+    return 0;
+}
+
+/*
+ * Metadata requests and opening, on any slot unless given
+ */
+static int server_lock(const char *path, struct request *req, int slot)
+{
+    return request_begin(path, req, SCHED_INTERACTIVE, slot, 0);
+}
+
+/*
+ * Reads and writes, on the slot the file was opened on
+ */
+static int transfer_lock(const char *path, struct request *req,
+                         smb_handle_t *handle, size_t size)
+{
+    return request_begin(path, req, SCHED_BULK, sched_find(handle->ctx),
+                         size);
+}
+
+/* error is the errno the request failed with, or 0 */
+static void server_unlock(struct request *req, int error)
+{
+    char url[1024];
+
+    /* A metadata request is a round trip to the share, moving nothing. Its
+       time from getting the slot on is the latency of the server. */
+    double ms = req->path != NULL ? stats_now_ms() - req->start : -1;
+    if (req->path != NULL && error == 0)
+    {
+        snprintf(url, sizeof(url), "smb:/%s", stripworkgroup(req->path));
+        throughput_sample(url, 0, ms);
+    }
+    if (req->limited)
+        limit_end(req->health.server);
+    sched_end(req->slot);
+    health_end(&req->health, error, ms);
+    errno = error;
+}
+
+/*
+ * Close handle on its slot, a server known to be down is not waited for
+ */
+static void close_handle(const char *server, smb_handle_t *handle)
+{
+    struct request req;
+
+    if (-1 == server_begin(server, &req, SCHED_BULK, sched_find(handle->ctx),
+                           handle->wlen))
+    {
+        handle_abandon(handle);
+        return;
+    }
+    int ret = handle_close(handle);
+    server_unlock(&req, ret < 0 ? errno : 0);
+}
+
+/*
+ * Check if a server that was down answers again, any answer will do
+ */
+static int server_probe(const char *server)
+{
+    char url[HEALTH_SERVER_NAME + 8];
+    int error = 0;
+
+    snprintf(url, sizeof(url), "smb://%s", server);
+    sched_enter(server);
+    SMBCFILE *dir = probe_ctx->opendir(probe_ctx, url);
+    if (dir == NULL)
+        error = errno;
+    else
+        probe_ctx->closedir(probe_ctx, dir);
+    probe_ctx->callbacks.purge_cached_fn(probe_ctx);
+    sched_leave();
+    return error;
+}
+
+static int fusesmb_getattr(const char *path, struct stat *stbuf)
+{
+    char smb_path[MY_MAXPATHLEN] = "smb:/", cache_files[2][1024];
+    int path_exists = 0, num_cache_files, i;
     struct stat cache;
     memset(stbuf, 0, sizeof(struct stat));
 
     /* Check the cache for valid workgroup, hosts and shares */
     if (slashcount(path) <= 3)
     {
-        get_path_in_settings_dir(&cache_file[0], sizeof(cache_file),
-            "fusesmb.cache");
+        num_cache_files = get_cache_files(cache_files);
 
         if (strlen(path) == 1 && path[0] == '/')
             path_exists = 1;
         else
         {
-            fp = fopen(cache_file, "r");
-            if (!fp)
-                return -ENOENT;
-
-            while (!feof(fp))
-            {
-                fgets(buf, MY_MAXPATHLEN, fp);
-                if (strncmp(buf, path, strlen(path)) == 0 &&
-                    (buf[strlen(path)] == '/' || buf[strlen(path)] == '\n'))
-                {
-                    path_exists = 1;
-                    break;
-                }
-            }
-            fclose(fp);
+            for (i = 0; i < num_cache_files && !path_exists; i++)
+                path_exists = cache_file_has_path(cache_files[i], path);
         }
         if (path_exists != 1)
             return -ENOENT;
 
         memset(&cache, 0, sizeof(cache));
-        stat(cache_file, &cache);
+        if (num_cache_files > 0)
+            stat(cache_files[0], &cache);
         memset(stbuf, 0, sizeof(*stbuf));
         stbuf->st_mode  = S_IFDIR | 0755;
         stbuf->st_nlink = 3;
@@ -272,64 +812,158 @@ static int fusesmb_getattr(const char *path, struct stat *stbuf)
     else
     {
         strcat(smb_path, stripworkgroup(path));
-        pthread_mutex_lock(&ctx_mutex);
-        if (ctx->stat(ctx, smb_path, stbuf) < 0)
+        struct request req;
+        if (-1 == server_lock(path, &req, SCHED_ANY))
+            return -EHOSTDOWN;
+        if (req.ctx->stat(req.ctx, smb_path, stbuf) < 0)
         {
-            pthread_mutex_unlock(&ctx_mutex);
+            server_unlock(&req, errno);
             return -errno;
         }
 
         stbuf->st_mode &= ~(S_IXUSR | S_IXGRP | S_IXOTH);
         	// remove executable bits (Samba uses them for certain DOS file
         	// attributes)
+        attrcache_put(smb_path, stbuf);
+        /* Writes still in the journal make the file longer */
+        journal_size(smb_path, &stbuf->st_size);
 
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, 0);
         return 0;
 
     }
 }
 
-static int fusesmb_opendir(const char *path, struct fuse_file_info *fi)
+/*
+ * Check if /WORKGROUP/SERVER/SHARE already has a connection
+ */
+static int share_connected(const char *path)
 {
-    if (slashcount(path) <= 2)
+    char server[MY_MAXPATHLEN];
+    char *share;
+
+    strncpy(server, stripworkgroup(path) + 1, sizeof(server) - 1);
+    server[sizeof(server) - 1] = '\0';
+    if (NULL == (share = strchr(server, '/')))
         return 0;
+    *share++ = '\0';
+    return connpool_idle_time(server, share) != -1;
+}
+
+/*
+ * Listing a server is almost always followed by opening one of its shares,
+ * so connect to the first few in the background
+ */
+static void prewarm_shares(const char *path, stringlist_t *shares)
+{
+    const char *server = stripworkgroup(path) + 1;
+    size_t i;
+    int queued = 0;
+
+    pthread_mutex_lock(&opts_mutex);
+    int limit = opts.global_prewarmshares;
+    pthread_mutex_unlock(&opts_mutex);
+
+    connpool_prewarm_cancel();
+    for (i = 0; i < sl_count(shares) && queued < limit; i++)
+    {
+        const char *share = sl_item(shares, i);
+        if (i > 0 && strcasecmp(share, sl_item(shares, i - 1)) == 0)
+            continue;
+        /* Administrative shares are rarely opened */
+        if (share[0] == '\0' || share[strlen(share) - 1] == '$')
+            continue;
+        connpool_prewarm(server, share);
+        queued++;
+    }
+}
+
+/*
+ * Open a directory inside a share on the server
+ */
+static int open_dir(const char *path, struct fuse_file_info *fi)
+{
     SMBCFILE *dir;
     char smb_path[MY_MAXPATHLEN] = "smb:/";
     strcat(smb_path, stripworkgroup(path));
-    pthread_mutex_lock(&ctx_mutex);
-    dir = ctx->opendir(ctx, smb_path);
+
+    /* Measure how long the first listing of a share takes, libsmbclient
+       reads the whole directory in opendir */
+    int share_root = slashcount(path) == 3;
+    int warm = 0;
+    double start = 0;
+    if (share_root)
+    {
+        warm = share_connected(path);
+        start = stats_now_ms();
+    }
+
+    struct request req;
+    if (-1 == server_lock(path, &req, DIR_SLOT))
+        return -EHOSTDOWN;
+    dir = req.ctx->opendir(req.ctx, smb_path);
     if (dir == NULL)
     {
         if (errno != EACCES) {
-            pthread_mutex_unlock(&ctx_mutex);
+            server_unlock(&req, errno);
             return -errno;
         } else {
             fi->fh = FILE_HANDLE_NEEDS_AUTHENTICATION;
-            pthread_mutex_unlock(&ctx_mutex);
+            server_unlock(&req, 0);
             return 0;
         }
     }
     fi->fh = (unsigned long)dir;
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
+    if (share_root)
+        stats_share_listing(stripworkgroup(path), stats_now_ms() - start, warm);
     return 0;
 }
 
+static int fusesmb_opendir(const char *path, struct fuse_file_info *fi)
+{
+    if (slashcount(path) <= 2)
+        return 0;
+    char smb_path[MY_MAXPATHLEN] = "smb:/";
+    strcat(smb_path, stripworkgroup(path));
+
+    if (0 == dircache_has(smb_path))
+    {
+        fi->fh = FILE_HANDLE_CACHED_LISTING;
+        return 0;
+    }
+    return open_dir(path, fi);
+}
+
+struct fill_args {
+    void *h;
+    fuse_fill_dir_t filler;
+};
+
+static void fill_cached(void *arg, const char *name, int is_dir)
+{
+    struct fill_args *args = (struct fill_args *)arg;
+    struct stat st;
+
+    memset(&st, 0, sizeof(st));
+    st.st_mode = is_dir ? S_IFDIR : S_IFREG;
+    args->filler(args->h, name, &st, 0);
+}
+
 static int fusesmb_readdir(const char *path, void *h, fuse_fill_dir_t filler,
                        off_t offset, struct fuse_file_info *fi)
 {
     (void)offset;
     struct smbc_dirent *pdirent;
     char buf[MY_MAXPATHLEN],
-         last_dir_entry[MY_MAXPATHLEN] = "",
-         cache_file[1024];
+         cache_files[2][1024];
     FILE *fp;
     char *dir_entry;
     struct stat st;
     memset(&st, 0, sizeof(st));
-    int dircount = 0;
 
     /*
-       Check the cache file for workgroups/hosts and shares that are currently online
+       Check the cache files for workgroups/hosts and shares that are currently online
        Cases handled here are:
        / ,
        /WORKGROUP and
@@ -337,72 +971,97 @@ static int fusesmb_readdir(const char *path, void *h, fuse_fill_dir_t filler,
      */
     if (slashcount(path) <= 2)
     {
+        int num_cache_files, i;
+        size_t j;
+        stringlist_t *entries;
+
         /* Listing Workgroups */
-        get_path_in_settings_dir(&cache_file[0], sizeof(cache_file),
-            "fusesmb.cache");
-        fp = fopen(cache_file, "r");
-        if (!fp)
+        num_cache_files = get_cache_files(cache_files);
+        if (num_cache_files == 0)
             return -ENOENT;
-        while (!feof(fp))
+        entries = sl_init();
+        if (entries == NULL)
+            return -ENOMEM;
+
+        for (i = 0; i < num_cache_files; i++)
         {
-            if (NULL == fgets(buf, sizeof(buf), fp))
+            fp = fopen(cache_files[i], "r");
+            if (!fp)
                 continue;
-
-            if (strncmp(buf, path, strlen(path)) == 0 &&
-                (strlen(buf) > strlen(path)))
+            while (!feof(fp))
             {
-                /* Note: strtok is safe because the static buffer is is not reused */
-                if (buf[strlen(path)] == '/' || strlen(path) == 1)
+                if (NULL == fgets(buf, sizeof(buf), fp))
+                    continue;
+
+                /* Skip a line the scanner is still appending to the journal */
+                if (buf[strlen(buf) - 1] != '\n')
+                    continue;
+
+                if (strncmp(buf, path, strlen(path)) == 0 &&
+                    (strlen(buf) > strlen(path)))
                 {
-                    /* Path is workgroup or server */
-                    if (strlen(path) > 1)
+                    /* Note: strtok is safe because the static buffer is is not reused */
+                    if (buf[strlen(path)] == '/' || strlen(path) == 1)
                     {
-                        dir_entry = strtok(&buf[strlen(path) + 1], "/");
-                        /* Look if share is a hidden share, dir_entry still contains '\n' */
-                        if (slashcount(path) == 2)
+                        /* Path is workgroup or server */
+                        if (strlen(path) > 1)
                         {
-                            if (dir_entry[strlen(dir_entry)-2] == '$')
+                            dir_entry = strtok(&buf[strlen(path) + 1], "/");
+                            /* Look if share is a hidden share, dir_entry still contains '\n' */
+                            if (slashcount(path) == 2)
                             {
-                                int showhidden = 0;
-                                pthread_mutex_lock(&cfg_mutex);
-                                if (0 == config_read_bool(&cfg, stripworkgroup(path), "showhiddenshares", &showhidden))
+                                if (dir_entry[strlen(dir_entry)-2] == '$')
                                 {
+                                    int showhidden = 0;
+                                    pthread_mutex_lock(&cfg_mutex);
+                                    if (0 == config_read_bool(&cfg, stripworkgroup(path), "showhiddenshares", &showhidden))
+                                    {
+                                        pthread_mutex_unlock(&cfg_mutex);
+                                        if (showhidden == 1)
+                                            continue;
+                                    }
                                     pthread_mutex_unlock(&cfg_mutex);
-                                    if (showhidden == 1)
-                                        continue;
-                                }
-                                pthread_mutex_unlock(&cfg_mutex);
 
-                                pthread_mutex_lock(&opts_mutex);
-                                if (opts.global_showhiddenshares == 0)
-                                {
+                                    pthread_mutex_lock(&opts_mutex);
+                                    if (opts.global_showhiddenshares == 0)
+                                    {
+                                        pthread_mutex_unlock(&opts_mutex);
+                                        continue;
+                                    }
                                     pthread_mutex_unlock(&opts_mutex);
-                                    continue;
                                 }
-                                pthread_mutex_unlock(&opts_mutex);
                             }
                         }
+                        /* Path is root */
+                        else
+                        {
+                            dir_entry = strtok(buf, "/");
+                        }
+                        sl_add(entries, strtok(dir_entry, "\n"), 1);
                     }
-                    /* Path is root */
-                    else
-                    {
-                        dir_entry = strtok(buf, "/");
-                    }
-                    /* Only unique workgroups or servers */
-                    if (strcmp(last_dir_entry, dir_entry) == 0)
-                        continue;
-
-                    st.st_mode = S_IFDIR;
-                    filler(h, strtok(dir_entry, "\n"), &st, 0);
-                    dircount++;
-                    strncpy(last_dir_entry, dir_entry, MY_MAXPATHLEN);
                 }
             }
+            fclose(fp);
         }
-        fclose(fp);
 
-        if (dircount == 0)
+        if (sl_count(entries) == 0)
+        {
+            sl_free(entries);
             return -ENOENT;
+        }
+
+        /* Only unique workgroups or servers, the journal is not sorted */
+        sl_casesort(entries);
+        st.st_mode = S_IFDIR;
+        for (j = 0; j < sl_count(entries); j++)
+        {
+            if (j > 0 && strcasecmp(sl_item(entries, j), sl_item(entries, j - 1)) == 0)
+                continue;
+            filler(h, sl_item(entries, j), &st, 0);
+        }
+        if (slashcount(path) == 2)
+            prewarm_shares(path, entries);
+        sl_free(entries);
 
         /* The workgroup / host and share lists don't have . and .. , so putting them in */
         st.st_mode = S_IFDIR;
@@ -413,51 +1072,82 @@ static int fusesmb_readdir(const char *path, void *h, fuse_fill_dir_t filler,
     /* Listing contents of a share */
     else
     {
+        char smb_path[MY_MAXPATHLEN] = "smb:/";
+        strcat(smb_path, stripworkgroup(path));
+
+        if (fi->fh == FILE_HANDLE_CACHED_LISTING)
+        {
+            struct fill_args args;
+            args.h = h;
+            args.filler = filler;
+            if (0 == dircache_list(smb_path, fill_cached, &args))
+                return 0;
+
+            /* Dropped since opendir, read it from the server after all */
+            int status = open_dir(path, fi);
+            if (status != 0)
+                return status;
+        }
+
         while (fi->fh == FILE_HANDLE_NEEDS_AUTHENTICATION) {
             int result = show_authentication_request(path);
             if (result != 0) {
                 // User cancelled
                 return -EACCES;
             }
-            int status = fusesmb_opendir(path, fi);
+            int status = open_dir(path, fi);
             if (status != 0)
                 return status;
         }
 
-        pthread_mutex_lock(&ctx_mutex);
+        char server[HEALTH_SERVER_NAME];
+        path_server(path, server, sizeof(server));
+        int slot = sched_begin(server, SCHED_INTERACTIVE, DIR_SLOT, 0);
+        SMBCCTX *ctx = sched_context(slot);
+        dircache_listing_t *listing = dircache_begin();
+        /* readdir() returns NULL at the end as well as on errors */
+        errno = 0;
         while (NULL != (pdirent = ctx->readdir(ctx, get_smbcfile(fi))))
         {
             if (pdirent->smbc_type == SMBC_DIR)
             {
                 st.st_mode = S_IFDIR;
                 filler(h, pdirent->name, &st, 0);
+                dircache_add(listing, pdirent->name, 1);
             }
             if (pdirent->smbc_type == SMBC_FILE)
             {
                 st.st_mode = S_IFREG;
                 filler(h, pdirent->name, &st, 0);
+                dircache_add(listing, pdirent->name, 0);
             }
         }
-        pthread_mutex_unlock(&ctx_mutex);
+        if (errno == 0)
+            dircache_store(smb_path, listing);
+        else
+            dircache_abort(listing);
+        sched_end(slot);
     }
     return 0;
 }
 
 static int fusesmb_releasedir(const char *path, struct fuse_file_info *fi)
 {
-    (void) path;
-    if (slashcount(path) <= 2)
+    if (slashcount(path) <= 2 || fi->fh == FILE_HANDLE_CACHED_LISTING)
         return 0;
 
-    pthread_mutex_lock(&ctx_mutex);
+    char server[HEALTH_SERVER_NAME];
+    path_server(path, server, sizeof(server));
+    int slot = sched_begin(server, SCHED_INTERACTIVE, DIR_SLOT, 0);
+    SMBCCTX *ctx = sched_context(slot);
     ctx->closedir(ctx, get_smbcfile(fi));
-    pthread_mutex_unlock(&ctx_mutex);
+    sched_end(slot);
     return 0;
 }
 
 static int fusesmb_open(const char *path, struct fuse_file_info *fi)
 {
-    SMBCFILE *file;
+    smb_handle_t *handle;
     char smb_path[MY_MAXPATHLEN] = "smb:/";
 
     if (slashcount(path) <= 3)
@@ -468,177 +1158,220 @@ static int fusesmb_open(const char *path, struct fuse_file_info *fi)
     //    return -ENOENT;
     strcat(smb_path, stripworkgroup(path));
 
-    pthread_mutex_lock(&ctx_mutex);
-    file = rwd_ctx->open(rwd_ctx, smb_path, fi->flags, 0);
-
-    if (file == NULL)
+    /* Journaled writes go out first, unless this only adds more. Rewriting
+       the file is journaled as well, the truncate comes last. The file on
+       the server is opened when the journal uploads to it, the kernel
+       looked it up already. */
+    if ((fi->flags & O_ACCMODE) == O_WRONLY && journal_enabled())
     {
-        if (errno == EISDIR) {
-            strlcat(smb_path, "/", MY_MAXPATHLEN);
-            file = smbc_getFunctionOpen(rwd_ctx)(rwd_ctx, smb_path, fi->flags, 0);
-        }
-        if (file == NULL) {
-            pthread_mutex_unlock(&ctx_mutex);
+        handlecache_drop(smb_path);
+        if ((fi->flags & O_TRUNC) && -1 == journal_truncate(smb_path, 0))
             return -errno;
-        }
+        if (NULL == (handle = handle_journaled(smb_path, fi->flags)))
+            return -errno;
+        fi->fh = (unsigned long)handle;
+        return 0;
     }
+    if (-1 == journal_wait(smb_path))
+        return -errno;
 
-    fi->fh = (unsigned long)file;
-    pthread_mutex_unlock(&ctx_mutex);
-    return 0;
-}
+    /* The data the kernel kept is still good when the server would have
+       told about a change */
+    pthread_mutex_lock(&opts_mutex);
+    int kernelcache = opts.global_kernelcache;
+    size_t smallfile = (size_t)opts.global_smallfile * 1024;
+    pthread_mutex_unlock(&opts_mutex);
+    if (kernelcache && dircache_opened(smb_path))
+        fi->keep_cache = 1;
+
+    /* Read-only files are often open already, or opened again right after
+       they were closed, the handle is still open then */
+    int readonly = (fi->flags & O_ACCMODE) == O_RDONLY;
+    if (!readonly)
+        handlecache_drop(smb_path);
+    else if (NULL != (handle = handlecache_take(smb_path, fi->flags)))
+    {
+        fi->fh = (unsigned long)handle;
+        return 0;
+    }
 
-static int fusesmb_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
-{
-    SMBCFILE *file;
-    char smb_path[MY_MAXPATHLEN] = "smb:/";
+    int stripes = server_stripes(path);
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_SHARED))
+        return -EHOSTDOWN;
+    handle = handle_open(req.ctx, sched_mutex(req.slot), smb_path,
+                         fi->flags, 0);
+    if (handle == NULL)
+    {
+        server_unlock(&req, errno);
+        return -errno;
+    }
+    handle_set_stripes(handle, stripes);
+    struct dialect_info info;
+    if (0 == dialect_lookup(req.health.server, &info))
+        handle_set_iosize(handle, info.iosize);
 
-    //printf("%i\n", offset);
-    //fflush(stdout);
+    /* Small files are mostly read whole right away, in one request. The
+       kernel just asked for the size. */
+    struct stat st;
+    double seen;
+    size_t head = 0, tail = 0;
+    int whole = 0;
+    if (0 == attrcache_get(smb_path, &st, &seen, ATTR_HINT_MS) &&
+        S_ISREG(st.st_mode))
+    {
+        handle_set_version(handle, &st, seen);
+        if (readonly && smallfile > 0 && (size_t)st.st_size <= smallfile)
+            whole = 0 == handle_prefetch(handle, smallfile);
+    }
 
-    strcat(smb_path, stripworkgroup(path));
+    /* Media players and archive tools go for the end right after the
+       header, both are fetched as one transfer once this returned */
+    int ends = readonly && !whole &&
+        0 == prefetch_profile(smb_path, &head, &tail) &&
+        handle_ends_missing(handle, head, tail);
 
-    int tries = 0;              //For number of retries before failing
-    ssize_t ssize;              //Returned by ctx->read
+    fi->fh = (unsigned long)handle;
+    server_unlock(&req, 0);
+
+    if (readonly)
+        handlecache_add(handle);
+    if (ends)
+        prefetch_queue(path, fi->flags, head, tail);
+    return 0;
+}
 
-    pthread_mutex_lock(&ctx_mutex);
-    /* Ugly goto but it works ;) But IMHO easiest solution for error handling here */
-    goto seek;
-  reopen:
-    if ((file = rwd_ctx->open(rwd_ctx, smb_path, fi->flags, 0)) == NULL)
+static int fusesmb_read(const char *path, char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    ssize_t ssize;
+
+    /* Broken connections are handled by the handle, it opens the file
+       again and retries */
+    smb_handle_t *handle = get_handle(fi);
+    handle_lock(handle);
+    struct request req;
+    if (-1 == transfer_lock(path, &req, handle, size))
     {
-        /* Trying to reopen when out of memory */
-        if (errno == ENOMEM)
-        {
-            tries++;
-            if (tries > 4)
-            {
-                pthread_mutex_unlock(&ctx_mutex);
-                return -errno;
-            }
-            goto reopen;
-        }
-        /* Other errors from docs cannot be recovered from so returning the error */
-        else
-        {
-            pthread_mutex_unlock(&ctx_mutex);
-            return -errno;
-        }
+        handle_unlock(handle);
+        return -EHOSTDOWN;
     }
-    fi->fh = (unsigned long)file;
-  seek:
+    ssize = handle_read(handle, buf, size, offset);
+    server_unlock(&req, ssize < 0 ? errno : 0);
+    handle_unlock(handle);
+    if (ssize < 0)
+        return -errno;
+    return (size_t) ssize;
+}
+
+static int fusesmb_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+{
+    ssize_t ssize;
 
-    if (rwd_ctx->lseek(rwd_ctx, get_smbcfile(fi), offset, SEEK_SET) == (off_t) - 1)
+    smb_handle_t *handle = get_handle(fi);
+    handle_lock(handle);
+    handlecache_drop(handle->url);
+    if (handle->writeback)
     {
-        /* Bad file descriptor try to reopen */
-        if (errno == EBADF)
-        {
-            goto reopen;
-        }
-        else
-        {
-            //SMB Init failed
-            pthread_mutex_unlock(&ctx_mutex);
+        blockcache_drop(handle->url);
+        ssize = journal_write(handle->url, buf, size, offset);
+        handle_unlock(handle);
+        if (ssize < 0)
             return -errno;
-        }
+        return (size_t) ssize;
     }
-    if ((ssize = rwd_ctx->read(rwd_ctx, get_smbcfile(fi), buf, size)) < 0)
+    struct request req;
+    if (-1 == transfer_lock(path, &req, handle, size))
     {
-        /* Bad file descriptor try to reopen */
-        if (errno == EBADF)
-        {
-            goto reopen;
-        }
-        /* Tried opening a directory / or smb_init failed */
-        else
-        {
-            pthread_mutex_unlock(&ctx_mutex);
-            return -errno;
-        }
+        handle_unlock(handle);
+        return -EHOSTDOWN;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    ssize = handle_write(handle, buf, size, offset);
+    server_unlock(&req, ssize < 0 ? errno : 0);
+    handle_unlock(handle);
+    if (ssize < 0)
+        return -errno;
     return (size_t) ssize;
 }
 
-static int fusesmb_write(const char *path, const char *buf, size_t size, off_t offset, struct fuse_file_info *fi)
+/*
+ * Closing a file drops the byte-range locks its owner held on it, like
+ * close() does
+ */
+static void release_locks(const char *path, struct fuse_file_info *fi)
 {
-    SMBCFILE *file;
     char smb_path[MY_MAXPATHLEN] = "smb:/";
 
+    if (slashcount(path) <= 3)
+        return;
     strcat(smb_path, stripworkgroup(path));
+    brlock_release(smb_path, fi->lock_owner);
+}
 
-    int tries = 0;              //For number of retries before failing
-    ssize_t ssize;              //Returned by ctx->read
+/*
+ * Small writes are buffered by the handle, errors writing them out show up
+ * here
+ */
+static int flush_handle(const char *path, struct fuse_file_info *fi)
+{
+    smb_handle_t *handle = get_handle(fi);
+    if (handle == NULL)
+        return 0;
+    if (handle->writeback)
+        return -1 == journal_sync() ? -errno : 0;
 
-    pthread_mutex_lock(&ctx_mutex);
-    /* Ugly goto but it works ;) But IMHO easiest solution for error handling here */
-    goto seek;
-  reopen:
-    if (NULL == (file = rwd_ctx->open(rwd_ctx, smb_path, fi->flags, 0)))
+    handle_lock(handle);
+    struct request req;
+    if (-1 == transfer_lock(path, &req, handle, handle->wlen))
     {
-        /* Trying to reopen when out of memory */
-        if (errno == ENOMEM)
-        {
-            tries++;
-            if (tries > 4)
-            {
-                pthread_mutex_unlock(&ctx_mutex);
-                return -errno;
-            }
-            goto reopen;
-        }
-        /* Other errors from docs cannot be recovered from so returning the error */
-        pthread_mutex_unlock(&ctx_mutex);
+        handle_unlock(handle);
+        return -EHOSTDOWN;
+    }
+    int ret = handle_flush(handle);
+    server_unlock(&req, ret < 0 ? errno : 0);
+    handle_unlock(handle);
+    if (ret < 0)
         return -errno;
+    return 0;
+}
 
-    }
-    fi->fh = (unsigned long)file;
-  seek:
+/*
+ * Called on every close()
+ */
+static int fusesmb_flush(const char *path, struct fuse_file_info *fi)
+{
+    release_locks(path, fi);
+    return flush_handle(path, fi);
+}
 
-    if (rwd_ctx->lseek(rwd_ctx, get_smbcfile(fi), offset, SEEK_SET) == (off_t) - 1)
-    {
-        /* Bad file descriptor try to reopen */
-        if (errno == EBADF)
-        {
-            goto reopen;
-        }
-        else
-        {
-            //SMB Init failed
-            pthread_mutex_unlock(&ctx_mutex);
-            return -errno;
-        }
-    }
-    if ((ssize = rwd_ctx->write(rwd_ctx, get_smbcfile(fi), (void *) buf, size)) < 0)
-    {
-        /* Bad file descriptor try to reopen */
-        if (errno == EBADF)
-        {
-            goto reopen;
-        }
-        /* Tried opening a directory / or smb_init failed */
-        else
-        {
-            pthread_mutex_unlock(&ctx_mutex);
-            return -errno;
-        }
-    }
-    pthread_mutex_unlock(&ctx_mutex);
-    return (size_t) ssize;
+static int fusesmb_fsync(const char *path, int datasync, struct fuse_file_info *fi)
+{
+    (void)datasync;
+    return flush_handle(path, fi);
 }
 
 static int fusesmb_release(const char *path, struct fuse_file_info *fi)
 {
-    (void)path;
-    pthread_mutex_lock(&ctx_mutex);
-#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
-    rwd_ctx->close_fn(rwd_ctx, get_smbcfile(fi));
-#else
-    rwd_ctx->close(rwd_ctx, get_smbcfile(fi));
-#endif
-    pthread_mutex_unlock(&ctx_mutex);
-    return 0;
+    char server[HEALTH_SERVER_NAME];
+    release_locks(path, fi);
+    smb_handle_t *handle = get_handle(fi);
+    if (handle == NULL)
+        return 0;
+    /* Shared or kept open for a moment when only read, see handlecache.h */
+    if (0 == handlecache_release(handle))
+        return 0;
 
+    /* Ends a rewrite in the journal, see journal.h */
+    if (handle->writeback)
+    {
+        journal_close(handle->url);
+        handle_close(handle);
+        return 0;
+    }
+
+    /* Pending writes go out on closing */
+    path_server(path, server, sizeof(server));
+    close_handle(server, handle);
+    return 0;
 }
 
 static int fusesmb_mknod(const char *path, mode_t mode,
@@ -657,42 +1390,99 @@ static int fusesmb_mknod(const char *path, mode_t mode,
         return -EACCES;
 
     strcat(smb_path, stripworkgroup(path));
-    pthread_mutex_lock(&ctx_mutex);
-    if ((file = ctx->creat(ctx, smb_path, mode)) == NULL)
+    handlecache_drop(smb_path);
+    if (-1 == journal_wait(smb_path))
+        return -errno;
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    file = req.ctx->creat(req.ctx, smb_path, mode);
+    dircache_invalidate(smb_path);
+    if (file == NULL)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
 #ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
-    ctx->close_fn(ctx, file);
+    req.ctx->close_fn(req.ctx, file);
 #else
-    ctx->close(ctx, file);
+    req.ctx->close(req.ctx, file);
 #endif
 
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
 
     return 0;
 }
 
+/*
+ * Create the file for writing to the journal: it is created on the server
+ * right away, without truncating it, and closed again. The rewrite is
+ * journaled like opening does, see fusesmb_open().
+ */
+static int create_journaled(const char *smb_path, mode_t mode,
+                            struct fuse_file_info *fi, struct request *req)
+{
+    smb_handle_t *handle;
+
+    SMBCFILE *file = req->ctx->open(req->ctx, smb_path,
+                                    O_WRONLY | O_CREAT | (fi->flags & O_EXCL),
+                                    mode);
+    dircache_invalidate(smb_path);
+    if (file == NULL)
+    {
+        server_unlock(req, errno);
+        return -errno;
+    }
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+    req->ctx->close_fn(req->ctx, file);
+#else
+    req->ctx->close(req->ctx, file);
+#endif
+    server_unlock(req, 0);
+
+    if (-1 == journal_truncate(smb_path, 0) ||
+        NULL == (handle = handle_journaled(smb_path, fi->flags)))
+        return -errno;
+    fi->fh = (unsigned long)handle;
+    return 0;
+}
+
 static int fusesmb_create(const char *path, mode_t mode, struct fuse_file_info* fi)
 {
 	char smb_path[MY_MAXPATHLEN] = "smb:/";
-	SMBCFILE *file;
+	smb_handle_t *handle;
 
 	if (slashcount(path) <= 3)
 		return -EACCES;
 
 	strcat(smb_path, stripworkgroup(path));
-	pthread_mutex_lock(&ctx_mutex);
-	if ((file = smbc_getFunctionCreat(rwd_ctx)(rwd_ctx, smb_path, mode)) == NULL)
+	handlecache_drop(smb_path);
+	/* Creating over a file written back rewrites it in the journal, as
+	   opening does for writing only, see fusesmb_open() */
+	int writeback = (fi->flags & O_ACCMODE) == O_WRONLY && journal_enabled();
+	if (!writeback && -1 == journal_wait(smb_path))
+		return -errno;
+	int stripes = server_stripes(path);
+	struct request req;
+	if (-1 == server_lock(path, &req, SCHED_SHARED))
+		return -EHOSTDOWN;
+	if (writeback)
+		return create_journaled(smb_path, mode, fi, &req);
+	handle = handle_creat(req.ctx, sched_mutex(req.slot), smb_path, fi->flags, mode);
+	dircache_invalidate(smb_path);
+	if (handle == NULL)
 	{
-		pthread_mutex_unlock(&ctx_mutex);
+		server_unlock(&req, errno);
 		return -errno;
 	}
+	handle_set_stripes(handle, stripes);
+	struct dialect_info info;
+	if (0 == dialect_lookup(req.health.server, &info))
+		handle_set_iosize(handle, info.iosize);
 
-	fi->fh = (unsigned long) file;
+	fi->fh = (unsigned long) handle;
 
-	pthread_mutex_unlock(&ctx_mutex);
+	server_unlock(&req, 0);
 
 	return 0;
 }
@@ -715,13 +1505,22 @@ static int fusesmb_unlink(const char *file)
         return -EACCES;
 
     strcat(smb_path, stripworkgroup(file));
-    pthread_mutex_lock(&ctx_mutex);
-    if (ctx->unlink(ctx, smb_path) < 0)
+    handlecache_drop(smb_path);
+    if (-1 == journal_wait(smb_path))
+        return -errno;
+    struct request req;
+    if (-1 == server_lock(file, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    int ret = req.ctx->unlink(req.ctx, smb_path);
+    dircache_invalidate(smb_path);
+    blockcache_drop(smb_path);
+    blocksum_drop(smb_path);
+    if (ret < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
     return 0;
 }
 
@@ -733,14 +1532,21 @@ static int fusesmb_rmdir(const char *path)
         return -EACCES;
 
     strcat(smb_path, stripworkgroup(path));
-    pthread_mutex_lock(&ctx_mutex);
+    handlecache_drop(smb_path);
+    if (-1 == journal_wait(smb_path))
+        return -errno;
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
 
-    if (ctx->rmdir(ctx, smb_path) < 0)
+    int ret = req.ctx->rmdir(req.ctx, smb_path);
+    dircache_invalidate(smb_path);
+    if (ret < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
     return 0;
 }
 
@@ -752,13 +1558,17 @@ static int fusesmb_mkdir(const char *path, mode_t mode)
         return -EACCES;
 
     strcat(smb_path, stripworkgroup(path));
-    pthread_mutex_lock(&ctx_mutex);
-    if (ctx->mkdir(ctx, smb_path, mode) < 0)
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    int ret = req.ctx->mkdir(req.ctx, smb_path, mode);
+    dircache_invalidate(smb_path);
+    if (ret < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
 
     return 0;
 }
@@ -778,13 +1588,18 @@ static int fusesmb_utime(const char *path, struct utimbuf *buf)
     tbuf[1].tv_sec = buf->modtime;
     tbuf[1].tv_usec = 0;
 
-    pthread_mutex_lock(&ctx_mutex);
-    if (ctx->utimes(ctx, smb_path, tbuf) < 0)
+    /* Uploading later would change the time again */
+    if (-1 == journal_wait(smb_path))
+        return -errno;
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    if (req.ctx->utimes(req.ctx, smb_path, tbuf) < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
 
 
     return 0;
@@ -798,13 +1613,15 @@ static int fusesmb_chmod(const char *path, mode_t mode)
     char smb_path[MY_MAXPATHLEN] = "smb:/";
     strcat(smb_path, stripworkgroup(path));
 
-    pthread_mutex_lock(&ctx_mutex);
-    if (ctx->chmod(ctx, smb_path, mode) < 0)
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    if (req.ctx->chmod(req.ctx, smb_path, mode) < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    server_unlock(&req, 0);
     return 0;
 }
 static int fusesmb_chown(const char *path, uid_t uid, gid_t gid)
@@ -828,20 +1645,40 @@ static int fusesmb_truncate(const char *path, off_t size)
 
     SMBCFILE *file;
     strcat(smb_path, stripworkgroup(path));
+
+    /* Truncating a file with writes still in the journal goes there too,
+       behind them (see journal.h). Any other file is truncated right away,
+       a handle on it may write to the server meanwhile. */
+    off_t journaled = 0;
+    if (size == 0 && journal_enabled() &&
+        0 == journal_size(smb_path, &journaled))
+    {
+        handlecache_drop(smb_path);
+        blockcache_drop(smb_path);
+        return -1 == journal_truncate(smb_path, 0) ? -errno : 0;
+    }
+
+    if (-1 == journal_wait(smb_path))
+        return -errno;
     if (size == 0)
     {
-        pthread_mutex_lock(&ctx_mutex);
-        if (NULL == (file = ctx->creat(ctx, smb_path, 0666)))
+        handlecache_drop(smb_path);
+        struct request req;
+        if (-1 == server_lock(path, &req, SCHED_ANY))
+            return -EHOSTDOWN;
+        file = req.ctx->creat(req.ctx, smb_path, 0666);
+        blockcache_drop(smb_path);
+        if (file == NULL)
         {
-            pthread_mutex_unlock(&ctx_mutex);
+            server_unlock(&req, errno);
             return -errno;
         }
 #ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
-        ctx->close_fn(ctx, file);
+        req.ctx->close_fn(req.ctx, file);
 #else
-        ctx->close(ctx, file);
+        req.ctx->close(req.ctx, file);
 #endif
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, 0);
         return 0;
     }
     else
@@ -849,14 +1686,16 @@ static int fusesmb_truncate(const char *path, off_t size)
          /* If the truncate size is equal to the current file size, the file
             is also correctly truncated (fixes an error from OpenOffice)
             */
-         pthread_mutex_lock(&ctx_mutex);
+         struct request req;
+         if (-1 == server_lock(path, &req, SCHED_ANY))
+             return -EHOSTDOWN;
          struct stat st;
-         if (ctx->stat(ctx, smb_path, &st) < 0)
+         if (req.ctx->stat(req.ctx, smb_path, &st) < 0)
          {
-             pthread_mutex_unlock(&ctx_mutex);
+             server_unlock(&req, errno);
              return -errno;
          }
-         pthread_mutex_unlock(&ctx_mutex);
+         server_unlock(&req, 0);
          if (size == st.st_size)
          {
              return 0;
@@ -875,27 +1714,151 @@ static int fusesmb_rename(const char *path, const char *new_path)
 
     strcat(smb_path, stripworkgroup(path));
     strcat(new_smb_path, stripworkgroup(new_path));
+    handlecache_drop(smb_path);
+    handlecache_drop(new_smb_path);
+    if (-1 == journal_wait(smb_path) || -1 == journal_wait(new_smb_path))
+        return -errno;
 
-    pthread_mutex_lock(&ctx_mutex);
-    if (ctx->rename(ctx, smb_path, ctx, new_smb_path) < 0)
+    struct request req;
+    if (-1 == server_lock(path, &req, SCHED_ANY))
+        return -EHOSTDOWN;
+    int ret = req.ctx->rename(req.ctx, smb_path, req.ctx, new_smb_path);
+    dircache_invalidate(smb_path);
+    dircache_invalidate(new_smb_path);
+    blockcache_drop(smb_path);
+    blockcache_drop(new_smb_path);
+    blocksum_drop(smb_path);
+    blocksum_drop(new_smb_path);
+    if (ret < 0)
     {
-        pthread_mutex_unlock(&ctx_mutex);
+        server_unlock(&req, errno);
         return -errno;
     }
-    pthread_mutex_unlock(&ctx_mutex);
+    brlock_rename(smb_path, new_smb_path);
+    server_unlock(&req, 0);
+    return 0;
+}
+
+/*
+ * Byte-range locks, only between the users of this mount (see brlock.h)
+ */
+static int fusesmb_lock(const char *path, struct fuse_file_info *fi, int cmd,
+                        struct flock *lock)
+{
+    char smb_path[MY_MAXPATHLEN] = "smb:/";
+
+    if (slashcount(path) <= 3)
+        return -EINVAL;
+    strcat(smb_path, stripworkgroup(path));
+    if (-1 == brlock_lock(smb_path, fi->lock_owner, cmd, lock))
+        return -errno;
     return 0;
 }
 
+/*
+ * Returns 1 when both paths are in the same share
+ */
+static int same_share(const char *path, const char *other)
+{
+    const char *a = stripworkgroup(path), *b = stripworkgroup(other);
+    const char *share = strchr(a + 1, '/');
+    const char *end = share != NULL ? strchr(share + 1, '/') : NULL;
+    size_t len = end != NULL ? (size_t)(end - a) : strlen(a);
+
+    return strncmp(a, b, len) == 0 && (b[len] == '/' || b[len] == '\0');
+}
+
+#ifdef HAVE_LIBSMBCLIENT_SPLICE
+/* Called after every chunk, the copy goes on to the end */
+static int copy_progress(off_t n, void *priv)
+{
+    (void)n;
+    (void)priv;
+    return 1;
+}
+#endif
+
+/*
+ * Copies the file path to target (a path in the mount) on the server itself,
+ * with SMB2 copychunk: the data doesn't go through the network. Only works
+ * within a share. fusesmb-cp uses it, falling back to an ordinary copy.
+ */
+static int server_copy(const char *path, const char *target)
+{
+#ifdef HAVE_LIBSMBCLIENT_SPLICE
+    char smb_path[MY_MAXPATHLEN]   = "smb:/",
+         smb_target[MY_MAXPATHLEN] = "smb:/";
+    SMBCFILE *src, *dst = NULL;
+    struct stat st;
+    off_t copied = -1;
+
+    if (slashcount(path) <= 3 || slashcount(target) <= 3)
+        return -EINVAL;
+    if (!same_share(path, target))
+        return -EXDEV;
+    strcat(smb_path, stripworkgroup(path));
+    strcat(smb_target, stripworkgroup(target));
+    if (strcmp(smb_path, smb_target) == 0)
+        return -EINVAL;
+
+    handlecache_drop(smb_target);
+    if (-1 == journal_wait(smb_path) || -1 == journal_wait(smb_target))
+        return -errno;
+
+    /* A transfer, but the data stays on the server: it costs no more than a
+       request */
+    struct request req;
+    if (-1 == request_begin(path, &req, SCHED_BULK, SCHED_SHARED, 0))
+        return -EHOSTDOWN;
+    src = req.ctx->open(req.ctx, smb_path, O_RDONLY, 0);
+    if (src != NULL && 0 == req.ctx->fstat(req.ctx, src, &st))
+        dst = req.ctx->open(req.ctx, smb_target, O_WRONLY | O_CREAT | O_TRUNC,
+                            0666);
+    if (dst != NULL)
+        copied = smbc_getFunctionSplice(req.ctx)(req.ctx, src, dst,
+                                                 st.st_size, copy_progress,
+                                                 NULL);
+    int error = copied == -1 ? errno : copied < st.st_size ? EIO : 0;
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+    if (dst != NULL)
+        req.ctx->close_fn(req.ctx, dst);
+    if (src != NULL)
+        req.ctx->close_fn(req.ctx, src);
+#else
+    if (dst != NULL)
+        req.ctx->close(req.ctx, dst);
+    if (src != NULL)
+        req.ctx->close(req.ctx, src);
+#endif
+    dircache_invalidate(smb_target);
+    blockcache_drop(smb_target);
+    blocksum_drop(smb_target);
+    server_unlock(&req, error);
+    return -error;
+#else
+    (void)path;
+    (void)target;
+    return -ENOTSUP;
+#endif
+}
+
 static int fusesmb_setxattr(const char* path, const char* name, const char* value,
     size_t size, int flags)
 {
 	printf("fusesmb_setxattr path=%s\n", path);
 
-    (void)path;
-    (void)name;
-    (void)value;
-    (void)size;
     (void)flags;
+    if (strcmp(name, kServerCopyAttributeName) == 0)
+    {
+        char target[MY_MAXPATHLEN];
+
+        /* The value may end in a NUL or not */
+        if (size == 0 || size >= sizeof(target))
+            return -EINVAL;
+        memcpy(target, value, size);
+        target[size] = '\0';
+        return server_copy(path, target);
+    }
     return -EACCES;
 }
 
@@ -954,17 +1917,115 @@ static int fusesmb_removexattr(const char* path, const char* name)
     return -EACCES;
 }
 
+static SMBCCTX *new_context(void)
+{
+    return fusesmb_new_context(&cfg, &cfg_mutex);
+}
+
+/*
+ * A handle the handle cache let go of, it has nothing left to write
+ */
+static void close_parked(smb_handle_t *handle)
+{
+    char server[HEALTH_SERVER_NAME];
+
+    limit_url_server(handle->url, server, sizeof(server));
+    close_handle(server, handle);
+}
+
+/*
+ * Directories are listed on DIR_SLOT, so that is where connections are
+ * set up ahead of them, after the requests of the user
+ */
+static SMBCCTX *prewarm_begin(const char *server)
+{
+    return sched_context(sched_begin(server, SCHED_BACKGROUND, DIR_SLOT, 0));
+}
+
+static void prewarm_end(SMBCCTX *ctx)
+{
+    sched_end(sched_find(ctx));
+}
+
+/*
+ * A handle waiting to try again lets others have its slot meanwhile, a
+ * retry waits behind the interactive requests
+ */
+static void yield_slot(SMBCCTX *ctx, const char *url, int release)
+{
+    char server[HEALTH_SERVER_NAME];
+    int slot = sched_find(ctx);
+
+    if (release)
+    {
+        sched_end(slot);
+        return;
+    }
+    limit_url_server(url, server, sizeof(server));
+    sched_begin(server, SCHED_BULK, slot, 0);
+}
+
+/*
+ * Reads the ends of a file that was just opened, see prefetch.h. The open
+ * shares its handle, the prefetch holds it meanwhile. When it is gone or
+ * its directory changed there is nothing to fetch for.
+ */
+static void prefetch_ends(const char *path, int flags, size_t head,
+                          size_t tail)
+{
+    char smb_path[MY_MAXPATHLEN] = "smb:/";
+    struct request req;
+
+    strcat(smb_path, stripworkgroup(path));
+    smb_handle_t *handle = handlecache_take(smb_path, flags);
+    if (handle == NULL)
+        return;
+    handle_lock(handle);
+    if (0 == request_begin(path, &req, SCHED_BACKGROUND,
+                           sched_find(handle->ctx), head + tail))
+    {
+        handle_prefetch_ends(handle, head, tail);
+        server_unlock(&req, 0);
+    }
+    handle_unlock(handle);
+    if (-1 == handlecache_release(handle))
+        close_parked(handle);
+}
+
 static void *fusesmb_init(struct fuse_conn_info* info)
 {
     (void)info;
     if (0 != pthread_create(&cleanup_thread, NULL, smb_purge_thread, NULL))
         exit(EXIT_FAILURE);
+    handle_init(yield_slot);
+    connpool_prewarm_init(prewarm_begin, prewarm_end);
+    health_init(server_probe);
+    stripe_init(new_context);
+    dialect_init(probe_dialect, server_dialect_config);
+    dircache_init(new_context);
+    handlecache_init(close_parked);
+    prefetch_init(prefetch_ends);
+
+    char journal[1024], status[1024];
+    get_path_in_settings_dir(&journal[0], sizeof(journal), "fusesmb.journal");
+    get_path_in_settings_dir(&status[0], sizeof(status), "fusesmb.uploads");
+    if (-1 == journal_init(journal, status, new_context))
+        fprintf(stderr, "Could not open the journal %s (%s)\n", journal,
+                strerror(errno));
     return NULL;
 }
 
 static void fusesmb_destroy(void *private_data)
 {
     (void)private_data;
+    prefetch_shutdown();
+    handlecache_shutdown();
+    journal_shutdown();
+    connpool_prewarm_shutdown();
+    health_shutdown();
+    stripe_shutdown();
+    dialect_shutdown();
+    dircache_shutdown();
     pthread_cancel(cleanup_thread);
     pthread_join(cleanup_thread, NULL);
 
@@ -977,7 +2038,7 @@ static int fusesmb_getfsinfo(struct fs_info* info)
         | B_FS_HAS_ATTR | B_FS_HAS_MIME;
         // TODO: find out if read-only
     info->block_size = 4096;
-    info->io_size = 128 * 1024;
+    info->io_size = throughput_io_size(128 * 1024);
     info->total_blocks = (100ULL * 1024 * 1024 * 1024) / info->block_size;
     info->free_blocks = info->total_blocks;
     info->total_nodes = 100;
@@ -1005,9 +2066,9 @@ static struct fuse_operations fusesmb_oper = {
     fusesmb_read,			// read
     fusesmb_write,			// write
     fusesmb_statfs,			// statfs
-    NULL,					// flush
+    fusesmb_flush,			// flush
     fusesmb_release,		// release
-    NULL,					// fsync
+    fusesmb_fsync,			// fsync
     fusesmb_setxattr,		// setxattr
     fusesmb_getxattr,		// getxattr
     fusesmb_listxattr,		// listxattr
@@ -1022,7 +2083,7 @@ static struct fuse_operations fusesmb_oper = {
     fusesmb_create,			// create
 	NULL,					// ftruncate
 	NULL,					// fgetattr
-	NULL,					// lock
+	fusesmb_lock,			// lock
 	NULL,					// utimens
 	NULL,					// bmap
     fusesmb_getfsinfo		// get_fs_info
@@ -1105,16 +2166,66 @@ int main(int argc, char *argv[])
 
     register_mime_types();
 
-    ctx = fusesmb_new_context(&cfg, &cfg_mutex);
-    rwd_ctx = fusesmb_new_context(&cfg, &cfg_mutex);
+#ifdef HAVE_LIBSMBCLIENT_THREAD_POSIX
+    /* Requests run on several contexts at once */
+    smbc_thread_posix();
+#endif
 
-    if (ctx == NULL || rwd_ctx == NULL)
+    if (-1 == sched_init(opts.global_connections, opts.global_reserved,
+                         new_context, dialect_range, dialect_set_range))
+        exit(EXIT_FAILURE);
+    probe_ctx = fusesmb_new_context(&cfg, &cfg_mutex);
+    if (probe_ctx == NULL)
         exit(EXIT_FAILURE);
 
-    fuse_main(argc, argv, &fusesmb_oper, NULL);
+    /* A probe should not take as long as a request may */
+    probe_ctx->timeout = 5000;
+
+    int i;
+    for (i = 0; i < sched_slots(); i++)
+        connpool_attach(sched_context(i));
+    stats_init();
+    throughput_init();
+    attrcache_init();
+    limit_init(server_limits);
+    global_limits();
+    dircache_set_ttl(opts.global_dircachettl);
+    blockcache_set_size((size_t)opts.global_blockcache << 20);
+    handlecache_set_ttl(opts.global_handlecache);
+    journal_set_size((size_t)opts.global_writeback << 20);
+    prefetch_profiles();
+
+    /* The timeouts of the high level FUSE API hold for the whole mount */
+    char **fuse_argv = argv;
+    char timeouts[64];
+    if (opts.global_kernelcache)
+    {
+        fuse_argv = (char **)malloc((argc + 3) * sizeof(char *));
+        if (fuse_argv == NULL)
+            exit(EXIT_FAILURE);
+        memcpy(fuse_argv, argv, argc * sizeof(char *));
+        snprintf(timeouts, sizeof(timeouts),
+                 "attr_timeout=%d,entry_timeout=%d",
+                 opts.global_kernelcachetimeout,
+                 opts.global_kernelcachetimeout);
+        fuse_argv[argc] = (char *)"-o";
+        fuse_argv[argc + 1] = timeouts;
+        fuse_argv[argc + 2] = NULL;
+        argc += 2;
+    }
 
-    smbc_free_context(ctx, 1);
-    smbc_free_context(rwd_ctx, 1);
+    fuse_main(argc, fuse_argv, &fusesmb_oper, NULL);
+    if (fuse_argv != argv)
+        free(fuse_argv);
+
+    sched_shutdown();
+    smbc_free_context(probe_ctx, 1);
+    limit_shutdown();
+    throughput_free();
+    blockcache_free();
+    blocksum_free();
+    attrcache_free();
+    stats_free();
 
     options_free(&opts);
     config_free(&cfg);
@@ -0,0 +1,811 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include "handle.h"
+#include "limit.h"
+#include "throughput.h"
+#include "blockcache.h"
+#include "dircache.h"
+#include "stats.h"
+#include "debug.h"
+
+#define WRITE_BUFFER (64 * 1024)
+#define RETRIES 6               /* the last wait is 3.2 seconds */
+#define BACKOFF_MS 100
+#define STRIPE_CHUNK (256 * 1024)  /* or the I/O size when larger */
+#define SEQUENTIAL_AFTER (1024 * 1024)  /* bytes before reading ahead */
+
+static handle_yield_fn yield_fn = NULL;
+
+void handle_init(handle_yield_fn yield)
+{
+    yield_fn = yield;
+}
+
+/*
+ * Errors after which opening the file again may help: the file or the
+ * connection it was on is gone, or memory was short
+ */
+static int is_reconnectable(int error)
+{
+    switch (error)
+    {
+        case EBADF:
+        case ECONNRESET:
+        case ECONNABORTED:
+        case ENOTCONN:
+        case EPIPE:
+        case ETIMEDOUT:
+        case ENOMEM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static void close_file(smb_handle_t *h)
+{
+    if (h->file == NULL)
+        return;
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+    h->ctx->close_fn(h->ctx, h->file);
+#else
+    h->ctx->close(h->ctx, h->file);
+#endif
+    h->file = NULL;
+}
+
+static int reopen(smb_handle_t *h)
+{
+    h->file = h->ctx->open(h->ctx, h->url, h->flags, 0);
+    if (h->file == NULL)
+        return -1;
+    if (h->ctx->lseek(h->ctx, h->file, h->pos, SEEK_SET) == (off_t)-1)
+    {
+        int error = errno;
+        close_file(h);
+        errno = error;
+        return -1;
+    }
+    debug("reopened %s at %lld", h->url, (long long)h->pos);
+    return 0;
+}
+
+/*
+ * Wait before the next attempt without holding up the other requests. The
+ * first retry is immediate, most often the server just closed an idle
+ * connection.
+ */
+static void backoff(SMBCCTX *ctx, pthread_mutex_t *lock, const char *url,
+                    int attempt)
+{
+    if (attempt == 0)
+        return;
+    if (yield_fn != NULL)
+        yield_fn(ctx, url, 1);
+    else
+        pthread_mutex_unlock(lock);
+    usleep((BACKOFF_MS << (attempt - 1)) * 1000);
+    if (yield_fn != NULL)
+        yield_fn(ctx, url, 0);
+    else
+        pthread_mutex_lock(lock);
+}
+
+static ssize_t pread_once(smb_handle_t *h, char *buf, size_t size,
+                          off_t offset)
+{
+    if (offset != h->pos &&
+        h->ctx->lseek(h->ctx, h->file, offset, SEEK_SET) == (off_t)-1)
+        return -1;
+    h->pos = offset;
+    ssize_t ret = h->ctx->read(h->ctx, h->file, buf, size);
+    if (ret > 0)
+        h->pos += ret;
+    return ret;
+}
+
+static ssize_t pwrite_once(smb_handle_t *h, const char *buf, size_t size,
+                           off_t offset)
+{
+    if (offset != h->pos &&
+        h->ctx->lseek(h->ctx, h->file, offset, SEEK_SET) == (off_t)-1)
+        return -1;
+    h->pos = offset;
+    ssize_t ret = h->ctx->write(h->ctx, h->file, (void *)buf, size);
+    if (ret > 0)
+        h->pos += ret;
+    return ret;
+}
+
+/*
+ * Run a read or write, opening the file again while the error says that may
+ * help
+ */
+static ssize_t with_retry(smb_handle_t *h, int write, char *buf, size_t size,
+                          off_t offset)
+{
+    char server[256];
+    int attempt;
+    ssize_t ret = -1;
+
+    limit_url_server(h->url, server, sizeof(server));
+    for (attempt = 0; attempt <= RETRIES; attempt++)
+    {
+        backoff(h->ctx, h->lock, h->url, attempt);
+        if (h->file == NULL && -1 == reopen(h))
+        {
+            if (!is_reconnectable(errno))
+                return -1;
+            continue;
+        }
+        limit_begin(server, size);
+        double start = stats_now_ms();
+        if (write)
+            ret = pwrite_once(h, buf, size, offset);
+        else
+            ret = pread_once(h, buf, size, offset);
+        if (ret > 0)
+            throughput_sample(h->url, ret, stats_now_ms() - start);
+        limit_end(server);
+        if (ret >= 0 || !is_reconnectable(errno))
+            return ret;
+
+        int error = errno;
+        debug("%s failed (%s), reopening", h->url, strerror(error));
+        close_file(h);
+        errno = error;
+    }
+    return ret;
+}
+
+static smb_handle_t *handle_new(SMBCCTX *ctx, pthread_mutex_t *lock,
+                                SMBCFILE *file, const char *url, int flags)
+{
+    smb_handle_t *h = (smb_handle_t *)malloc(sizeof(smb_handle_t));
+    if (h == NULL || NULL == (h->url = strdup(url)))
+    {
+        free(h);
+        errno = ENOMEM;
+        return NULL;
+    }
+    pthread_mutex_init(&h->mutex, NULL);
+    h->ctx = ctx;
+    h->lock = lock;
+    h->file = file;
+    /* Opening again must not create or truncate the file */
+    h->flags = flags & ~(O_CREAT | O_EXCL | O_TRUNC);
+    h->pos = 0;
+    h->wbuf = NULL;
+    h->wlen = 0;
+    h->wsize = WRITE_BUFFER;
+    h->iosize = WRITE_BUFFER;
+    h->chunk = WRITE_BUFFER;
+    h->woff = 0;
+    h->stripes = 1;
+    memset(h->stripe_files, 0, sizeof(h->stripe_files));
+    h->next_read = 0;
+    h->sequential = 0;
+    h->rbuf = NULL;
+    h->rlen = 0;
+    h->roff = 0;
+    h->reof = 0;
+    h->lease = 0;
+    h->content = NULL;
+    h->clen = 0;
+    h->opened = stats_now_ms();
+    h->writeback = 0;
+    return h;
+}
+
+smb_handle_t *handle_open(SMBCCTX *ctx, pthread_mutex_t *lock,
+                          const char *url, int flags, mode_t mode)
+{
+    char dir_url[2048];
+    int attempt;
+    SMBCFILE *file = NULL;
+
+    for (attempt = 0; attempt <= RETRIES && file == NULL; attempt++)
+    {
+        backoff(ctx, lock, url, attempt);
+        file = ctx->open(ctx, url, flags, mode);
+        if (file == NULL && errno == EISDIR)
+        {
+            snprintf(dir_url, sizeof(dir_url), "%s/", url);
+            url = dir_url;
+            file = smbc_getFunctionOpen(ctx)(ctx, url, flags, mode);
+        }
+        if (file == NULL && errno != ENOMEM)
+            return NULL;
+    }
+    if (file == NULL)
+        return NULL;
+
+    smb_handle_t *h = handle_new(ctx, lock, file, url, flags);
+    if (h == NULL)
+    {
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+        ctx->close_fn(ctx, file);
+#else
+        ctx->close(ctx, file);
+#endif
+        errno = ENOMEM;
+    }
+    return h;
+}
+
+smb_handle_t *handle_creat(SMBCCTX *ctx, pthread_mutex_t *lock,
+                           const char *url, int flags, mode_t mode)
+{
+    SMBCFILE *file = smbc_getFunctionCreat(ctx)(ctx, url, mode);
+    if (file == NULL)
+        return NULL;
+
+    /* creat() opens for writing only, reopen the same way */
+    smb_handle_t *h = handle_new(ctx, lock, file, url,
+                                 (flags & ~O_ACCMODE) | O_WRONLY);
+    if (h == NULL)
+    {
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+        ctx->close_fn(ctx, file);
+#else
+        ctx->close(ctx, file);
+#endif
+        errno = ENOMEM;
+    }
+    return h;
+}
+
+smb_handle_t *handle_journaled(const char *url, int flags)
+{
+    smb_handle_t *h = handle_new(NULL, NULL, NULL, url, flags);
+    if (h != NULL)
+        h->writeback = 1;
+    return h;
+}
+
+void handle_set_stripes(smb_handle_t *h, int count)
+{
+    if (count < 1)
+        count = 1;
+    if (count > STRIPE_MAX)
+        count = STRIPE_MAX;
+    h->stripes = count;
+    if (count > 1 && h->chunk < STRIPE_CHUNK)
+        h->chunk = STRIPE_CHUNK;
+    h->wsize = count * h->chunk;
+}
+
+void handle_set_iosize(smb_handle_t *h, size_t size)
+{
+    h->iosize = size;
+    h->chunk = h->stripes > 1 && size < STRIPE_CHUNK ? STRIPE_CHUNK : size;
+    h->wsize = h->stripes * h->chunk;
+}
+
+/*
+ * Follow the measured throughput of the share. The buffers only change size
+ * while they are empty.
+ */
+static void tune(smb_handle_t *h)
+{
+    size_t fallback = h->stripes > 1 && h->iosize < STRIPE_CHUNK ?
+        STRIPE_CHUNK : h->iosize;
+    size_t chunk = throughput_chunk(h->url, fallback);
+
+    if (chunk == h->chunk || h->wlen > 0)
+        return;
+    free(h->wbuf);
+    free(h->rbuf);
+    h->wbuf = NULL;
+    h->rbuf = NULL;
+    h->rlen = 0;
+    h->reof = 0;
+    h->chunk = chunk;
+    h->wsize = h->stripes * chunk;
+}
+
+int handle_prefetch(smb_handle_t *h, size_t limit)
+{
+    size_t done = 0;
+    char *buf = (char *)malloc(limit + 1);
+
+    if (buf == NULL)
+        return -1;
+    /* One byte more tells whether the file grew past the limit */
+    while (done <= limit)
+    {
+        ssize_t ret = pread_once(h, buf + done, limit + 1 - done, done);
+        if (ret < 0)
+        {
+            free(buf);
+            return -1;
+        }
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    if (done > limit)
+    {
+        free(buf);
+        return -1;
+    }
+    h->content = buf;
+    h->clen = done;
+    /* Nothing else is read from the server */
+    close_file(h);
+    return 0;
+}
+
+void handle_lock(smb_handle_t *h)
+{
+    pthread_mutex_lock(&h->mutex);
+}
+
+void handle_unlock(smb_handle_t *h)
+{
+    pthread_mutex_unlock(&h->mutex);
+}
+
+/*
+ * Transfer len bytes at offset, one chunk per stripe. Chunks a stripe could
+ * not do go over the connection of the handle. Returns the number of bytes
+ * up to the first short chunk (the end of the file) or -1.
+ */
+static ssize_t striped(smb_handle_t *h, int write, char *buf, size_t len,
+                       off_t offset)
+{
+    struct stripe_job jobs[STRIPE_MAX];
+    int i, count = (len + h->chunk - 1) / h->chunk;
+    size_t total = 0;
+
+    for (i = 0; i < count; i++)
+    {
+        jobs[i].file = &h->stripe_files[i];
+        jobs[i].url = h->url;
+        jobs[i].flags = h->flags;
+        jobs[i].write = write;
+        jobs[i].buf = buf + i * h->chunk;
+        jobs[i].offset = offset + i * h->chunk;
+        jobs[i].size = len - i * h->chunk < h->chunk ?
+            len - i * h->chunk : h->chunk;
+    }
+
+    pthread_mutex_unlock(h->lock);
+    stripe_run(jobs, count);
+    pthread_mutex_lock(h->lock);
+
+    for (i = 0; i < count; i++)
+    {
+        ssize_t ret = jobs[i].result;
+        if (ret > 0)
+            throughput_sample(h->url, ret, jobs[i].ms);
+        if (ret < 0)
+        {
+            debug("stripe %d of %s failed (%s)", i, h->url,
+                  strerror(jobs[i].error));
+            ret = with_retry(h, write, jobs[i].buf, jobs[i].size,
+                             jobs[i].offset);
+            if (ret < 0)
+                return -1;
+        }
+        total += ret;
+        if ((size_t)ret < jobs[i].size)
+            break;
+    }
+    return total;
+}
+
+int handle_flush(smb_handle_t *h)
+{
+    size_t done = 0;
+
+    /* Only a full buffer is worth the stripes, the rest is the tail */
+    if (h->stripes > 1 && h->wlen > h->chunk)
+    {
+        ssize_t ret = striped(h, 1, h->wbuf, h->wlen, h->woff);
+        if (ret < 0)
+            return -1;
+        if ((size_t)ret < h->wlen)
+        {
+            errno = EIO;
+            return -1;
+        }
+        h->wlen = 0;
+        return 0;
+    }
+
+    while (done < h->wlen)
+    {
+        ssize_t ret = with_retry(h, 1, h->wbuf + done, h->wlen - done,
+                                 h->woff + done);
+        if (ret < 0)
+        {
+            /* Keep what is left, a later flush may still succeed */
+            memmove(h->wbuf, h->wbuf + done, h->wlen - done);
+            h->wlen -= done;
+            h->woff += done;
+            return -1;
+        }
+        if (ret == 0)
+        {
+            errno = EIO;
+            return -1;
+        }
+        done += ret;
+    }
+    h->wlen = 0;
+    return 0;
+}
+
+/*
+ * Read len bytes at offset with as many requests as it takes, fewer only at
+ * the end of the file
+ */
+static ssize_t read_full(smb_handle_t *h, char *buf, size_t len,
+                         off_t offset)
+{
+    size_t done = 0;
+
+    while (done < len)
+    {
+        ssize_t ret = with_retry(h, 0, buf + done, len - done,
+                                 offset + done);
+        if (ret < 0)
+            return -1;
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    return done;
+}
+
+/*
+ * Fill the read window at offset, over the stripes or on the connection of
+ * the handle
+ */
+static ssize_t fill_window(smb_handle_t *h, size_t window, off_t offset)
+{
+    ssize_t ret;
+
+    if (h->stripes > 1)
+        ret = striped(h, 0, h->rbuf, window, offset);
+    else
+        ret = read_full(h, h->rbuf, window, offset);
+    if (ret > 0 && h->lease > 0)
+        blockcache_put(h->url, &h->version, h->rbuf, ret, offset);
+    return ret;
+}
+
+/*
+ * Blocks of the file in the cache can be used while its directory is
+ * watched and no change was reported since the version was read: nobody
+ * wrote to it since. When that no longer holds the lease is broken, the
+ * blocks are dropped and a new one is taken.
+ */
+static int has_lease(smb_handle_t *h)
+{
+    struct stat st;
+
+    if (!blockcache_enabled())
+        return 0;
+    if (h->lease > 0 && dircache_unchanged(h->url, h->lease))
+        return 1;
+    if (h->lease > 0)
+    {
+        blockcache_drop(h->url);
+        h->lease = 0;
+    }
+
+    double now = stats_now_ms();
+    if (h->file == NULL || !dircache_unchanged(h->url, now) ||
+        h->ctx->fstat(h->ctx, h->file, &st) < 0)
+        return 0;
+    h->version.mtime = st.st_mtime;
+    h->version.size = st.st_size;
+    h->lease = now;
+    return 1;
+}
+
+/*
+ * Read the whole blocks around the range, so they can be cached
+ */
+static ssize_t block_read(smb_handle_t *h, char *buf, size_t size,
+                          off_t offset)
+{
+    off_t start = offset - offset % BLOCKCACHE_BLOCK;
+    off_t end = offset + size + BLOCKCACHE_BLOCK - 1;
+    end -= end % BLOCKCACHE_BLOCK;
+
+    char *blocks = (char *)malloc(end - start);
+    if (blocks == NULL)
+        return with_retry(h, 0, buf, size, offset);
+    ssize_t ret = read_full(h, blocks, end - start, start);
+    if (ret < 0)
+    {
+        free(blocks);
+        return -1;
+    }
+    blockcache_put(h->url, &h->version, blocks, ret, start);
+
+    ret -= offset - start;
+    if (ret < 0)
+        ret = 0;
+    if ((size_t)ret > size)
+        ret = size;
+    memcpy(buf, blocks + (offset - start), ret);
+    free(blocks);
+    return ret;
+}
+
+/*
+ * Serve a read from the window, filling it at offset when it doesn't hold
+ * the range
+ */
+static ssize_t window_read(smb_handle_t *h, char *buf, size_t size,
+                           off_t offset)
+{
+    if (offset < h->roff || offset + (off_t)size > h->roff + (off_t)h->rlen)
+    {
+        /* A short window ended at the end of the file */
+        int at_end = h->reof && offset >= h->roff &&
+            offset <= h->roff + (off_t)h->rlen;
+        if (!at_end)
+        {
+            tune(h);
+            size_t window = h->stripes * h->chunk;
+            if (size >= window)
+                return with_retry(h, 0, buf, size, offset);
+            if (h->rbuf == NULL && NULL == (h->rbuf = (char *)malloc(window)))
+                return with_retry(h, 0, buf, size, offset);
+            h->rlen = 0;
+            h->reof = 0;
+            ssize_t ret = fill_window(h, window, offset);
+            if (ret < 0)
+                return -1;
+            h->roff = offset;
+            h->rlen = ret;
+            h->reof = (size_t)ret < window;
+        }
+    }
+
+    size_t avail = h->roff + h->rlen - offset;
+    if (size > avail)
+        size = avail;
+    memcpy(buf, h->rbuf + (offset - h->roff), size);
+    return size;
+}
+
+void handle_set_version(smb_handle_t *h, const struct stat *st, double when)
+{
+    if (!blockcache_enabled() || !dircache_unchanged(h->url, when))
+        return;
+    h->version.mtime = st->st_mtime;
+    h->version.size = st->st_size;
+    h->lease = when;
+}
+
+/*
+ * The ranges handle_prefetch_ends() reads, in whole blocks so they can be
+ * cached. Returns their number.
+ */
+static int end_ranges(smb_handle_t *h, size_t head, size_t tail,
+                      off_t *offsets, size_t *sizes)
+{
+    int count = 0;
+
+    off_t size = h->version.size;
+    off_t head_end = (head + BLOCKCACHE_BLOCK - 1) / BLOCKCACHE_BLOCK *
+        BLOCKCACHE_BLOCK;
+    off_t tail_start = size > (off_t)tail ? size - tail : 0;
+    tail_start -= tail_start % BLOCKCACHE_BLOCK;
+    if (head_end > size)
+        head_end = size;
+    if (tail == 0)
+        tail_start = size;
+    if (head > 0 && head_end >= tail_start)
+    {
+        head_end = size;
+        tail_start = size;
+    }
+    if (head_end > 0)
+    {
+        offsets[count] = 0;
+        sizes[count++] = head_end;
+    }
+    if (tail_start < size)
+    {
+        offsets[count] = tail_start;
+        sizes[count++] = size - tail_start;
+    }
+    return count;
+}
+
+int handle_ends_missing(smb_handle_t *h, size_t head, size_t tail)
+{
+    off_t offsets[2];
+    size_t sizes[2];
+    int i;
+
+    if (!has_lease(h))
+        return 0;
+    int count = end_ranges(h, head, tail, offsets, sizes);
+    for (i = 0; i < count; i++)
+        if (!blockcache_has(h->url, &h->version, sizes[i], offsets[i]))
+            return 1;
+    return 0;
+}
+
+int handle_prefetch_ends(smb_handle_t *h, size_t head, size_t tail)
+{
+    struct stripe_job jobs[2];
+    off_t offsets[2];
+    size_t sizes[2];
+    int i;
+
+    if (!has_lease(h))
+        return -1;
+    int count = end_ranges(h, head, tail, offsets, sizes);
+
+    for (i = 0; i < count; i++)
+    {
+        jobs[i].buf = NULL;
+        jobs[i].result = -1;
+        if (blockcache_has(h->url, &h->version, sizes[i], offsets[i]))
+            continue;
+        if (NULL == (jobs[i].buf = (char *)malloc(sizes[i])))
+            continue;
+        jobs[i].file = &h->stripe_files[i];
+        jobs[i].url = h->url;
+        jobs[i].flags = h->flags;
+        jobs[i].write = 0;
+        jobs[i].size = sizes[i];
+        jobs[i].offset = offsets[i];
+    }
+
+    /* Both ends at once over the stripes, when there are any */
+    if (h->stripes > 1 && count == 2 &&
+        jobs[0].buf != NULL && jobs[1].buf != NULL)
+    {
+        pthread_mutex_unlock(h->lock);
+        stripe_run(jobs, count);
+        pthread_mutex_lock(h->lock);
+    }
+    for (i = 0; i < count; i++)
+    {
+        if (jobs[i].buf == NULL)
+            continue;
+        if (jobs[i].result > 0)
+            throughput_sample(h->url, jobs[i].result, jobs[i].ms);
+        else
+            jobs[i].result = read_full(h, jobs[i].buf, jobs[i].size,
+                                       jobs[i].offset);
+        if (jobs[i].result > 0)
+            blockcache_put(h->url, &h->version, jobs[i].buf,
+                           jobs[i].result, jobs[i].offset);
+        free(jobs[i].buf);
+    }
+    return 0;
+}
+
+ssize_t handle_read(smb_handle_t *h, char *buf, size_t size, off_t offset)
+{
+    if (h->content != NULL)
+    {
+        if (offset >= (off_t)h->clen)
+            return 0;
+        if (size > h->clen - offset)
+            size = h->clen - offset;
+        memcpy(buf, h->content + offset, size);
+        return size;
+    }
+
+    /* Reads have to see the writes made through this handle */
+    if (h->wlen > 0 && -1 == handle_flush(h))
+        return -1;
+
+    int lease = has_lease(h);
+    if (lease)
+    {
+        ssize_t ret = blockcache_get(h->url, &h->version, buf, size, offset);
+        if (ret >= 0)
+            return ret;
+    }
+
+    if (offset == h->next_read)
+        h->sequential += size;
+    else
+        h->sequential = 0;
+    h->next_read = offset + size;
+    if (h->sequential >= SEQUENTIAL_AFTER)
+        return window_read(h, buf, size, offset);
+    if (lease)
+        return block_read(h, buf, size, offset);
+    return with_retry(h, 0, buf, size, offset);
+}
+
+ssize_t handle_write(smb_handle_t *h, const char *buf, size_t size,
+                     off_t offset)
+{
+    /* The read window and the cache may hold what is overwritten now */
+    h->rlen = 0;
+    h->reof = 0;
+    free(h->content);
+    h->content = NULL;
+    if (h->lease > 0)
+    {
+        blockcache_drop(h->url);
+        h->lease = 0;
+    }
+
+    /* Pending data that doesn't continue here goes out first */
+    if (h->wlen > 0 &&
+        (offset != h->woff + (off_t)h->wlen || h->wlen + size > h->wsize))
+    {
+        if (-1 == handle_flush(h))
+            return -1;
+    }
+
+    if (h->wlen == 0)
+        tune(h);
+    if (size >= h->wsize)
+        return with_retry(h, 1, (char *)buf, size, offset);
+
+    if (h->wbuf == NULL &&
+        NULL == (h->wbuf = (char *)malloc(h->wsize)))
+        return with_retry(h, 1, (char *)buf, size, offset);
+
+    if (h->wlen == 0)
+        h->woff = offset;
+    memcpy(h->wbuf + h->wlen, buf, size);
+    h->wlen += size;
+    return size;
+}
+
+static void handle_free(smb_handle_t *h)
+{
+    pthread_mutex_destroy(&h->mutex);
+    free(h->rbuf);
+    free(h->wbuf);
+    free(h->content);
+    free(h->url);
+    free(h);
+}
+
+int handle_close(smb_handle_t *h)
+{
+    int i, ret = 0, error = 0;
+
+    if (h->wlen > 0 && -1 == handle_flush(h))
+    {
+        ret = -1;
+        error = errno;
+    }
+    close_file(h);
+    for (i = 0; i < STRIPE_MAX; i++)
+        if (h->stripe_files[i] != NULL)
+            stripe_close(i, h->stripe_files[i]);
+    handle_free(h);
+    errno = error;
+    return ret;
+}
+
+void handle_abandon(smb_handle_t *h)
+{
+    if (h->wlen > 0)
+    {
+        debug("%s: %zu bytes not written, the server is down", h->url,
+              h->wlen);
+    }
+    handle_free(h);
+}
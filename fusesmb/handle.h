@@ -0,0 +1,157 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Open file handles of fusesmb. A handle remembers how its file was opened,
+   so when the connection to the server breaks the file is opened again and
+   the request retried, with an increasing delay between the attempts. Small
+   sequential writes are collected in a buffer, which survives a reconnect
+   and is written once the file is open again.
+
+   Sequential reads are served from a window of one chunk, which is filled
+   ahead of them. A handle can also spread large sequential transfers over
+   several stripes (see stripe.h): the window then holds one chunk per
+   stripe, filled at once, and the write buffer grows to the same size and
+   is written the same way. The chunk follows the throughput measured on the
+   share (see throughput.h) whenever the buffers are empty.
+
+   Reads also go through the block cache (see blockcache.h) while the handle
+   holds a lease on the file. SMB leases are not available through
+   libsmbclient, so the watch on the directory of the file stands in for
+   one (see dircache.h): it is held from when the version of the file was
+   read for as long as no change in the directory is reported. Writes
+   through the handle break it.
+
+   Unlike an SMB lease this is best-effort and not safe with writers on
+   other clients. Change notifications arrive asynchronously, so blocks
+   written elsewhere can be served until the notification is in. A write
+   that keeps the size and lands within the second of the last
+   modification time also leaves the version unchanged. Where files are
+   written from several clients at once, the block cache should be turned
+   off (blockcache = 0 in fusesmb.conf).
+
+   Handles opened for reading may be shared by the opens of their file and
+   outlive them for a moment, see handlecache.h.
+
+   Requests on a handle are serialized with handle_lock(), taken before the
+   lock of the context. The other functions must be called with both held,
+   the context lock is released while the stripes are busy. While waiting
+   between attempts the context is given up altogether, see handle_init().
+*/
+
+#ifndef HANDLE_H
+#define HANDLE_H
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <pthread.h>
+#include <libsmbclient.h>
+#include "stripe.h"
+#include "blockcache.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef struct smb_handle {
+    pthread_mutex_t mutex;
+    SMBCCTX *ctx;
+    pthread_mutex_t *lock;
+    SMBCFILE *file;             /* NULL after the connection broke */
+    char *url;
+    int flags;                  /* for reopening, without O_CREAT etc. */
+    off_t pos;                  /* file position on the server */
+    char *wbuf;                 /* pending writes, at woff */
+    size_t wlen;
+    size_t wsize;
+    size_t iosize;              /* largest request the server takes */
+    size_t chunk;               /* per stripe, adapted to the share */
+    off_t woff;
+    int stripes;                /* 1 when not striping */
+    SMBCFILE *stripe_files[STRIPE_MAX];
+    off_t next_read;            /* to detect sequential reads */
+    off_t sequential;
+    char *rbuf;                 /* read window, at roff */
+    size_t rlen;
+    off_t roff;
+    int reof;                   /* the window ends at the end of the file */
+    struct blockcache_version version;  /* of the file under the lease */
+    double lease;               /* when it was taken, 0 for none */
+    char *content;              /* the whole file, see handle_prefetch() */
+    size_t clen;
+    double opened;              /* when, see handlecache.h */
+    int writeback;              /* writes go to the journal, see journal.h */
+} smb_handle_t;
+
+/* Gives up ctx with release 1 before waiting between attempts on url, and
+   takes it back locked with release 0, so other requests can use it
+   meanwhile. Without one only the context lock is released. */
+typedef void (*handle_yield_fn)(SMBCCTX *ctx, const char *url, int release);
+
+void handle_init(handle_yield_fn yield);
+
+/* Returns NULL and sets errno on failure */
+smb_handle_t *handle_open(SMBCCTX *ctx, pthread_mutex_t *lock,
+    const char *url, int flags, mode_t mode);
+smb_handle_t *handle_creat(SMBCCTX *ctx, pthread_mutex_t *lock,
+    const char *url, int flags, mode_t mode);
+
+/* A handle whose writes all go to the journal (see journal.h), nothing is
+   opened on the server for it and closing it sends nothing */
+smb_handle_t *handle_journaled(const char *url, int flags);
+
+/* Use count stripes for large sequential transfers, before the first one */
+void handle_set_stripes(smb_handle_t *handle, int count);
+
+/* Largest request the server takes, also before the first transfer */
+void handle_set_iosize(smb_handle_t *handle, size_t size);
+
+/* Read the whole file when it has at most limit bytes, reads are then
+   served from memory and the file on the server is closed. For read-only
+   handles, right after opening. Returns 0 or -1 when the file is larger
+   or the read failed, the handle is still usable then. */
+int handle_prefetch(smb_handle_t *handle, size_t limit);
+
+/* The file as getattr found it at when, in milliseconds since the epoch.
+   Starts the lease from then if the directory was watched already, saving
+   the request for the version. */
+void handle_set_version(smb_handle_t *handle, const struct stat *st,
+    double when);
+
+/* Read head bytes at the start and tail bytes at the end of the file into
+   the block cache, both at once when the handle stripes. Only under a
+   lease, returns -1 without one. */
+int handle_prefetch_ends(smb_handle_t *handle, size_t head, size_t tail);
+
+/* Whether handle_prefetch_ends() would read anything, 0 when the block
+   cache holds both ends already or there is no lease */
+int handle_ends_missing(smb_handle_t *handle, size_t head, size_t tail);
+
+void handle_lock(smb_handle_t *handle);
+void handle_unlock(smb_handle_t *handle);
+
+ssize_t handle_read(smb_handle_t *handle, char *buf, size_t size,
+    off_t offset);
+ssize_t handle_write(smb_handle_t *handle, const char *buf, size_t size,
+    off_t offset);
+
+/* Write out pending writes, returns 0 or -1 with errno set */
+int handle_flush(smb_handle_t *handle);
+
+/* Flushes and closes, the handle is freed even when that fails */
+int handle_close(smb_handle_t *handle);
+
+/* Frees the handle without sending anything, for a server that is down.
+   Pending writes are lost, the files are left to their contexts. */
+void handle_abandon(smb_handle_t *handle);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // HANDLE_H
@@ -0,0 +1,351 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stdlib.h>
+#include <string.h>
+#include "dircache.h"
+#include "handlecache.h"
+#include "stats.h"
+
+#define REAP_TICK_MS 250        /* how often parked handles are checked */
+
+/* A handle in use by refs opens, parked when there are none */
+struct entry {
+    smb_handle_t *handle;       /* NULL when the slot is free */
+    int refs;
+    int dropped;                /* not shared any more, closed when unused */
+    double since;               /* parked */
+};
+
+static struct entry entries[HANDLECACHE_SIZE];
+static int count = 0;
+static int parked = 0;
+static double ttl_ms = 1000;
+static handlecache_close_fn close_fn = NULL;
+static pthread_t reaper;
+static int started = 0;
+static int running = 0;
+static pthread_mutex_t cache_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t reap_cond = PTHREAD_COND_INITIALIZER;
+
+/*
+ * What the handle read is still current when nothing changed since it was
+ * opened
+ */
+static int is_current(smb_handle_t *h)
+{
+    return dircache_unchanged(h->url, h->opened);
+}
+
+static int is_readonly(smb_handle_t *h)
+{
+    return (h->flags & O_ACCMODE) == O_RDONLY && h->wlen == 0;
+}
+
+/*
+ * Called with cache_mutex held, as are the functions below. The handle is
+ * closed by the caller once it is released.
+ */
+static smb_handle_t *remove_entry(struct entry *e)
+{
+    smb_handle_t *h = e->handle;
+    if (e->refs == 0)
+        parked--;
+    e->handle = NULL;
+    count--;
+    return h;
+}
+
+static struct entry *find_entry(smb_handle_t *h)
+{
+    int i;
+
+    for (i = 0; i < HANDLECACHE_SIZE; i++)
+        if (entries[i].handle == h)
+            return &entries[i];
+    return NULL;
+}
+
+static struct entry *oldest_parked(void)
+{
+    struct entry *oldest = NULL;
+    int i;
+
+    for (i = 0; i < HANDLECACHE_SIZE; i++)
+        if (entries[i].handle != NULL && entries[i].refs == 0 &&
+            (oldest == NULL || entries[i].since < oldest->since))
+            oldest = &entries[i];
+    return oldest;
+}
+
+/*
+ * A free slot, making room by letting go of the oldest parked handle
+ * (returned in evicted) when there is none
+ */
+static struct entry *free_entry(smb_handle_t **evicted)
+{
+    int i;
+
+    for (i = 0; i < HANDLECACHE_SIZE; i++)
+        if (entries[i].handle == NULL)
+            return &entries[i];
+    struct entry *e = oldest_parked();
+    if (e != NULL)
+        *evicted = remove_entry(e);
+    return e;
+}
+
+static int is_below(const char *url, const char *dir, size_t len)
+{
+    return strncmp(url, dir, len) == 0 &&
+        (url[len] == '\0' || url[len] == '/');
+}
+
+static void close_all(smb_handle_t **handles, int n)
+{
+    int i;
+
+    for (i = 0; i < n; i++)
+        close_fn(handles[i]);
+}
+
+static void *reap_thread(void *data)
+{
+    smb_handle_t *done[HANDLECACHE_SIZE];
+    struct timespec until;
+    int i, n;
+
+    (void)data;
+    pthread_mutex_lock(&cache_mutex);
+    while (running)
+    {
+        if (parked == 0)
+        {
+            pthread_cond_wait(&reap_cond, &cache_mutex);
+            continue;
+        }
+
+        double now = stats_now_ms();
+        for (i = 0, n = 0; i < HANDLECACHE_SIZE; i++)
+            if (entries[i].handle != NULL && entries[i].refs == 0 &&
+                (now - entries[i].since >= ttl_ms ||
+                 !is_current(entries[i].handle)))
+                done[n++] = remove_entry(&entries[i]);
+        if (n > 0)
+        {
+            pthread_mutex_unlock(&cache_mutex);
+            close_all(done, n);
+            pthread_mutex_lock(&cache_mutex);
+            continue;
+        }
+
+        now += REAP_TICK_MS;
+        until.tv_sec = (time_t)(now / 1000);
+        until.tv_nsec = (long)((now - until.tv_sec * 1000.0) * 1000000);
+        pthread_cond_timedwait(&reap_cond, &cache_mutex, &until);
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    return NULL;
+}
+
+int handlecache_init(handlecache_close_fn close_handle)
+{
+    pthread_mutex_lock(&cache_mutex);
+    close_fn = close_handle;
+    running = 1;
+    started = 0 == pthread_create(&reaper, NULL, reap_thread, NULL);
+    pthread_mutex_unlock(&cache_mutex);
+    if (!started)
+    {
+        errno = EAGAIN;
+        return -1;
+    }
+    return 0;
+}
+
+void handlecache_shutdown(void)
+{
+    smb_handle_t *done[HANDLECACHE_SIZE];
+    int i, n;
+
+    pthread_mutex_lock(&cache_mutex);
+    running = 0;
+    pthread_cond_broadcast(&reap_cond);
+    pthread_mutex_unlock(&cache_mutex);
+    if (started)
+        pthread_join(reaper, NULL);
+    started = 0;
+
+    /* Handles still in use are closed by their last release */
+    pthread_mutex_lock(&cache_mutex);
+    for (i = 0, n = 0; i < HANDLECACHE_SIZE; i++)
+    {
+        if (entries[i].handle == NULL)
+            continue;
+        if (entries[i].refs == 0)
+            done[n++] = remove_entry(&entries[i]);
+        else
+            entries[i].dropped = 1;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    close_all(done, n);
+}
+
+void handlecache_set_ttl(int ms)
+{
+    pthread_mutex_lock(&cache_mutex);
+    ttl_ms = ms > 0 ? ms : 0;
+    /* The reaper closes what is over time now */
+    pthread_cond_broadcast(&reap_cond);
+    pthread_mutex_unlock(&cache_mutex);
+}
+
+void handlecache_add(smb_handle_t *h)
+{
+    smb_handle_t *evicted = NULL;
+
+    if (!is_readonly(h))
+        return;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct entry *e;
+    if (running && is_current(h) && NULL != (e = free_entry(&evicted)))
+    {
+        e->handle = h;
+        e->refs = 1;
+        e->dropped = 0;
+        count++;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (evicted != NULL)
+        close_fn(evicted);
+}
+
+smb_handle_t *handlecache_take(const char *url, int flags)
+{
+    smb_handle_t *h = NULL, *stale = NULL;
+    struct entry *e = NULL;
+    int i;
+
+    /* Handles are kept the way they would be opened again */
+    flags &= ~(O_CREAT | O_EXCL | O_TRUNC);
+
+    pthread_mutex_lock(&cache_mutex);
+    if (count == 0)
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return NULL;
+    }
+    /* One in use first, otherwise the one parked last */
+    for (i = 0; i < HANDLECACHE_SIZE; i++)
+    {
+        struct entry *c = &entries[i];
+        if (c->handle == NULL || c->dropped || c->handle->flags != flags ||
+            strcmp(c->handle->url, url) != 0)
+            continue;
+        if (e == NULL || (e->refs == 0 &&
+                          (c->refs > 0 || c->since > e->since)))
+            e = c;
+    }
+    if (e != NULL && !is_current(e->handle))
+    {
+        if (e->refs == 0)
+            stale = remove_entry(e);
+        else
+            e->dropped = 1;
+    }
+    else if (e != NULL)
+    {
+        if (e->refs == 0)
+            parked--;
+        e->refs++;
+        h = e->handle;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (stale != NULL)
+        close_fn(stale);
+    return h;
+}
+
+int handlecache_release(smb_handle_t *h)
+{
+    smb_handle_t *evicted = NULL;
+
+    if (!is_readonly(h))
+        return -1;
+
+    pthread_mutex_lock(&cache_mutex);
+    struct entry *e = find_entry(h);
+    if (e != NULL && e->refs > 1)
+    {
+        e->refs--;
+        pthread_mutex_unlock(&cache_mutex);
+        return 0;
+    }
+    /* The last open, the entry counts as in use until it is parked */
+    if (!running || ttl_ms == 0 || (e != NULL && e->dropped) ||
+        !is_current(h))
+    {
+        if (e != NULL)
+        {
+            e->handle = NULL;
+            count--;
+        }
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+
+    /* Park it, the oldest parked one goes when there are enough */
+    if (parked >= HANDLECACHE_PARKED)
+        evicted = remove_entry(oldest_parked());
+    if (e == NULL && NULL == (e = free_entry(&evicted)))
+    {
+        pthread_mutex_unlock(&cache_mutex);
+        return -1;
+    }
+    if (e->handle == NULL)
+    {
+        e->handle = h;
+        e->dropped = 0;
+        count++;
+    }
+    e->refs = 0;
+    e->since = stats_now_ms();
+    parked++;
+    pthread_cond_broadcast(&reap_cond);
+    pthread_mutex_unlock(&cache_mutex);
+
+    if (evicted != NULL)
+        close_fn(evicted);
+    return 0;
+}
+
+void handlecache_drop(const char *url)
+{
+    smb_handle_t *done[HANDLECACHE_SIZE];
+    size_t len = strlen(url);
+    int i, n;
+
+    pthread_mutex_lock(&cache_mutex);
+    for (i = 0, n = 0; i < HANDLECACHE_SIZE && count > 0; i++)
+    {
+        struct entry *e = &entries[i];
+        if (e->handle == NULL || !is_below(e->handle->url, url, len))
+            continue;
+        if (e->refs == 0)
+            done[n++] = remove_entry(e);
+        else
+            e->dropped = 1;
+    }
+    pthread_mutex_unlock(&cache_mutex);
+    close_all(done, n);
+}
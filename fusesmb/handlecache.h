@@ -0,0 +1,71 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Handles of files opened for reading only. Opening a file the same way
+   while it is open already shares the handle, with what it read, instead of
+   opening the file on the server once more; the last release closes it.
+
+   After that the handle stays open for a moment, as applications often open
+   the same file again right away (Tracker sniffing the MIME type and then
+   the real open, for example). Opening the file again takes the parked
+   handle.
+
+   A handle is only shared or parked, and only taken again, while the
+   directory of its file is watched and no change in it was reported since
+   the handle was opened (see dircache.h). A thread closes parked handles
+   once their time is up or a change is reported. Changes made through
+   fusesmb itself close them right away, see handlecache_drop().
+
+   Requests on a shared handle are serialized by handle_lock() as on any
+   other.
+*/
+
+#ifndef HANDLECACHE_H
+#define HANDLECACHE_H
+
+#include "handle.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define HANDLECACHE_SIZE 64     /* handles shared or parked */
+#define HANDLECACHE_PARKED 16
+
+/* Closes a handle the cache lets go of, called without any lock held */
+typedef void (*handlecache_close_fn)(smb_handle_t *handle);
+
+int handlecache_init(handlecache_close_fn close_handle);
+
+/* Closes all parked handles, those in use close on their last release */
+void handlecache_shutdown(void);
+
+/* Milliseconds a handle stays parked, 0 turns parking off */
+void handlecache_set_ttl(int ms);
+
+/* Share a handle that was just opened */
+void handlecache_add(smb_handle_t *handle);
+
+/* A shared or parked handle of url opened with flags, or NULL. The open
+   holds it until handlecache_release(). */
+smb_handle_t *handlecache_take(const char *url, int flags);
+
+/* An open of the handle was closed. Returns 0 when the handle is still in
+   use or was parked, -1 when the caller has to close it. */
+int handlecache_release(smb_handle_t *handle);
+
+/* url is written to, removed or renamed: close the parked handles of it and
+   of everything below it, and stop sharing those in use */
+void handlecache_drop(const char *url);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // HANDLECACHE_H
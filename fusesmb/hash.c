@@ -356,6 +356,19 @@ void hash_free_nodes(hash_t *hash)
     clear_table(hash);
 }
 
+/*
+ * Cause the hash to become empty without handing the nodes back to
+ * hash->freenode(). Only useful when the node allocator releases all of its
+ * nodes at once, like the pool in hashpool.c. (Not part of kazlib, added
+ * for fusesmb.)
+ */
+
+void hash_forget_nodes(hash_t *hash)
+{
+    hash->nodecount = 0;
+    clear_table(hash);
+}
+
 /*
  * Obsolescent function for removing all nodes from a table,
  * freeing them and then freeing the table all in one step.
@@ -0,0 +1,166 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "hashpool.h"
+
+#define FIRST_SLAB_NODES 64
+#define MAX_SLAB_NODES 4096
+#define FIRST_CHUNK_SIZE 4096
+#define MAX_CHUNK_SIZE (256 * 1024)
+
+/*
+ * Slabs and chunks double in size up to a limit, the nodes or string data
+ * directly follow the header
+ */
+struct hashpool_slab {
+    struct hashpool_slab *next;
+    size_t size;
+};
+
+struct hashpool_chunk {
+    struct hashpool_chunk *next;
+    size_t size;
+    size_t used;
+};
+
+/* A freed node is reused through this list until the pool is destroyed */
+struct hashpool_free {
+    struct hashpool_free *next;
+};
+
+static hnode_t *hashpool_node_alloc(void *context)
+{
+    hashpool_t *pool = (hashpool_t *)context;
+
+    if (pool->free_nodes != NULL)
+    {
+        struct hashpool_free *node = pool->free_nodes;
+        pool->free_nodes = node->next;
+        return (hnode_t *)node;
+    }
+
+    struct hashpool_slab *slab = pool->slabs;
+    if (slab == NULL || pool->slab_used == slab->size)
+    {
+        size_t size = FIRST_SLAB_NODES;
+        if (slab != NULL && slab->size < MAX_SLAB_NODES)
+            size = slab->size * 2;
+        else if (slab != NULL)
+            size = MAX_SLAB_NODES;
+
+        slab = (struct hashpool_slab *)malloc(sizeof(struct hashpool_slab)
+            + size * sizeof(hnode_t));
+        if (slab == NULL)
+            return NULL;
+        slab->size = size;
+        slab->next = pool->slabs;
+        pool->slabs = slab;
+        pool->slab_used = 0;
+    }
+
+    return (hnode_t *)(slab + 1) + pool->slab_used++;
+}
+
+static void hashpool_node_free(hnode_t *node, void *context)
+{
+    hashpool_t *pool = (hashpool_t *)context;
+    struct hashpool_free *free_node = (struct hashpool_free *)node;
+    free_node->next = pool->free_nodes;
+    pool->free_nodes = free_node;
+}
+
+static char *hashpool_strdup(hashpool_t *pool, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    struct hashpool_chunk *chunk = pool->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < len)
+    {
+        size_t size = FIRST_CHUNK_SIZE;
+        if (chunk != NULL)
+        {
+            size = chunk->size * 2;
+            if (size > MAX_CHUNK_SIZE)
+                size = MAX_CHUNK_SIZE;
+        }
+        if (size < len)
+            size = len;
+
+        chunk = (struct hashpool_chunk *)malloc(sizeof(struct hashpool_chunk)
+            + size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = pool->chunks;
+        pool->chunks = chunk;
+    }
+
+    char *copy = (char *)(chunk + 1) + chunk->used;
+    memcpy(copy, str, len);
+    chunk->used += len;
+    return copy;
+}
+
+hashpool_t *hashpool_create(void)
+{
+    hashpool_t *pool = (hashpool_t *)malloc(sizeof(hashpool_t));
+    if (pool == NULL)
+        return NULL;
+
+    pool->interned = ohash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    if (pool->interned == NULL)
+    {
+        free(pool);
+        return NULL;
+    }
+    pool->slabs = NULL;
+    pool->slab_used = 0;
+    pool->free_nodes = NULL;
+    pool->chunks = NULL;
+    return pool;
+}
+
+void hashpool_destroy(hashpool_t *pool)
+{
+    if (pool == NULL)
+        return;
+
+    while (pool->slabs != NULL)
+    {
+        struct hashpool_slab *next = pool->slabs->next;
+        free(pool->slabs);
+        pool->slabs = next;
+    }
+    while (pool->chunks != NULL)
+    {
+        struct hashpool_chunk *next = pool->chunks->next;
+        free(pool->chunks);
+        pool->chunks = next;
+    }
+    ohash_destroy(pool->interned);
+    free(pool);
+}
+
+void hashpool_attach(hashpool_t *pool, hash_t *hash)
+{
+    hash_set_allocator(hash, hashpool_node_alloc, hashpool_node_free, pool);
+}
+
+const char *hashpool_intern(hashpool_t *pool, const char *str)
+{
+    ohnode_t *node = ohash_lookup(pool->interned, str);
+    if (node != NULL)
+        return (const char *)ohnode_getkey(node);
+
+    char *copy = hashpool_strdup(pool, str);
+    if (copy == NULL)
+        return NULL;
+    if (!ohash_insert(pool->interned, copy, copy))
+        return NULL;
+    return copy;
+}
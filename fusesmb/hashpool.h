@@ -0,0 +1,52 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Node and key pool for kazlib hash tables. Plugged in with
+   hashpool_attach(), the table takes its nodes from slabs of the pool
+   instead of one malloc() per node. Keys (and values) can be interned into
+   the pool as well, so the whole table is released with hash_forget_nodes(),
+   hash_destroy() and hashpool_destroy() without walking it.
+*/
+
+#ifndef HASHPOOL_H
+#define HASHPOOL_H
+
+#include "hash.h"
+#include "ohash.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+struct hashpool_slab;
+struct hashpool_chunk;
+struct hashpool_free;
+
+typedef struct hashpool {
+    struct hashpool_slab *slabs;
+    size_t slab_used;
+    struct hashpool_free *free_nodes;
+    struct hashpool_chunk *chunks;
+    ohash_t *interned;
+} hashpool_t;
+
+hashpool_t *hashpool_create(void);
+void hashpool_destroy(hashpool_t *pool);
+
+/* The table must still be empty */
+void hashpool_attach(hashpool_t *pool, hash_t *hash);
+
+/* Returns the pool's copy of str, equal strings are stored only once */
+const char *hashpool_intern(hashpool_t *pool, const char *str);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // HASHPOOL_H
@@ -0,0 +1,273 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <ctype.h>
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "cmap.h"
+#include "health.h"
+#include "debug.h"
+
+#define HEALTH_SAMPLES 32
+#define HEALTH_MIN_SAMPLES 8        /* before that the maximum timeout is used */
+#define HEALTH_TIMEOUT_FACTOR 10    /* timeout = 99th percentile * factor */
+#define HEALTH_MIN_TIMEOUT 2000     /* ms, less is not really useful */
+#define HEALTH_FAILURES 2           /* in a row, to open the circuit */
+#define HEALTH_PROBE_MIN 5          /* seconds between probes, doubling */
+#define HEALTH_PROBE_MAX 60
+#define HEALTH_PROBE_BATCH 16
+
+struct server_health {
+    float samples[HEALTH_SAMPLES];  /* ms, ring buffer */
+    unsigned int nsamples;
+    unsigned int next;
+    unsigned int failures;
+    int open;
+    time_t next_probe;
+    int probe_interval;
+};
+
+struct begin_args {
+    int max_timeout;
+    int timeout;
+    int open;
+};
+
+struct end_args {
+    double ms;
+    int error;
+};
+
+struct probe_list {
+    char servers[HEALTH_PROBE_BATCH][HEALTH_SERVER_NAME];
+    int count;
+    time_t now;
+};
+
+static cmap_t *servers = NULL;
+static health_probe_fn probe_fn;
+static pthread_t probe_thread;
+static pthread_mutex_t probe_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t probe_cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+
+static int compare_float(const void *a, const void *b)
+{
+    float fa = *(const float *)a, fb = *(const float *)b;
+    return fa < fb ? -1 : fa > fb;
+}
+
+int health_is_failure(int error)
+{
+    switch (error)
+    {
+        case ETIMEDOUT:
+        case EHOSTDOWN:
+        case EHOSTUNREACH:
+        case ENETUNREACH:
+        case ENETDOWN:
+        case ECONNREFUSED:
+        case ECONNRESET:
+        case ECONNABORTED:
+        case ENOTCONN:
+        case EPIPE:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int begin_request(const char *key, void *value, void *arg)
+{
+    struct server_health *health = (struct server_health *)value;
+    struct begin_args *args = (struct begin_args *)arg;
+    float sorted[HEALTH_SAMPLES];
+    (void)key;
+
+    args->open = health->open;
+    args->timeout = args->max_timeout;
+    if (health->nsamples < HEALTH_MIN_SAMPLES)
+        return 0;
+
+    memcpy(sorted, health->samples, health->nsamples * sizeof(float));
+    qsort(sorted, health->nsamples, sizeof(float), compare_float);
+    double p99 = sorted[(health->nsamples * 99) / 100];
+    double timeout = p99 * HEALTH_TIMEOUT_FACTOR;
+    if (timeout < HEALTH_MIN_TIMEOUT)
+        timeout = HEALTH_MIN_TIMEOUT;
+    if (timeout < args->timeout)
+        args->timeout = (int)timeout;
+    return 0;
+}
+
+int health_begin(struct health_op *op, const char *server, int max_timeout)
+{
+    struct begin_args args;
+    size_t i;
+
+    /* NetBIOS names are case insensitive */
+    for (i = 0; server[i] != '\0' && i < sizeof(op->server) - 1; i++)
+        op->server[i] = toupper((unsigned char)server[i]);
+    op->server[i] = '\0';
+    op->timeout = max_timeout;
+
+    if (servers == NULL)
+        return 0;
+    args.max_timeout = max_timeout;
+    if (-1 == cmap_update(servers, op->server, begin_request, &args))
+        return 0;
+    if (args.open)
+        return -1;
+    op->timeout = args.timeout;
+    return 0;
+}
+
+static int end_request(const char *key, void *value, void *arg)
+{
+    struct server_health *health = (struct server_health *)value;
+    struct end_args *args = (struct end_args *)arg;
+    (void)key;
+
+    if (health_is_failure(args->error))
+    {
+        if (++health->failures >= HEALTH_FAILURES && !health->open)
+        {
+            debug("%s is down, opening circuit", key);
+            health->open = 1;
+            health->probe_interval = HEALTH_PROBE_MIN;
+            health->next_probe = time(NULL) + health->probe_interval;
+        }
+        return 0;
+    }
+
+    /* Any answer, even an error, is a latency sample */
+    health->failures = 0;
+    if (args->ms < 0)
+        return 0;
+    health->samples[health->next] = (float)args->ms;
+    health->next = (health->next + 1) % HEALTH_SAMPLES;
+    if (health->nsamples < HEALTH_SAMPLES)
+        health->nsamples++;
+    return 0;
+}
+
+void health_end(struct health_op *op, int error, double ms)
+{
+    struct end_args args;
+
+    if (servers == NULL)
+        return;
+    args.ms = ms;
+    args.error = error;
+    cmap_update(servers, op->server, end_request, &args);
+}
+
+static int collect_probes(const char *key, void *value, void *arg)
+{
+    struct server_health *health = (struct server_health *)value;
+    struct probe_list *list = (struct probe_list *)arg;
+
+    if (health->open && health->next_probe <= list->now &&
+        list->count < HEALTH_PROBE_BATCH)
+    {
+        strcpy(list->servers[list->count++], key);
+    }
+    return 0;
+}
+
+static int probe_result(const char *key, void *value, void *arg)
+{
+    struct server_health *health = (struct server_health *)value;
+    int up = *(int *)arg;
+    (void)key;
+
+    if (up)
+    {
+        debug("%s is back, closing circuit", key);
+        health->open = 0;
+        health->failures = 0;
+        /* The old latencies may not hold anymore */
+        health->nsamples = 0;
+        health->next = 0;
+    }
+    else
+    {
+        health->probe_interval *= 2;
+        if (health->probe_interval > HEALTH_PROBE_MAX)
+            health->probe_interval = HEALTH_PROBE_MAX;
+        health->next_probe = time(NULL) + health->probe_interval;
+    }
+    return 0;
+}
+
+static void *health_probe_thread(void *data)
+{
+    (void)data;
+    struct probe_list list;
+    int i;
+
+    pthread_mutex_lock(&probe_mutex);
+    while (running)
+    {
+        struct timespec until;
+        until.tv_sec = time(NULL) + 1;
+        until.tv_nsec = 0;
+        pthread_cond_timedwait(&probe_cond, &probe_mutex, &until);
+        if (!running)
+            break;
+        pthread_mutex_unlock(&probe_mutex);
+
+        list.count = 0;
+        list.now = time(NULL);
+        cmap_remove_if(servers, collect_probes, &list);
+        for (i = 0; i < list.count; i++)
+        {
+            int up = !health_is_failure(probe_fn(list.servers[i]));
+            cmap_update(servers, list.servers[i], probe_result, &up);
+        }
+
+        pthread_mutex_lock(&probe_mutex);
+    }
+    pthread_mutex_unlock(&probe_mutex);
+    return NULL;
+}
+
+int health_init(health_probe_fn probe)
+{
+    servers = cmap_create(sizeof(struct server_health), 16);
+    if (servers == NULL)
+        return -1;
+    probe_fn = probe;
+    running = 1;
+    if (0 != pthread_create(&probe_thread, NULL, health_probe_thread, NULL))
+    {
+        /* Without probes an open circuit would never close again */
+        running = 0;
+        cmap_destroy(servers);
+        servers = NULL;
+        return -1;
+    }
+    return 0;
+}
+
+void health_shutdown(void)
+{
+    pthread_mutex_lock(&probe_mutex);
+    if (!running)
+    {
+        pthread_mutex_unlock(&probe_mutex);
+        return;
+    }
+    running = 0;
+    pthread_cond_signal(&probe_cond);
+    pthread_mutex_unlock(&probe_mutex);
+    pthread_join(probe_thread, NULL);
+    cmap_destroy(servers);
+    servers = NULL;
+}
@@ -0,0 +1,53 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Per server health tracking. Metadata requests to a server are timed, the
+   latencies give the timeout for the next request, and connection failures
+   open a circuit: while a server is considered down, requests fail at once
+   with EHOSTDOWN instead of each waiting for the full timeout. A background
+   thread probes such servers and closes the circuit when they answer again.
+*/
+
+#ifndef HEALTH_H
+#define HEALTH_H
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define HEALTH_SERVER_NAME 256
+
+struct health_op {
+    char server[HEALTH_SERVER_NAME];
+    int timeout;                /* ms */
+};
+
+/* Returns 0 when the server answered, an errno value otherwise */
+typedef int (*health_probe_fn)(const char *server);
+
+int health_init(health_probe_fn probe);
+void health_shutdown(void);
+
+/* Start a request to server, fills in the timeout to use, at most
+   max_timeout ms. Returns -1 while the circuit of the server is open. */
+int health_begin(struct health_op *op, const char *server, int max_timeout);
+
+/* End a request, error is the errno it failed with or 0. ms is the round
+   trip it took on the wire, without waiting for a slot, or -1 when it is no
+   latency sample (transfers, which take as long as they move). */
+void health_end(struct health_op *op, int error, double ms);
+
+/* Check if an errno value means the server could not be reached */
+int health_is_failure(int error);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // HEALTH_H
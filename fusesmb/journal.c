@@ -0,0 +1,990 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include "blocksum.h"
+#include "cmap.h"
+#include "limit.h"
+#include "journal.h"
+#include "scheduler.h"
+#include "stats.h"
+#include "debug.h"
+
+#define JOURNAL_MAGIC "FSMBJRN1"
+#define WRITE_MAGIC 0x4a524543u    /* "JREC" */
+#define TRUNCATE_MAGIC 0x4a54524eu /* "JTRN", offset is the new size */
+#define CLOSE_MAGIC 0x4a434c53u    /* "JCLS" */
+#define URL_MAX 1024
+#define UPLOAD_CHUNK (256 * 1024)
+#define RETRY_MAX_MS 30000
+#define STALL_MS 30000          /* journal_wait() gives up without progress */
+#define STATUS_EVERY_MS 1000
+#define SESSION_IDLE_MS 2000    /* a rewrite ends without records for this */
+
+/* At the start of the file, done is where the first record that is not
+   uploaded yet starts */
+struct journal_header {
+    char magic[8];
+    int64_t done;
+};
+
+/* A write, truncate or close, followed by the url (without NUL) and for a
+   write the data */
+struct journal_record {
+    uint32_t magic;
+    uint32_t url_len;
+    int64_t offset;
+    int64_t len;
+};
+
+/* What is left to upload of a file */
+struct pending {
+    long records;
+    off_t bytes;
+    off_t size;                 /* where the writes end */
+    int truncated;              /* size is exact, the file was truncated */
+};
+
+struct change {
+    int add;
+    long records;
+    off_t bytes;
+    off_t size;
+    int truncate;
+};
+
+/* A file being rewritten from a truncate on. Writes that carry on where
+   the last one ended are gathered into blocks, and a block whose checksum
+   matches the one of the same block on the server is not sent. Until the
+   rewrite ends the journal keeps it from its truncate on, so that it can
+   start over after an error or a restart. */
+struct session {
+    int active;
+    int finished;               /* ended, its records are to be untracked */
+    char url[URL_MAX];
+    off_t record;               /* where its truncate is in the journal */
+    long records;               /* taken into it so far */
+    off_t bytes;
+    struct blocksum *base;      /* of the file on the server, or NULL */
+    ssize_t base_count;
+    off_t base_size;
+    struct blocksum *sums;      /* of what was written */
+    size_t count;
+    int complete;               /* sums cover everything before next */
+    off_t next;                 /* where the next write has to start */
+    char *block;                /* gathered so far, ends at next */
+    size_t fill;
+    off_t saved;                /* bytes not sent, since it was last read */
+};
+
+/* The file records are uploaded to, kept open for the next one */
+struct uploader {
+    SMBCCTX *ctx;
+    SMBCFILE *file;
+    char url[URL_MAX];
+    struct session session;
+};
+
+static int fd = -1;
+static off_t done = 0;          /* saved in the header */
+static off_t next = 0;          /* done lags behind it during a rewrite */
+static off_t end = 0;
+static size_t limit = 0;
+static cmap_t *pending = NULL;
+static journal_context_fn new_upload_context;
+static char status_path[1024];
+static double status_written = 0;
+static long long uploaded = 0;
+static long long unchanged = 0; /* of uploaded, not sent as on the server */
+static long failed = 0;
+static char last_error[URL_MAX + 64] = "-";
+static double progress = 0;     /* when the last record was done */
+static int writers = 0;         /* waiting for room in the journal */
+static pthread_t upload_thread_id;
+static int started = 0;
+static int running = 0;
+static pthread_mutex_t journal_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t work_cond = PTHREAD_COND_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+
+static off_t record_size(const struct journal_record *rec)
+{
+    return sizeof(struct journal_record) + rec->url_len + rec->len;
+}
+
+/*
+ * Errors after which the upload is tried again: the server or the
+ * connection is gone for now, or the file is in use
+ */
+static int is_transient(int error)
+{
+    switch (error)
+    {
+        case EBADF:
+        case EBUSY:
+        case EAGAIN:
+        case ECONNRESET:
+        case ECONNABORTED:
+        case ECONNREFUSED:
+        case ENOTCONN:
+        case EPIPE:
+        case ETIMEDOUT:
+        case EHOSTDOWN:
+        case EHOSTUNREACH:
+        case ENETDOWN:
+        case ENETUNREACH:
+        case ENOMEM:
+            return 1;
+        default:
+            return 0;
+    }
+}
+
+static int update_pending(const char *key, void *value, void *arg)
+{
+    struct pending *p = (struct pending *)value;
+    const struct change *c = (const struct change *)arg;
+
+    (void)key;
+    if (c->add)
+    {
+        p->records += c->records;
+        p->bytes += c->bytes;
+        if (c->truncate)
+        {
+            p->size = c->size;
+            p->truncated = 1;
+        }
+        else if (c->size > p->size)
+            p->size = c->size;
+        return 0;
+    }
+    p->records -= c->records;
+    p->bytes -= c->bytes;
+    return p->records <= 0;
+}
+
+static void track(const char *url, int add, const struct journal_record *rec)
+{
+    struct change c;
+
+    c.add = add;
+    c.records = 1;
+    c.bytes = rec->len;
+    c.size = rec->offset + rec->len;
+    c.truncate = rec->magic == TRUNCATE_MAGIC;
+    cmap_update(pending, url, update_pending, &c);
+}
+
+static void untrack(const char *url, long records, off_t bytes)
+{
+    struct change c;
+
+    c.add = 0;
+    c.records = records;
+    c.bytes = bytes;
+    c.size = 0;
+    c.truncate = 0;
+    cmap_update(pending, url, update_pending, &c);
+}
+
+/*
+ * Reads the record at at, which has to end before until. Returns 0 or -1
+ * when there is no whole record.
+ */
+static int read_record(off_t at, off_t until, struct journal_record *rec,
+                       char *url)
+{
+    if (pread(fd, rec, sizeof(*rec), at) != (ssize_t)sizeof(*rec) ||
+        (rec->magic != WRITE_MAGIC && rec->len != 0) ||
+        (rec->magic != WRITE_MAGIC && rec->magic != TRUNCATE_MAGIC &&
+         rec->magic != CLOSE_MAGIC) || rec->url_len >= URL_MAX ||
+        rec->offset < 0 || rec->len < 0 || at + record_size(rec) > until)
+        return -1;
+    if (pread(fd, url, rec->url_len, at + sizeof(*rec)) !=
+        (ssize_t)rec->url_len)
+        return -1;
+    url[rec->url_len] = '\0';
+    return 0;
+}
+
+/*
+ * Called with journal_mutex held, as are the functions below
+ */
+static void write_done(void)
+{
+    int64_t at = done;
+    if (pwrite(fd, &at, sizeof(at), offsetof(struct journal_header, done)) !=
+        (ssize_t)sizeof(at))
+    {
+        debug("journal: saving the position failed (%s)", strerror(errno));
+    }
+}
+
+/*
+ * Pick up where the last run left off, dropping a record at the end that
+ * was not written whole
+ */
+static int recover(void)
+{
+    struct journal_header header;
+    struct journal_record rec;
+    char url[URL_MAX];
+    struct stat st;
+
+    if (fstat(fd, &st) < 0)
+        return -1;
+    if (st.st_size < (off_t)sizeof(header) ||
+        pread(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header) ||
+        memcmp(header.magic, JOURNAL_MAGIC, sizeof(header.magic)) != 0 ||
+        header.done < (int64_t)sizeof(header) || header.done > st.st_size)
+    {
+        memcpy(header.magic, JOURNAL_MAGIC, sizeof(header.magic));
+        header.done = sizeof(header);
+        if (ftruncate(fd, 0) < 0 ||
+            pwrite(fd, &header, sizeof(header), 0) != (ssize_t)sizeof(header))
+            return -1;
+        st.st_size = sizeof(header);
+    }
+
+    next = done = header.done;
+    end = st.st_size;
+    off_t at = done;
+    while (at < end && 0 == read_record(at, end, &rec, url))
+    {
+        track(url, 1, &rec);
+        at += record_size(&rec);
+    }
+    if (at < end)
+    {
+        debug("journal: dropping %lld bytes cut short",
+              (long long)(end - at));
+        if (ftruncate(fd, at) < 0)
+            return -1;
+        end = at;
+    }
+    if (done < end)
+    {
+        debug("journal: %lld bytes left to upload", (long long)(end - done));
+    }
+    return 0;
+}
+
+static int write_pending(const char *key, void *value, void *arg)
+{
+    const struct pending *p = (const struct pending *)value;
+    fprintf((FILE *)arg, "%s %ld %lld\n", key, p->records,
+            (long long)p->bytes);
+    return 0;
+}
+
+static void write_status(int force)
+{
+    char tmp[1024 + 8];
+    double now = stats_now_ms();
+
+    if (status_path[0] == '\0' ||
+        (!force && now - status_written < STATUS_EVERY_MS))
+        return;
+    status_written = now;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", status_path);
+    mode_t oldmask = umask(022);
+    FILE *fp = fopen(tmp, "w");
+    umask(oldmask);
+    if (fp == NULL)
+        return;
+    fprintf(fp, "# url records bytes\n");
+    cmap_remove_if(pending, write_pending, fp);
+    fprintf(fp,
+            "# uploaded_bytes unchanged_bytes failed_records last_error\n");
+    fprintf(fp, "%lld %lld %ld %s\n", uploaded, unchanged, failed, last_error);
+    if (0 != fclose(fp) || -1 == rename(tmp, status_path))
+        unlink(tmp);
+}
+
+/*
+ * Wait until the deadline, or until shutdown
+ */
+static void wait_until(double deadline)
+{
+    struct timespec until;
+
+    until.tv_sec = (time_t)(deadline / 1000);
+    until.tv_nsec = (long)((deadline - until.tv_sec * 1000.0) * 1000000);
+    while (running && stats_now_ms() < deadline)
+        pthread_cond_timedwait(&work_cond, &journal_mutex, &until);
+}
+
+/*
+ * Wait until the deadline or until there is something to do
+ */
+static void wait_for_work(double deadline)
+{
+    struct timespec until;
+
+    until.tv_sec = (time_t)(deadline / 1000);
+    until.tv_nsec = (long)((deadline - until.tv_sec * 1000.0) * 1000000);
+    pthread_cond_timedwait(&work_cond, &journal_mutex, &until);
+}
+
+/*
+ * Called without journal_mutex, the uploader is the only one reading the
+ * records before end
+ */
+static void close_upload(struct uploader *u)
+{
+    if (u->file == NULL)
+        return;
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+    u->ctx->close_fn(u->ctx, u->file);
+#else
+    u->ctx->close(u->ctx, u->file);
+#endif
+    u->file = NULL;
+    u->url[0] = '\0';
+}
+
+/*
+ * Returns 0 or the errno opening url failed with
+ */
+static int open_upload(struct uploader *u, const char *url)
+{
+    if (u->ctx == NULL && NULL == (u->ctx = new_upload_context()))
+        return errno != 0 ? errno : ENOMEM;
+    if (u->file != NULL && strcmp(u->url, url) != 0)
+        close_upload(u);
+    if (u->file == NULL)
+    {
+        /* The file was there when the writes were made */
+        u->file = u->ctx->open(u->ctx, url, O_WRONLY | O_CREAT, 0666);
+        if (u->file == NULL)
+            return errno;
+        strcpy(u->url, url);
+    }
+    return 0;
+}
+
+/*
+ * Writes size bytes at offset to the open file, returns 0 or the errno
+ */
+static int send_data(struct uploader *u, const char *buf, size_t size,
+                     off_t offset)
+{
+    char server[256];
+    size_t pos = 0;
+
+    limit_url_server(u->url, server, sizeof(server));
+    while (pos < size)
+    {
+        limit_begin(server, size - pos);
+        ssize_t ret = -1;
+        if (u->ctx->lseek(u->ctx, u->file, offset + pos, SEEK_SET) !=
+            (off_t)-1)
+            ret = u->ctx->write(u->ctx, u->file, buf + pos, size - pos);
+        int error = ret < 0 ? errno : EIO;
+        limit_end(server);
+        if (ret <= 0)
+            return error;
+        pos += ret;
+    }
+    return 0;
+}
+
+/*
+ * Returns 0 or the errno the upload failed with
+ */
+static int upload_record(struct uploader *u, off_t at,
+                         const struct journal_record *rec, const char *url,
+                         char *buf)
+{
+    off_t data = at + sizeof(*rec) + rec->url_len, pos = 0;
+    int error = open_upload(u, url);
+
+    while (error == 0 && pos < rec->len)
+    {
+        size_t size = rec->len - pos < UPLOAD_CHUNK ?
+            (size_t)(rec->len - pos) : UPLOAD_CHUNK;
+        if (pread(fd, buf, size, data + pos) != (ssize_t)size)
+            return EIO;
+        error = send_data(u, buf, size, rec->offset + pos);
+        pos += size;
+    }
+    return error;
+}
+
+static void stop_session(struct uploader *u, int finished)
+{
+    struct session *s = &u->session;
+
+    free(s->base);
+    free(s->sums);
+    free(s->block);
+    s->base = NULL;
+    s->sums = NULL;
+    s->block = NULL;
+    s->active = 0;
+    s->finished = finished;
+}
+
+/*
+ * Starts a rewrite of url with the truncate rec at at. The file is only
+ * truncated at the end when its checksums are known, and then only from
+ * where the new content ends.
+ */
+static int begin_session(struct uploader *u, off_t at,
+                         const struct journal_record *rec, const char *url)
+{
+    struct session *s = &u->session;
+    struct blockcache_version v;
+    struct stat st;
+    int error = open_upload(u, url);
+
+    if (error != 0)
+        return error;
+    if (u->ctx->fstat(u->ctx, u->file, &st) < 0)
+        return errno;
+
+    s->base = NULL;
+    s->base_count = rec->offset == 0 ? blocksum_get(url, &v, &s->base) : -1;
+    if (s->base_count >= 0 &&
+        (v.mtime != st.st_mtime || v.size != st.st_size))
+    {
+        /* The file changed since */
+        free(s->base);
+        s->base = NULL;
+        s->base_count = -1;
+    }
+    if (s->base == NULL &&
+        smbc_getFunctionFtruncate(u->ctx)(u->ctx, u->file, rec->offset) < 0)
+        return errno;
+    if (NULL == (s->block = (char *)malloc(BLOCKCACHE_BLOCK)))
+    {
+        free(s->base);
+        s->base = NULL;
+        return ENOMEM;
+    }
+
+    strcpy(s->url, url);
+    s->record = at;
+    s->records = 1;
+    s->bytes = 0;
+    s->base_size = st.st_size;
+    s->sums = NULL;
+    s->count = 0;
+    s->complete = rec->offset == 0;
+    s->next = rec->offset;
+    s->fill = 0;
+    s->active = 1;
+    return 0;
+}
+
+/*
+ * Sends the block gathered, unless the server has it already
+ */
+static int send_block(struct uploader *u)
+{
+    struct session *s = &u->session;
+    struct blocksum sum;
+    off_t offset = s->next - s->fill;
+    size_t index = offset / BLOCKCACHE_BLOCK;
+    int error = 0;
+
+    blocksum_compute(s->block, s->fill, &sum);
+    off_t base_len = s->base_size - offset < BLOCKCACHE_BLOCK ?
+        s->base_size - offset : BLOCKCACHE_BLOCK;
+    if (s->base != NULL && (ssize_t)index < s->base_count &&
+        base_len == (off_t)s->fill && blocksum_equal(&sum, &s->base[index]))
+        s->saved += s->fill;
+    else
+        error = send_data(u, s->block, s->fill, offset);
+
+    if (error == 0 && s->complete)
+    {
+        struct blocksum *sums = (struct blocksum *)realloc(s->sums,
+            (index + 1) * sizeof(struct blocksum));
+        if (sums == NULL)
+            s->complete = 0;
+        else
+        {
+            s->sums = sums;
+            s->sums[index] = sum;
+            s->count = index + 1;
+        }
+    }
+    s->fill = 0;
+    return error;
+}
+
+/*
+ * Takes a write that carries on the rewrite
+ */
+static int session_write(struct uploader *u, off_t at,
+                         const struct journal_record *rec)
+{
+    struct session *s = &u->session;
+    off_t data = at + sizeof(*rec) + rec->url_len, pos = 0;
+    int error = 0;
+
+    while (error == 0 && pos < rec->len)
+    {
+        size_t size = BLOCKCACHE_BLOCK - s->fill;
+        if (rec->len - pos < (off_t)size)
+            size = rec->len - pos;
+        if (pread(fd, s->block + s->fill, size, data + pos) != (ssize_t)size)
+            return EIO;
+        s->fill += size;
+        s->next += size;
+        pos += size;
+        if (s->fill == BLOCKCACHE_BLOCK)
+            error = send_block(u);
+    }
+    return error;
+}
+
+static int end_session(struct uploader *u)
+{
+    struct session *s = &u->session;
+    struct blockcache_version v;
+    struct stat st;
+    int error = 0;
+
+    if (s->fill > 0)
+        error = send_block(u);
+    if (error == 0 && s->base != NULL &&
+        smbc_getFunctionFtruncate(u->ctx)(u->ctx, u->file, s->next) < 0)
+        error = errno;
+    if (error != 0)
+        return error;
+    close_upload(u);
+
+    /* Checksums of what is on the server now, for the next rewrite */
+    if (s->complete && 0 == u->ctx->stat(u->ctx, s->url, &st) &&
+        st.st_size == s->next)
+    {
+        v.mtime = st.st_mtime;
+        v.size = st.st_size;
+        blocksum_set(s->url, &v, s->sums, s->count);
+    }
+    else
+        blocksum_drop(s->url);
+    stop_session(u, 1);
+    return 0;
+}
+
+/*
+ * Uploads the record at at, kept is set when the rewrite took it and
+ * untracks it when it ends. Returns 0 or the errno it failed with.
+ */
+static int process(struct uploader *u, off_t at,
+                   const struct journal_record *rec, const char *url,
+                   char *buf, int *kept)
+{
+    struct session *s = &u->session;
+    int error;
+
+    *kept = 0;
+    if (s->active && strcmp(s->url, url) == 0 &&
+        (rec->magic == CLOSE_MAGIC ||
+         (rec->magic == WRITE_MAGIC && rec->offset == s->next)))
+    {
+        *kept = 1;
+        s->records++;
+        s->bytes += rec->len;
+        if (rec->magic == CLOSE_MAGIC)
+            return end_session(u);
+        return session_write(u, at, rec);
+    }
+    if (s->active && 0 != (error = end_session(u)))
+        return error;
+
+    switch (rec->magic)
+    {
+        case TRUNCATE_MAGIC:
+            if (0 != (error = begin_session(u, at, rec, url)))
+                return error;
+            *kept = 1;
+            return 0;
+        case CLOSE_MAGIC:
+            if (u->file != NULL && strcmp(u->url, url) == 0)
+                close_upload(u);
+            return 0;
+        default:
+            blocksum_drop(url);
+            return upload_record(u, at, rec, url, buf);
+    }
+}
+
+static void *upload_thread(void *data)
+{
+    struct uploader u;
+    struct session *s = &u.session;
+    struct journal_record rec;
+    char url[URL_MAX], server[256];
+    int attempt = 0;
+    char *buf = (char *)malloc(UPLOAD_CHUNK);
+
+    (void)data;
+    memset(&u, 0, sizeof(u));
+
+    pthread_mutex_lock(&journal_mutex);
+    while (running && buf != NULL)
+    {
+        int idle = next == end;
+        if (idle && !s->active)
+        {
+            if (u.file != NULL)
+            {
+                pthread_mutex_unlock(&journal_mutex);
+                close_upload(&u);
+                pthread_mutex_lock(&journal_mutex);
+                continue;
+            }
+            /* Nothing is left, start over at the front */
+            if (end > (off_t)sizeof(struct journal_header) &&
+                0 == ftruncate(fd, sizeof(struct journal_header)))
+            {
+                next = done = end = sizeof(struct journal_header);
+                write_done();
+            }
+            write_status(1);
+            pthread_cond_wait(&work_cond, &journal_mutex);
+            continue;
+        }
+        /* Wait a moment for the rewrite to carry on, but not when writes
+           wait for the room it holds */
+        if (idle && writers == 0 && stats_now_ms() < progress + SESSION_IDLE_MS)
+        {
+            wait_for_work(progress + SESSION_IDLE_MS);
+            continue;
+        }
+
+        off_t at = next, until = end, restart = -1;
+        int error = 0, corrupt = 0, kept = 0;
+        if (idle)
+            strcpy(url, s->url);
+        pthread_mutex_unlock(&journal_mutex);
+        if (!idle && -1 == read_record(at, until, &rec, url))
+            corrupt = 1;
+        else
+        {
+            /* Connections to the server need its protocol range */
+            limit_url_server(url, server, sizeof(server));
+            sched_enter(server);
+            if (idle)
+                error = end_session(&u);
+            else
+                error = process(&u, at, &rec, url, buf, &kept);
+            sched_leave();
+        }
+        if ((error != 0 || corrupt) && s->active)
+        {
+            /* Start the rewrite over, the checksums no longer tell what is
+               on the server */
+            blocksum_drop(s->url);
+            if (error != 0 && is_transient(error))
+            {
+                restart = s->record;
+                s->saved = 0;
+            }
+            stop_session(&u, restart == -1);
+        }
+        if (error != 0 && is_transient(error))
+            close_upload(&u);
+        pthread_mutex_lock(&journal_mutex);
+
+        if (s->finished)
+        {
+            untrack(s->url, s->records, s->bytes);
+            s->finished = 0;
+        }
+        unchanged += s->saved;
+        s->saved = 0;
+        if (corrupt)
+        {
+            /* Should not happen, nothing after it can be found */
+            debug("journal: bad record at %lld, dropping the rest",
+                  (long long)at);
+            if (0 == ftruncate(fd, at))
+                end = at;
+            next = done = end;
+            write_done();
+            cmap_clear(pending);
+            failed++;
+            pthread_cond_broadcast(&done_cond);
+            continue;
+        }
+        if (error != 0)
+            snprintf(last_error, sizeof(last_error), "%s:%s", url,
+                     strerror(error));
+        if (error != 0 && is_transient(error))
+        {
+            if (restart != -1)
+                next = restart;
+            write_status(0);
+            double delay = attempt < 6 ? 500 << attempt : RETRY_MAX_MS;
+            attempt++;
+            wait_until(stats_now_ms() + (delay < RETRY_MAX_MS ? delay : RETRY_MAX_MS));
+            continue;
+        }
+
+        attempt = 0;
+        if (error != 0)
+        {
+            debug("journal: uploading to %s failed (%s), dropped", url,
+                  strerror(error));
+            failed++;
+        }
+        else if (!idle)
+            uploaded += rec.len;
+        if (!idle)
+        {
+            next = at + record_size(&rec);
+            if (!kept)
+                track(url, 0, &rec);
+        }
+        done = s->active ? s->record : next;
+        write_done();
+        progress = stats_now_ms();
+        pthread_cond_broadcast(&done_cond);
+        write_status(0);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+
+    /* A rewrite left open starts over from the journal next time */
+    if (s->active)
+        stop_session(&u, 0);
+    close_upload(&u);
+    if (u.ctx != NULL)
+        smbc_free_context(u.ctx, 1);
+    free(buf);
+    return NULL;
+}
+
+int journal_init(const char *file, const char *status_file,
+                 journal_context_fn new_context)
+{
+    pthread_mutex_lock(&journal_mutex);
+    fd = open(file, O_RDWR | O_CREAT, 0600);
+    if (fd == -1 ||
+        NULL == (pending = cmap_create(sizeof(struct pending), 0)) ||
+        -1 == recover())
+    {
+        int error = errno;
+        if (fd != -1)
+            close(fd);
+        fd = -1;
+        if (pending != NULL)
+            cmap_destroy(pending);
+        pending = NULL;
+        pthread_mutex_unlock(&journal_mutex);
+        errno = error;
+        return -1;
+    }
+    snprintf(status_path, sizeof(status_path), "%s", status_file);
+    new_upload_context = new_context;
+    running = 1;
+    started = 0 == pthread_create(&upload_thread_id, NULL, upload_thread,
+                                  NULL);
+    pthread_mutex_unlock(&journal_mutex);
+    return 0;
+}
+
+void journal_shutdown(void)
+{
+    pthread_mutex_lock(&journal_mutex);
+    running = 0;
+    pthread_cond_broadcast(&work_cond);
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&journal_mutex);
+    if (started)
+        pthread_join(upload_thread_id, NULL);
+    started = 0;
+
+    pthread_mutex_lock(&journal_mutex);
+    if (fd != -1)
+    {
+        write_status(1);
+        close(fd);
+    }
+    fd = -1;
+    if (pending != NULL)
+        cmap_destroy(pending);
+    pending = NULL;
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+void journal_set_size(size_t size)
+{
+    pthread_mutex_lock(&journal_mutex);
+    limit = size;
+    pthread_cond_broadcast(&done_cond);
+    pthread_mutex_unlock(&journal_mutex);
+}
+
+int journal_enabled(void)
+{
+    pthread_mutex_lock(&journal_mutex);
+    int enabled = running && limit > 0;
+    pthread_mutex_unlock(&journal_mutex);
+    return enabled;
+}
+
+/*
+ * Appends a record, returns 0 or -1 with errno set
+ */
+static int append(uint32_t magic, const char *url, const char *buf,
+                  size_t size, off_t offset)
+{
+    struct journal_record rec;
+    size_t url_len = strlen(url);
+
+    if (url_len >= URL_MAX)
+    {
+        errno = ENAMETOOLONG;
+        return -1;
+    }
+    rec.magic = magic;
+    rec.url_len = url_len;
+    rec.offset = offset;
+    rec.len = size;
+    off_t need = record_size(&rec);
+
+    pthread_mutex_lock(&journal_mutex);
+    /* A full journal waits for the uploads, a write larger than all of it
+       goes in alone. Truncates and closes come from requests holding a slot
+       and never wait, they are small. */
+    while (size > 0 && running && end > done &&
+           end - done + need > (off_t)limit)
+    {
+        writers++;
+        pthread_cond_signal(&work_cond);
+        pthread_cond_wait(&done_cond, &journal_mutex);
+        writers--;
+    }
+    if (!running)
+    {
+        pthread_mutex_unlock(&journal_mutex);
+        errno = EIO;
+        return -1;
+    }
+    if (pwrite(fd, &rec, sizeof(rec), end) != (ssize_t)sizeof(rec) ||
+        pwrite(fd, url, url_len, end + sizeof(rec)) != (ssize_t)url_len ||
+        pwrite(fd, buf, size, end + sizeof(rec) + url_len) != (ssize_t)size)
+    {
+        int error = errno != 0 ? errno : ENOSPC;
+        if (ftruncate(fd, end) < 0)
+        {
+            debug("journal: cutting off a failed write failed (%s)",
+                  strerror(errno));
+        }
+        pthread_mutex_unlock(&journal_mutex);
+        errno = error;
+        return -1;
+    }
+    end += need;
+    track(url, 1, &rec);
+    pthread_cond_signal(&work_cond);
+    pthread_mutex_unlock(&journal_mutex);
+    return 0;
+}
+
+ssize_t journal_write(const char *url, const char *buf, size_t size,
+                      off_t offset)
+{
+    if (-1 == append(WRITE_MAGIC, url, buf, size, offset))
+        return -1;
+    return size;
+}
+
+int journal_truncate(const char *url, off_t size)
+{
+    return append(TRUNCATE_MAGIC, url, NULL, 0, size);
+}
+
+int journal_close(const char *url)
+{
+    return append(CLOSE_MAGIC, url, NULL, 0, 0);
+}
+
+int journal_sync(void)
+{
+    pthread_mutex_lock(&journal_mutex);
+    int file = fd;
+    pthread_mutex_unlock(&journal_mutex);
+    return file == -1 ? 0 : fsync(file);
+}
+
+struct match {
+    const char *url;
+    size_t len;
+    int found;
+};
+
+static int match_pending(const char *key, void *value, void *arg)
+{
+    struct match *m = (struct match *)arg;
+
+    (void)value;
+    if (strncmp(key, m->url, m->len) == 0 &&
+        (key[m->len] == '\0' || key[m->len] == '/'))
+        m->found = 1;
+    return 0;
+}
+
+int journal_wait(const char *url)
+{
+    struct match m;
+    struct timespec until;
+
+    m.url = url;
+    m.len = strlen(url);
+    pthread_mutex_lock(&journal_mutex);
+    double start = stats_now_ms();
+    while (pending != NULL && cmap_count(pending) > 0)
+    {
+        m.found = 0;
+        cmap_remove_if(pending, match_pending, &m);
+        if (!m.found)
+            break;
+
+        /* Give up when the uploads made no progress for a while */
+        double last = progress > start ? progress : start;
+        if (!running || stats_now_ms() - last >= STALL_MS)
+        {
+            pthread_mutex_unlock(&journal_mutex);
+            errno = ETIMEDOUT;
+            return -1;
+        }
+        double deadline = last + STALL_MS;
+        until.tv_sec = (time_t)(deadline / 1000);
+        until.tv_nsec = (long)((deadline - until.tv_sec * 1000.0) * 1000000);
+        pthread_cond_timedwait(&done_cond, &journal_mutex, &until);
+    }
+    pthread_mutex_unlock(&journal_mutex);
+    return 0;
+}
+
+int journal_size(const char *url, off_t *size)
+{
+    struct pending p;
+
+    if (pending == NULL || cmap_get(pending, url, &p) == -1)
+        return -1;
+    if (p.truncated || p.size > *size)
+        *size = p.size;
+    return 0;
+}
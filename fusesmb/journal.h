@@ -0,0 +1,82 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Write-back journal. Writes to files opened for writing only are appended
+   to a journal file in the settings directory instead of going to the
+   server, and a thread uploads them in the order they were made, on a
+   libsmbclient context of its own. The journal survives a crash or restart
+   of fusesmb: the uploads carry on from the first record not uploaded
+   yet, and a record cut short at the end is dropped.
+
+   Besides data, truncating a file to rewrite it and closing it are
+   journaled. A rewrite only sends the blocks that differ from the file on
+   the server, when the checksums of its blocks are known (see blocksum.h)
+   and it did not change since: writes that carry on where the last one
+   ended are gathered into blocks and compared with the block at the same
+   offset, the file is truncated once the rewrite is closed. A rewrite
+   larger than the journal ends early, the rest is sent as it is.
+
+   Other changes to a file with pending data (opening it for reading or
+   truncating it to another size, removing, renaming it) wait until its
+   data is uploaded, see journal_wait().
+
+   The uploads in progress are listed in a status file, rewritten at most
+   once a second and when the journal runs empty.
+*/
+
+#ifndef JOURNAL_H
+#define JOURNAL_H
+
+#include <sys/types.h>
+#include <libsmbclient.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+typedef SMBCCTX *(*journal_context_fn)(void);
+
+/* Opens or creates the journal file and starts uploading what is left in
+   it. Returns 0 or -1 with errno set. */
+int journal_init(const char *file, const char *status_file,
+    journal_context_fn new_context);
+
+/* Stops the uploads, what is left stays in the journal */
+void journal_shutdown(void);
+
+/* Bytes the journal may hold before writes wait for uploads, 0 turns
+   journaling of new writes off */
+void journal_set_size(size_t size);
+int journal_enabled(void);
+
+/* Append a write of url, returns size or -1 with errno set */
+ssize_t journal_write(const char *url, const char *buf, size_t size,
+    off_t offset);
+
+/* Append a truncate of url to size, or that url was closed. Return 0 or -1
+   with errno set. */
+int journal_truncate(const char *url, off_t size);
+int journal_close(const char *url);
+
+/* The writes appended so far are on disk, returns 0 or -1 with errno set */
+int journal_sync(void);
+
+/* Wait until nothing of url or below it is left to upload. Returns 0, or
+   -1 with errno ETIMEDOUT when the uploads made no progress for a while. */
+int journal_wait(const char *url);
+
+/* Returns 0 and raises size to where the pending writes of url end, or
+   sets it when it is truncated, when there are any, -1 otherwise */
+int journal_size(const char *url, off_t *size);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // JOURNAL_H
@@ -0,0 +1,226 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "limit.h"
+#include "stats.h"
+#include "debug.h"
+
+#define LIMIT_SERVER_NAME 256
+
+struct bucket {
+    double rate;                /* bytes per second, 0 for no limit */
+    double tokens;
+    double last;                /* seconds */
+};
+
+struct limits {
+    struct bucket bucket;
+    int requests;               /* 0 for no limit */
+    int inflight;
+};
+
+struct server_limits {
+    struct server_limits *next;
+    char name[LIMIT_SERVER_NAME];
+    struct limits limits;
+    int stale;                  /* configuration to be read again */
+};
+
+static limit_config_fn config_fn = NULL;
+static pthread_mutex_t limit_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t limit_cond = PTHREAD_COND_INITIALIZER;
+static struct server_limits *servers = NULL;
+static struct limits global;
+
+static void bucket_set(struct bucket *b, long rate)
+{
+    if (b->rate == rate)
+        return;
+    b->rate = rate;
+    b->tokens = rate;
+    b->last = stats_now_ms() / 1000;
+}
+
+/*
+ * Take bytes, returns the seconds to wait for them
+ */
+static double bucket_take(struct bucket *b, size_t bytes, double t)
+{
+    if (b->rate <= 0)
+        return 0;
+    b->tokens += (t - b->last) * b->rate;
+    b->last = t;
+    if (b->tokens > b->rate)
+        b->tokens = b->rate;
+    b->tokens -= bytes;
+    return b->tokens < 0 ? -b->tokens / b->rate : 0;
+}
+
+static void upper(const char *server, char *key)
+{
+    size_t i;
+
+    for (i = 0; server[i] != '\0' && i < LIMIT_SERVER_NAME - 1; i++)
+        key[i] = toupper((unsigned char)server[i]);
+    key[i] = '\0';
+}
+
+void limit_init(limit_config_fn config)
+{
+    config_fn = config;
+}
+
+void limit_shutdown(void)
+{
+    pthread_mutex_lock(&limit_mutex);
+    while (servers != NULL)
+    {
+        struct server_limits *next = servers->next;
+        free(servers);
+        servers = next;
+    }
+    pthread_mutex_unlock(&limit_mutex);
+}
+
+void limit_set_global(long bandwidth, int requests)
+{
+    pthread_mutex_lock(&limit_mutex);
+    bucket_set(&global.bucket, bandwidth);
+    global.requests = requests;
+    pthread_cond_broadcast(&limit_cond);
+    pthread_mutex_unlock(&limit_mutex);
+}
+
+void limit_reload(void)
+{
+    struct server_limits *s;
+
+    pthread_mutex_lock(&limit_mutex);
+    for (s = servers; s != NULL; s = s->next)
+        s->stale = 1;
+    pthread_mutex_unlock(&limit_mutex);
+}
+
+/*
+ * Called with limit_mutex held, which is released to read the
+ * configuration. Returns NULL when out of memory.
+ */
+static struct server_limits *server_get(const char *key)
+{
+    struct server_limits *s;
+    long bandwidth = 0;
+    int requests = 0;
+
+    for (s = servers; s != NULL; s = s->next)
+        if (strcmp(s->name, key) == 0)
+            break;
+    if (s != NULL && !s->stale)
+        return s;
+
+    pthread_mutex_unlock(&limit_mutex);
+    if (config_fn != NULL)
+        config_fn(key, &bandwidth, &requests);
+    pthread_mutex_lock(&limit_mutex);
+
+    /* Entries are never freed before limit_shutdown() */
+    for (s = servers; s != NULL; s = s->next)
+        if (strcmp(s->name, key) == 0)
+            break;
+    if (s == NULL)
+    {
+        s = (struct server_limits *)calloc(1, sizeof(struct server_limits));
+        if (s == NULL)
+            return NULL;
+        strcpy(s->name, key);
+        s->next = servers;
+        servers = s;
+    }
+    bucket_set(&s->limits.bucket, bandwidth);
+    s->limits.requests = requests;
+    s->stale = 0;
+    pthread_cond_broadcast(&limit_cond);
+    return s;
+}
+
+static int at_limit(const struct limits *l)
+{
+    return l->requests > 0 && l->inflight >= l->requests;
+}
+
+void limit_begin(const char *server, size_t bytes)
+{
+    char key[LIMIT_SERVER_NAME];
+    struct server_limits *s;
+    double wait = 0;
+
+    upper(server, key);
+    pthread_mutex_lock(&limit_mutex);
+    s = server_get(key);
+    while (at_limit(&global) || (s != NULL && at_limit(&s->limits)))
+        pthread_cond_wait(&limit_cond, &limit_mutex);
+    global.inflight++;
+    if (s != NULL)
+        s->limits.inflight++;
+
+    if (bytes > 0)
+    {
+        double t = stats_now_ms() / 1000;
+        wait = bucket_take(&global.bucket, bytes, t);
+        if (s != NULL)
+        {
+            double w = bucket_take(&s->limits.bucket, bytes, t);
+            if (w > wait)
+                wait = w;
+        }
+    }
+    pthread_mutex_unlock(&limit_mutex);
+
+    if (wait > 0)
+    {
+        struct timespec ts;
+        ts.tv_sec = (time_t)wait;
+        ts.tv_nsec = (long)((wait - ts.tv_sec) * 1000000000);
+        nanosleep(&ts, NULL);
+    }
+}
+
+void limit_end(const char *server)
+{
+    char key[LIMIT_SERVER_NAME];
+    struct server_limits *s;
+
+    upper(server, key);
+    pthread_mutex_lock(&limit_mutex);
+    global.inflight--;
+    for (s = servers; s != NULL; s = s->next)
+    {
+        if (strcmp(s->name, key) == 0)
+        {
+            s->limits.inflight--;
+            break;
+        }
+    }
+    pthread_cond_broadcast(&limit_cond);
+    pthread_mutex_unlock(&limit_mutex);
+}
+
+void limit_url_server(const char *url, char *server, size_t size)
+{
+    size_t len;
+
+    if (0 == strncmp(url, "smb://", 6))
+        url += 6;
+    len = strcspn(url, "/");
+    if (len >= size)
+        len = size - 1;
+    memcpy(server, url, len);
+    server[len] = '\0';
+}
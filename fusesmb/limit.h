@@ -0,0 +1,53 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Bandwidth and request limits, per server and for all servers together.
+   Bandwidth is limited with token buckets holding at most a second's
+   worth, a request that takes more than there is waits until the debt is
+   paid off. The number of requests in flight is capped as well, counting
+   every read or write on the wire, also those of the stripes.
+
+   Call limit_begin() while holding the slot or stripe the request runs on,
+   never the other way around.
+*/
+
+#ifndef LIMIT_H
+#define LIMIT_H
+
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Limits of a server, 0 for none, bandwidth in bytes per second */
+typedef void (*limit_config_fn)(const char *server, long *bandwidth,
+    int *requests);
+
+void limit_init(limit_config_fn config);
+void limit_shutdown(void);
+
+void limit_set_global(long bandwidth, int requests);
+
+/* Read the limits of the servers again */
+void limit_reload(void);
+
+/* Wait until a request moving bytes may go to server, it counts as in
+   flight until limit_end() */
+void limit_begin(const char *server, size_t bytes);
+void limit_end(const char *server);
+
+/* Server of smb://SERVER/... */
+void limit_url_server(const char *url, char *server, size_t size);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // LIMIT_H
@@ -0,0 +1,394 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "ohash.h"
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+/*
+ * Control bytes: a full slot stores the low 7 bits of its hash (0..127),
+ * free slots have the high bit set. The first OHASH_GROUP_SIZE control bytes
+ * are mirrored behind the end of the table, so a group can be loaded at any
+ * position without wrapping.
+ */
+#define CTRL_EMPTY ((signed char)-128)
+#define CTRL_DELETED ((signed char)-2)
+
+#define INIT_CAPACITY 32
+#define H1(hkey) ((hkey) >> 7)
+#define H2(hkey) ((signed char)((hkey) & 0x7f))
+
+typedef unsigned int group_mask_t;
+
+static group_mask_t group_match(const signed char *ctrl, signed char h2)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (group_mask_t)_mm_movemask_epi8(
+        _mm_cmpeq_epi8(group, _mm_set1_epi8(h2)));
+#else
+    group_mask_t mask = 0;
+    int i;
+    for (i = 0; i < OHASH_GROUP_SIZE; i++)
+    {
+        if (ctrl[i] == h2)
+            mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+/* empty or deleted */
+static group_mask_t group_match_free(const signed char *ctrl)
+{
+#if defined(__SSE2__)
+    __m128i group = _mm_loadu_si128((const __m128i *)ctrl);
+    return (group_mask_t)_mm_movemask_epi8(group);
+#else
+    group_mask_t mask = 0;
+    int i;
+    for (i = 0; i < OHASH_GROUP_SIZE; i++)
+    {
+        if (ctrl[i] < 0)
+            mask |= 1U << i;
+    }
+    return mask;
+#endif
+}
+
+static int group_has_empty(const signed char *ctrl)
+{
+    return group_match(ctrl, CTRL_EMPTY) != 0;
+}
+
+static int lowest_bit(group_mask_t mask)
+{
+#if defined(__GNUC__) && __GNUC__ >= 4
+    return __builtin_ctz(mask);
+#else
+    int i = 0;
+    while ((mask & 1) == 0)
+    {
+        mask >>= 1;
+        i++;
+    }
+    return i;
+#endif
+}
+
+static int comp_default(const void *key1, const void *key2)
+{
+    return strcmp((const char *)key1, (const char *)key2);
+}
+
+static void set_ctrl(ohash_t *hash, hashcount_t index, signed char value)
+{
+    hash->ohash_ctrl[index] = value;
+    if (index < OHASH_GROUP_SIZE)
+        hash->ohash_ctrl[hash->ohash_capacity + index] = value;
+}
+
+static int alloc_table(ohash_t *hash, hashcount_t capacity)
+{
+    signed char *ctrl = (signed char *)malloc(capacity + OHASH_GROUP_SIZE);
+    ohnode_t *slots = (ohnode_t *)malloc(capacity * sizeof(ohnode_t));
+    if (ctrl == NULL || slots == NULL)
+    {
+        free(ctrl);
+        free(slots);
+        return -1;
+    }
+    memset(ctrl, CTRL_EMPTY, capacity + OHASH_GROUP_SIZE);
+    hash->ohash_ctrl = ctrl;
+    hash->ohash_slots = slots;
+    hash->ohash_capacity = capacity;
+    hash->ohash_deleted = 0;
+    return 0;
+}
+
+/*
+ * Probe the groups in triangular steps, which visits every group once
+ * because the number of groups is a power of two.
+ */
+static hashcount_t find_free_slot(ohash_t *hash, hash_val_t hkey)
+{
+    hashcount_t mask = hash->ohash_capacity - 1;
+    hashcount_t pos = H1(hkey) & mask;
+    hashcount_t step = 0;
+
+    for (;;)
+    {
+        group_mask_t free_slots = group_match_free(hash->ohash_ctrl + pos);
+        if (free_slots != 0)
+            return (pos + lowest_bit(free_slots)) & mask;
+        step += OHASH_GROUP_SIZE;
+        pos = (pos + step) & mask;
+    }
+}
+
+static int resize(ohash_t *hash, hashcount_t capacity)
+{
+    signed char *old_ctrl = hash->ohash_ctrl;
+    ohnode_t *old_slots = hash->ohash_slots;
+    hashcount_t old_capacity = hash->ohash_capacity, i;
+
+    if (-1 == alloc_table(hash, capacity))
+        return -1;
+
+    for (i = 0; i < old_capacity; i++)
+    {
+        if (old_ctrl[i] < 0)
+            continue;
+        hashcount_t slot = find_free_slot(hash, old_slots[i].ohash_hkey);
+        set_ctrl(hash, slot, H2(old_slots[i].ohash_hkey));
+        hash->ohash_slots[slot] = old_slots[i];
+    }
+    free(old_ctrl);
+    free(old_slots);
+    return 0;
+}
+
+ohash_t *ohash_create(hashcount_t maxcount, hash_comp_t compfun,
+    hash_fun_t hashfun)
+{
+    ohash_t *hash = (ohash_t *)malloc(sizeof(ohash_t));
+    if (hash == NULL)
+        return NULL;
+
+    if (-1 == alloc_table(hash, INIT_CAPACITY))
+    {
+        free(hash);
+        return NULL;
+    }
+    hash->ohash_nodecount = 0;
+    hash->ohash_maxcount = maxcount;
+    hash->ohash_compare = compfun ? compfun : comp_default;
+    hash->ohash_function = hashfun ? hashfun : ohash_fun_string;
+    return hash;
+}
+
+void ohash_destroy(ohash_t *hash)
+{
+    free(hash->ohash_ctrl);
+    free(hash->ohash_slots);
+    free(hash);
+}
+
+void ohash_clear(ohash_t *hash)
+{
+    memset(hash->ohash_ctrl, CTRL_EMPTY, hash->ohash_capacity + OHASH_GROUP_SIZE);
+    hash->ohash_nodecount = 0;
+    hash->ohash_deleted = 0;
+}
+
+int ohash_insert(ohash_t *hash, const void *key, void *data)
+{
+    if (ohash_isfull(hash))
+        return 0;
+
+    /* Keep at least 1/8 of the slots empty so that probing terminates,
+       tombstones alone are cleaned up by rehashing at the same size */
+    if ((hash->ohash_nodecount + hash->ohash_deleted + 1) * 8 >
+        hash->ohash_capacity * 7)
+    {
+        hashcount_t capacity = hash->ohash_capacity;
+        if ((hash->ohash_nodecount + 1) * 2 > capacity)
+            capacity *= 2;
+        if (-1 == resize(hash, capacity))
+            return 0;
+    }
+
+    hash_val_t hkey = hash->ohash_function(key);
+    hashcount_t slot = find_free_slot(hash, hkey);
+    if (hash->ohash_ctrl[slot] == CTRL_DELETED)
+        hash->ohash_deleted--;
+    set_ctrl(hash, slot, H2(hkey));
+    hash->ohash_slots[slot].ohash_key = key;
+    hash->ohash_slots[slot].ohash_data = data;
+    hash->ohash_slots[slot].ohash_hkey = hkey;
+    hash->ohash_nodecount++;
+    return 1;
+}
+
+ohnode_t *ohash_lookup(ohash_t *hash, const void *key)
+{
+    hash_val_t hkey = hash->ohash_function(key);
+    hashcount_t mask = hash->ohash_capacity - 1;
+    hashcount_t pos = H1(hkey) & mask;
+    hashcount_t step = 0;
+    signed char h2 = H2(hkey);
+
+    for (;;)
+    {
+        const signed char *group = hash->ohash_ctrl + pos;
+        group_mask_t matches = group_match(group, h2);
+        while (matches != 0)
+        {
+            int bit = lowest_bit(matches);
+            ohnode_t *node = &hash->ohash_slots[(pos + bit) & mask];
+            if (node->ohash_hkey == hkey &&
+                hash->ohash_compare(node->ohash_key, key) == 0)
+                return node;
+            matches &= matches - 1;
+        }
+        if (group_has_empty(group))
+            return NULL;
+        step += OHASH_GROUP_SIZE;
+        pos = (pos + step) & mask;
+    }
+}
+
+void ohash_delete(ohash_t *hash, ohnode_t *node)
+{
+    hashcount_t index = node - hash->ohash_slots;
+    set_ctrl(hash, index, CTRL_DELETED);
+    hash->ohash_nodecount--;
+    hash->ohash_deleted++;
+}
+
+void ohash_scan_begin(ohscan_t *scan, ohash_t *hash)
+{
+    scan->ohash_table = hash;
+    scan->ohash_index = 0;
+}
+
+ohnode_t *ohash_scan_next(ohscan_t *scan)
+{
+    ohash_t *hash = scan->ohash_table;
+    while (scan->ohash_index < hash->ohash_capacity)
+    {
+        hashcount_t index = scan->ohash_index++;
+        if (hash->ohash_ctrl[index] >= 0)
+            return &hash->ohash_slots[index];
+    }
+    return NULL;
+}
+
+/*
+ * FNV-1a followed by the MurmurHash3 finalizer, which spreads the bits so
+ * that both the 7 bit control byte and the probe position are well mixed
+ */
+hash_val_t ohash_fun_string(const void *key)
+{
+    const unsigned char *str = (const unsigned char *)key;
+    hash_val_t h = 2166136261UL;
+
+    while (*str)
+        h = (h ^ *str++) * 16777619UL;
+
+    h ^= h >> 16;
+    h *= 0x85ebca6bUL;
+    h ^= h >> 13;
+    h *= 0xc2b2ae35UL;
+    h ^= h >> 16;
+    return h;
+}
+
+#ifdef RUN_BENCHMARK
+
+/*
+ * Comparison with the kazlib table in hash.c, build with:
+ *  gcc -O2 -DNDEBUG -DRUN_BENCHMARK -o ohash-bench ohash.c hash.c
+ * Without NDEBUG, hash.c verifies the whole table on every insert.
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static char **make_paths(int count, const char *prefix)
+{
+    char buf[256];
+    int i;
+    char **paths = (char **)malloc(count * sizeof(char *));
+    for (i = 0; i < count; i++)
+    {
+        snprintf(buf, sizeof(buf), "%s/WORKGROUP/SERVER%d/share/dir%d/file%d.txt",
+            prefix, i % 37, i % 1013, i);
+        paths[i] = strdup(buf);
+    }
+    return paths;
+}
+
+int main(void)
+{
+    const int count = 200000;
+    char **paths = make_paths(count, "");
+    char **missing = make_paths(count, "/missing");
+    unsigned long found;
+    double t;
+    int i;
+
+    hash_t *kaz = hash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    t = now_ms();
+    for (i = 0; i < count; i++)
+        hash_alloc_insert(kaz, paths[i], paths[i]);
+    printf("kazlib insert:    %8.2f ms\n", now_ms() - t);
+    t = now_ms();
+    for (found = 0, i = 0; i < count; i++)
+        found += hash_lookup(kaz, paths[i]) != NULL;
+    printf("kazlib hit:       %8.2f ms (%lu)\n", now_ms() - t, found);
+    t = now_ms();
+    for (found = 0, i = 0; i < count; i++)
+        found += hash_lookup(kaz, missing[i]) != NULL;
+    printf("kazlib miss:      %8.2f ms (%lu)\n", now_ms() - t, found);
+    hscan_t hs;
+    hnode_t *hn;
+    t = now_ms();
+    found = 0;
+    hash_scan_begin(&hs, kaz);
+    while ((hn = hash_scan_next(&hs)))
+        found += hnode_get(hn) != NULL;
+    printf("kazlib scan:      %8.2f ms (%lu)\n", now_ms() - t, found);
+    t = now_ms();
+    hash_free_nodes(kaz);
+    hash_destroy(kaz);
+    printf("kazlib free:      %8.2f ms\n", now_ms() - t);
+
+    ohash_t *oh = ohash_create(HASHCOUNT_T_MAX, NULL, NULL);
+    t = now_ms();
+    for (i = 0; i < count; i++)
+        ohash_insert(oh, paths[i], paths[i]);
+    printf("ohash insert:     %8.2f ms\n", now_ms() - t);
+    t = now_ms();
+    for (found = 0, i = 0; i < count; i++)
+        found += ohash_lookup(oh, paths[i]) != NULL;
+    printf("ohash hit:        %8.2f ms (%lu)\n", now_ms() - t, found);
+    t = now_ms();
+    for (found = 0, i = 0; i < count; i++)
+        found += ohash_lookup(oh, missing[i]) != NULL;
+    printf("ohash miss:       %8.2f ms (%lu)\n", now_ms() - t, found);
+    ohscan_t os;
+    ohnode_t *on;
+    t = now_ms();
+    found = 0;
+    ohash_scan_begin(&os, oh);
+    while ((on = ohash_scan_next(&os)))
+        found += ohnode_get(on) != NULL;
+    printf("ohash scan:       %8.2f ms (%lu)\n", now_ms() - t, found);
+    t = now_ms();
+    ohash_destroy(oh);
+    printf("ohash free:       %8.2f ms\n", now_ms() - t);
+
+    for (i = 0; i < count; i++)
+    {
+        free(paths[i]);
+        free(missing[i]);
+    }
+    free(paths);
+    free(missing);
+    return 0;
+}
+#endif
@@ -0,0 +1,180 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Open addressing hash table with the same calling conventions as the kazlib
+   table in hash.h. Nodes live inline in the table, with one control byte per
+   slot holding 7 bits of the hash, so a lookup compares a whole group of 16
+   slots at once (with SSE2 where available) before touching any key.
+*/
+
+#ifndef OHASH_H
+#define OHASH_H
+
+#include "hash.h"
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define OHASH_GROUP_SIZE 16
+
+/*
+ * Table slot. A pointer to a slot is only valid until the next insertion,
+ * which may move all slots when the table grows.
+ */
+typedef struct ohnode_t {
+    const void *ohash_key;
+    void *ohash_data;
+    hash_val_t ohash_hkey;
+} ohnode_t;
+
+typedef struct ohash_t {
+    signed char *ohash_ctrl;		/* capacity + OHASH_GROUP_SIZE bytes */
+    ohnode_t *ohash_slots;
+    hashcount_t ohash_capacity;		/* power of two */
+    hashcount_t ohash_nodecount;
+    hashcount_t ohash_deleted;
+    hashcount_t ohash_maxcount;
+    hash_comp_t ohash_compare;
+    hash_fun_t ohash_function;
+} ohash_t;
+
+typedef struct ohscan_t {
+    ohash_t *ohash_table;
+    hashcount_t ohash_index;
+} ohscan_t;
+
+ohash_t *ohash_create(hashcount_t maxcount, hash_comp_t compfun,
+    hash_fun_t hashfun);
+void ohash_destroy(ohash_t *hash);
+void ohash_clear(ohash_t *hash);
+
+/* Returns 1 on success, 0 on failure like hash_alloc_insert(). The key must
+   not be in the table yet. */
+int ohash_insert(ohash_t *hash, const void *key, void *data);
+ohnode_t *ohash_lookup(ohash_t *hash, const void *key);
+void ohash_delete(ohash_t *hash, ohnode_t *node);
+
+/* Deleting the node just returned by ohash_scan_next() is allowed */
+void ohash_scan_begin(ohscan_t *scan, ohash_t *hash);
+ohnode_t *ohash_scan_next(ohscan_t *scan);
+
+/* String hash, also used by default */
+hash_val_t ohash_fun_string(const void *key);
+
+#define ohash_count(H) ((H)->ohash_nodecount)
+#define ohash_isempty(H) ((H)->ohash_nodecount == 0)
+#define ohash_isfull(H) ((H)->ohash_nodecount == (H)->ohash_maxcount)
+#define ohnode_get(N) ((N)->ohash_data)
+#define ohnode_getkey(N) ((N)->ohash_key)
+#define ohnode_put(N, V) ((N)->ohash_data = (V))
+
+
+#ifdef __cplusplus
+} // extern "C"
+
+
+#include <new>
+#include <stdlib.h>
+#include <string.h>
+
+
+/* C++ front end for string keyed tables, keys and values are copied */
+template<typename Value>
+class OpenHashMap {
+public:
+	OpenHashMap()
+		:
+		fTable(ohash_create(HASHCOUNT_T_MAX, NULL, NULL))
+	{
+	}
+
+	~OpenHashMap()
+	{
+		Clear();
+		if (fTable != NULL)
+			ohash_destroy(fTable);
+	}
+
+	bool InitCheck() const
+	{
+		return fTable != NULL;
+	}
+
+	bool Put(const char* key, const Value& value)
+	{
+		ohnode_t* node = ohash_lookup(fTable, key);
+		if (node != NULL) {
+			*(Value*)ohnode_get(node) = value;
+			return true;
+		}
+
+		char* keyCopy = strdup(key);
+		Value* valueCopy = new(std::nothrow) Value(value);
+		if (keyCopy == NULL || valueCopy == NULL
+			|| !ohash_insert(fTable, keyCopy, valueCopy)) {
+			free(keyCopy);
+			delete valueCopy;
+			return false;
+		}
+		return true;
+	}
+
+	Value* Get(const char* key) const
+	{
+		ohnode_t* node = ohash_lookup(fTable, key);
+		if (node == NULL)
+			return NULL;
+		return (Value*)ohnode_get(node);
+	}
+
+	bool Remove(const char* key)
+	{
+		ohnode_t* node = ohash_lookup(fTable, key);
+		if (node == NULL)
+			return false;
+		_Free(node);
+		ohash_delete(fTable, node);
+		return true;
+	}
+
+	size_t Count() const
+	{
+		return ohash_count(fTable);
+	}
+
+	void Clear()
+	{
+		if (fTable == NULL)
+			return;
+		ohscan_t scan;
+		ohash_scan_begin(&scan, fTable);
+		while (ohnode_t* node = ohash_scan_next(&scan))
+			_Free(node);
+		ohash_clear(fTable);
+	}
+
+private:
+	// not copyable
+	OpenHashMap(const OpenHashMap&);
+	OpenHashMap& operator=(const OpenHashMap&);
+
+	static void _Free(ohnode_t* node)
+	{
+		free((void*)ohnode_getkey(node));
+		delete (Value*)ohnode_get(node);
+	}
+
+private:
+	ohash_t*	fTable;
+};
+
+
+#endif // __cplusplus
+
+
+#endif // OHASH_H
@@ -0,0 +1,223 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <pthread.h>
+#include <string.h>
+#include <strings.h>
+#include "prefetch.h"
+
+#define PROFILES_MAX 64
+#define PREFETCH_QUEUE 8        /* files waiting for their ends */
+#define PREFETCH_PATH 1024
+#define KiB 1024
+
+struct profile {
+    char ext[16];
+    size_t head;
+    size_t tail;
+};
+
+/* Where the formats keep what a reader looks for first */
+static const struct profile builtin[] = {
+    { "mp4", 64 * KiB, 1024 * KiB },    /* moov atom, often at the end */
+    { "m4v", 64 * KiB, 1024 * KiB },
+    { "m4a", 64 * KiB, 256 * KiB },
+    { "mov", 64 * KiB, 1024 * KiB },
+    { "mkv", 64 * KiB, 512 * KiB },     /* cues and tags at the end */
+    { "webm", 64 * KiB, 512 * KiB },
+    { "avi", 64 * KiB, 512 * KiB },     /* idx1 index at the end */
+    { "mp3", 64 * KiB, 64 * KiB },      /* ID3v2 in front, ID3v1 at the end */
+    { "flac", 128 * KiB, 0 },           /* metadata blocks and pictures */
+    { "pdf", 64 * KiB, 256 * KiB },     /* cross reference table, trailer */
+    { "zip", 64 * KiB, 256 * KiB },     /* central directory at the end */
+    { "jar", 64 * KiB, 256 * KiB },
+    { "cbz", 64 * KiB, 256 * KiB },
+    { "epub", 64 * KiB, 256 * KiB },
+    { "docx", 64 * KiB, 256 * KiB },
+    { "xlsx", 64 * KiB, 256 * KiB },
+    { "pptx", 64 * KiB, 256 * KiB },
+    { "odt", 64 * KiB, 256 * KiB },
+    { "7z", 64 * KiB, 256 * KiB },      /* header at the end */
+    { "iso", 64 * KiB, 0 },             /* volume descriptors */
+};
+
+struct prefetch_request {
+    char path[PREFETCH_PATH];
+    int flags;
+    size_t head;
+    size_t tail;
+};
+
+static struct {
+    pthread_t thread;
+    pthread_mutex_t mutex;
+    pthread_cond_t cond;
+    prefetch_fn fetch;
+    struct prefetch_request queue[PREFETCH_QUEUE];
+    int first;
+    int count;
+    int running;
+} worker;
+
+static struct profile profiles[PROFILES_MAX];
+static int count = -1;                  /* the built in ones before a reset */
+static pthread_mutex_t profiles_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+/*
+ * Called with profiles_mutex held
+ */
+static void load_builtin(void)
+{
+    count = sizeof(builtin) / sizeof(builtin[0]);
+    memcpy(profiles, builtin, sizeof(builtin));
+}
+
+void prefetch_reset(void)
+{
+    pthread_mutex_lock(&profiles_mutex);
+    load_builtin();
+    pthread_mutex_unlock(&profiles_mutex);
+}
+
+void prefetch_set(const char *ext, size_t head, size_t tail)
+{
+    int i;
+
+    if (ext[0] == '.')
+        ext++;
+    if (strlen(ext) >= sizeof(profiles[0].ext))
+        return;
+    pthread_mutex_lock(&profiles_mutex);
+    if (count == -1)
+        load_builtin();
+    for (i = 0; i < count; i++)
+        if (strcasecmp(profiles[i].ext, ext) == 0)
+            break;
+    if (i < PROFILES_MAX)
+    {
+        strcpy(profiles[i].ext, ext);
+        profiles[i].head = head;
+        profiles[i].tail = tail;
+        if (i == count)
+            count++;
+    }
+    pthread_mutex_unlock(&profiles_mutex);
+}
+
+int prefetch_profile(const char *path, size_t *head, size_t *tail)
+{
+    const char *ext = strrchr(path, '.');
+    int i, ret = -1;
+
+    if (ext == NULL || strchr(ext, '/') != NULL)
+        return -1;
+    ext++;
+    pthread_mutex_lock(&profiles_mutex);
+    if (count == -1)
+        load_builtin();
+    for (i = 0; i < count; i++)
+    {
+        if (strcasecmp(profiles[i].ext, ext) != 0)
+            continue;
+        *head = profiles[i].head;
+        *tail = profiles[i].tail;
+        ret = *head + *tail > 0 ? 0 : -1;
+        break;
+    }
+    pthread_mutex_unlock(&profiles_mutex);
+    return ret;
+}
+
+static void *prefetch_thread(void *data)
+{
+    (void)data;
+    struct prefetch_request request;
+
+    pthread_mutex_lock(&worker.mutex);
+    while (1)
+    {
+        while (worker.running && worker.count == 0)
+            pthread_cond_wait(&worker.cond, &worker.mutex);
+        if (!worker.running)
+            break;
+        request = worker.queue[worker.first];
+        worker.first = (worker.first + 1) % PREFETCH_QUEUE;
+        worker.count--;
+        pthread_mutex_unlock(&worker.mutex);
+
+        worker.fetch(request.path, request.flags, request.head, request.tail);
+
+        pthread_mutex_lock(&worker.mutex);
+    }
+    pthread_mutex_unlock(&worker.mutex);
+    return NULL;
+}
+
+int prefetch_init(prefetch_fn fetch)
+{
+    pthread_mutex_init(&worker.mutex, NULL);
+    pthread_cond_init(&worker.cond, NULL);
+    worker.fetch = fetch;
+    worker.first = worker.count = 0;
+    worker.running = 1;
+    if (0 != pthread_create(&worker.thread, NULL, prefetch_thread, NULL))
+    {
+        worker.running = 0;
+        return -1;
+    }
+    return 0;
+}
+
+void prefetch_shutdown(void)
+{
+    pthread_mutex_lock(&worker.mutex);
+    if (!worker.running)
+    {
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    worker.running = 0;
+    pthread_cond_signal(&worker.cond);
+    pthread_mutex_unlock(&worker.mutex);
+    pthread_join(worker.thread, NULL);
+}
+
+void prefetch_queue(const char *path, int flags, size_t head, size_t tail)
+{
+    int i;
+
+    if (strlen(path) >= PREFETCH_PATH)
+        return;
+
+    pthread_mutex_lock(&worker.mutex);
+    if (!worker.running)
+    {
+        pthread_mutex_unlock(&worker.mutex);
+        return;
+    }
+    for (i = 0; i < worker.count; i++)
+    {
+        if (strcmp(worker.queue[(worker.first + i) % PREFETCH_QUEUE].path,
+                   path) == 0)
+        {
+            pthread_mutex_unlock(&worker.mutex);
+            return;
+        }
+    }
+    if (worker.count == PREFETCH_QUEUE)
+    {
+        worker.first = (worker.first + 1) % PREFETCH_QUEUE;
+        worker.count--;
+    }
+    struct prefetch_request *request =
+        &worker.queue[(worker.first + worker.count) % PREFETCH_QUEUE];
+    strcpy(request->path, path);
+    request->flags = flags;
+    request->head = head;
+    request->tail = tail;
+    worker.count++;
+    pthread_cond_signal(&worker.cond);
+    pthread_mutex_unlock(&worker.mutex);
+}
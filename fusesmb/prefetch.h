@@ -0,0 +1,57 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Prefetch profiles by file extension. Media players and archive tools
+   read the header of a file and then jump to its end, for the MP4 moov
+   atom, the ZIP central directory or the MKV cues. A profile says how much
+   of the head and of the tail to read into the block cache when such a file
+   is opened, see handle_prefetch_ends().
+
+   There are built in profiles for the common formats, the [prefetch]
+   section of the config file changes or adds them with lines like
+   "mp4 = 64,1024", head and tail in KiB. "0,0" turns one off.
+
+   The ends are read by a worker thread after the open returned, so the
+   open doesn't wait for them. When files are opened faster than their ends
+   are read, the oldest are dropped, the reader has moved on from them.
+*/
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <stddef.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+/* Back to the built in profiles */
+void prefetch_reset(void);
+
+void prefetch_set(const char *ext, size_t head, size_t tail);
+
+/* Returns 0 and the bytes to read when path has a profile, -1 otherwise */
+int prefetch_profile(const char *path, size_t *head, size_t *tail);
+
+/* Reads head and tail bytes of the file at path, opened with flags, into
+   the block cache */
+typedef void (*prefetch_fn)(const char *path, int flags, size_t head,
+    size_t tail);
+
+int prefetch_init(prefetch_fn fetch);
+void prefetch_shutdown(void);
+
+/* Have the worker read the ends of a file that is being opened */
+void prefetch_queue(const char *path, int flags, size_t head, size_t tail);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // PREFETCH_H
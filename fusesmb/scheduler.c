@@ -0,0 +1,368 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <ctype.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "scheduler.h"
+#include "debug.h"
+
+#define SCHED_SERVER_NAME 256
+#define SCHED_COST_UNIT (64 * 1024)     /* bytes costing as much as a stat */
+#define SCHED_NO_SLOT -3                /* for sched_enter() */
+
+struct slot {
+    SMBCCTX *ctx;
+    pthread_mutex_t mutex;
+    int busy;
+    int bound;                  /* the request depends on the range */
+};
+
+/* Requests of one class to one server */
+struct flow {
+    struct flow *next;
+    char server[SCHED_SERVER_NAME];
+    enum sched_class cls;
+    double finish;              /* virtual finish time of its last request */
+    int waiting;
+};
+
+struct waiter {
+    struct waiter *next;
+    enum sched_class cls;
+    int want;                   /* slot, SCHED_ANY, SCHED_SHARED or
+                                   SCHED_NO_SLOT */
+    char range[SCHED_RANGE];
+    int bound;                  /* needs range */
+    double start;               /* virtual start time */
+    unsigned long seq;
+    int slot;                   /* -1 until granted */
+    pthread_cond_t cond;
+};
+
+static struct slot *slots = NULL;
+static int nslots = 0;
+static int nreserved = 0;
+static pthread_mutex_t sched_lock = PTHREAD_MUTEX_INITIALIZER;
+static struct waiter *waiting = NULL;
+static struct flow *flows = NULL;
+static double vtime[SCHED_BACKGROUND + 1];     /* per class */
+static unsigned long next_seq = 0;
+static sched_range_fn range_fn = NULL;
+static sched_apply_fn apply_fn = NULL;
+static char current[SCHED_RANGE] = "?";        /* none applied yet */
+static int bound = 0;           /* requests and threads depending on it */
+
+int sched_init(int count, int reserved, sched_context_fn new_context,
+               sched_range_fn range_of, sched_apply_fn apply)
+{
+    int i;
+
+    if (count < 2)
+        count = 2;
+    /* Leave at least one slot for transfers */
+    if (reserved > count - 1)
+        reserved = count - 1;
+    if (reserved < 0)
+        reserved = 0;
+
+    slots = (struct slot *)calloc(count, sizeof(struct slot));
+    if (slots == NULL)
+        return -1;
+    for (i = 0; i < count; i++)
+    {
+        if (NULL == (slots[i].ctx = new_context()))
+        {
+            while (i-- > 0)
+            {
+                smbc_free_context(slots[i].ctx, 1);
+                pthread_mutex_destroy(&slots[i].mutex);
+            }
+            free(slots);
+            slots = NULL;
+            return -1;
+        }
+        pthread_mutex_init(&slots[i].mutex, NULL);
+    }
+    nslots = count;
+    nreserved = reserved;
+    range_fn = range_of;
+    apply_fn = apply;
+    return 0;
+}
+
+void sched_shutdown(void)
+{
+    int i;
+
+    for (i = 0; i < nslots; i++)
+    {
+        smbc_free_context(slots[i].ctx, 1);
+        pthread_mutex_destroy(&slots[i].mutex);
+    }
+    free(slots);
+    slots = NULL;
+    nslots = 0;
+    while (flows != NULL)
+    {
+        struct flow *next = flows->next;
+        free(flows);
+        flows = next;
+    }
+}
+
+int sched_slots(void)
+{
+    return nslots;
+}
+
+SMBCCTX *sched_context(int slot)
+{
+    return slots[slot].ctx;
+}
+
+pthread_mutex_t *sched_mutex(int slot)
+{
+    return &slots[slot].mutex;
+}
+
+int sched_find(SMBCCTX *ctx)
+{
+    int i;
+
+    for (i = 0; i < nslots; i++)
+        if (slots[i].ctx == ctx)
+            return i;
+    return -1;
+}
+
+/*
+ * Called with sched_lock held, also drops flows that are idle and whose
+ * last request the virtual time has passed
+ */
+static struct flow *flow_get(const char *server, enum sched_class cls)
+{
+    struct flow **fp = &flows, *found = NULL;
+
+    while (*fp != NULL)
+    {
+        struct flow *f = *fp;
+        if (f->cls == cls && strcmp(f->server, server) == 0)
+            found = f;
+        else if (f->waiting == 0 && f->finish <= vtime[f->cls])
+        {
+            *fp = f->next;
+            free(f);
+            continue;
+        }
+        fp = &f->next;
+    }
+    if (found != NULL)
+        return found;
+
+    found = (struct flow *)calloc(1, sizeof(struct flow));
+    if (found == NULL)
+        return NULL;
+    strncpy(found->server, server, sizeof(found->server) - 1);
+    found->cls = cls;
+    found->finish = vtime[cls];
+    found->next = flows;
+    flows = found;
+    return found;
+}
+
+/*
+ * Free slot w may have, -1 if none. Interactive requests try the reserved
+ * slots first, to leave the others to transfers.
+ */
+static int free_slot(struct waiter *w)
+{
+    int i, first = 0;
+
+    if (w->want == SCHED_NO_SLOT)
+        return SCHED_NO_SLOT;
+    if (w->want >= 0)
+        return slots[w->want].busy ? -1 : w->want;
+    if (w->want == SCHED_SHARED || w->cls != SCHED_INTERACTIVE)
+        first = nreserved;
+    for (i = first; i < nslots; i++)
+        if (!slots[i].busy)
+            return i;
+    return -1;
+}
+
+static int goes_before(struct waiter *a, struct waiter *b)
+{
+    if (a->cls != b->cls)
+        return a->cls < b->cls;
+    if (a->start != b->start)
+        return a->start < b->start;
+    return a->seq < b->seq;
+}
+
+/*
+ * Hand free slots to the waiters that are first in line for them. Requests
+ * depending on the protocol range are let in in the order they came: once
+ * the oldest of them needs another range, no more get in for the current
+ * one, and when those running are done the range is changed. Called with
+ * sched_lock held.
+ */
+static void dispatch(void)
+{
+    while (1)
+    {
+        struct waiter **wp, **best = NULL, *w, *head;
+        int slot = -1;
+
+        /* Waiters are appended, the first bound one is the oldest */
+        for (head = waiting; head != NULL && !head->bound; head = head->next)
+            ;
+        if (head != NULL && strcmp(head->range, current) != 0 && bound == 0)
+        {
+            debug("protocol range %s",
+                  head->range[0] ? head->range : "default");
+            apply_fn(slots[0].ctx, head->range);
+            strcpy(current, head->range);
+        }
+        int open = head == NULL || strcmp(head->range, current) == 0;
+
+        for (wp = &waiting; *wp != NULL; wp = &(*wp)->next)
+        {
+            if ((*wp)->bound && (!open || strcmp((*wp)->range, current) != 0))
+                continue;
+            int s = free_slot(*wp);
+            if (s != -1 && (best == NULL || goes_before(*wp, *best)))
+            {
+                best = wp;
+                slot = s;
+            }
+        }
+        if (best == NULL)
+            return;
+
+        w = *best;
+        *best = w->next;
+        if (w->start > vtime[w->cls])
+            vtime[w->cls] = w->start;
+        if (slot >= 0)
+        {
+            slots[slot].busy = 1;
+            slots[slot].bound = w->bound;
+        }
+        if (w->bound)
+            bound++;
+        w->slot = slot;
+        pthread_cond_signal(&w->cond);
+    }
+}
+
+/*
+ * Queue for slot (or SCHED_NO_SLOT) and wait until it is granted. range is
+ * NULL when the request does not depend on it.
+ */
+static int wait_for(const char *server, enum sched_class cls, int slot,
+                    size_t cost, const char *range)
+{
+    char key[SCHED_SERVER_NAME];
+    struct waiter w, **wp;
+    size_t i;
+
+    /* NetBIOS names are case insensitive */
+    for (i = 0; server[i] != '\0' && i < sizeof(key) - 1; i++)
+        key[i] = toupper((unsigned char)server[i]);
+    key[i] = '\0';
+
+    w.next = NULL;
+    w.cls = cls;
+    w.want = slot;
+    w.bound = range != NULL && apply_fn != NULL;
+    w.range[0] = '\0';
+    if (range != NULL)
+        strncat(w.range, range, sizeof(w.range) - 1);
+    w.slot = -1;
+    pthread_cond_init(&w.cond, NULL);
+
+    pthread_mutex_lock(&sched_lock);
+    struct flow *f = flow_get(key, cls);
+    double units = 1.0 + (double)cost / SCHED_COST_UNIT;
+    if (f != NULL)
+    {
+        w.start = f->finish > vtime[cls] ? f->finish : vtime[cls];
+        f->finish = w.start + units;
+        f->waiting++;
+    }
+    else
+        w.start = vtime[cls];
+    w.seq = next_seq++;
+    for (wp = &waiting; *wp != NULL; wp = &(*wp)->next)
+        ;
+    *wp = &w;
+
+    dispatch();
+    while (w.slot == -1)
+        pthread_cond_wait(&w.cond, &sched_lock);
+    if (f != NULL)
+        f->waiting--;
+    pthread_mutex_unlock(&sched_lock);
+    pthread_cond_destroy(&w.cond);
+    return w.slot;
+}
+
+/*
+ * Range connections to server need, in range
+ */
+static const char *range_of(const char *server, char *range, size_t size)
+{
+    range[0] = '\0';
+    if (range_fn != NULL)
+        range_fn(server, range, size);
+    return range;
+}
+
+int sched_begin(const char *server, enum sched_class cls, int slot,
+                size_t cost)
+{
+    char range[SCHED_RANGE];
+
+    if (server == NULL)
+        slot = wait_for("", cls, slot, cost, NULL);
+    else
+        slot = wait_for(server, cls, slot, cost,
+                        range_of(server, range, sizeof(range)));
+    pthread_mutex_lock(&slots[slot].mutex);
+    return slot;
+}
+
+void sched_end(int slot)
+{
+    pthread_mutex_unlock(&slots[slot].mutex);
+
+    pthread_mutex_lock(&sched_lock);
+    slots[slot].busy = 0;
+    if (slots[slot].bound)
+        bound--;
+    slots[slot].bound = 0;
+    dispatch();
+    pthread_mutex_unlock(&sched_lock);
+}
+
+void sched_enter(const char *server)
+{
+    char range[SCHED_RANGE];
+
+    wait_for(server, SCHED_BACKGROUND, SCHED_NO_SLOT, 0,
+             range_of(server, range, sizeof(range)));
+}
+
+void sched_leave(void)
+{
+    pthread_mutex_lock(&sched_lock);
+    if (apply_fn != NULL)
+        bound--;
+    dispatch();
+    pthread_mutex_unlock(&sched_lock);
+}
@@ -0,0 +1,92 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Request scheduler in front of the libsmbclient contexts. Each slot is a
+   context with connections of its own, and a request has its slot to
+   itself. Interactive requests (metadata, listings, opening files) go
+   before bulk transfers, and the first slots are reserved for them, so
+   browsing doesn't wait behind a large copy. Within a class the servers
+   get their fair share through start time fair queuing, bulk requests
+   costing more the more data they move.
+
+   Open files and directories stay on the slot they were opened on, their
+   requests wait for that slot.
+
+   The protocol range of libsmbclient is global, but servers may need
+   different ones (see dialect.h). The scheduler keeps one range at a time.
+   Once the oldest waiting request that depends on it needs another, no
+   more get in for the current one, whatever their class, and the range is
+   changed when the running ones are done. Requests that open no
+   connections are not held up. The threads with
+   contexts of their own take part through sched_enter(). Stripes run for a
+   request holding a slot already.
+*/
+
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include <sys/types.h>
+#include <pthread.h>
+#include <libsmbclient.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define SCHED_ANY -1            /* any slot the class may use */
+#define SCHED_SHARED -2         /* any slot that is not reserved */
+
+#define SCHED_RANGE 16
+
+enum sched_class {
+    SCHED_INTERACTIVE,
+    SCHED_BULK,
+    SCHED_BACKGROUND            /* keeping connections alive and the like */
+};
+
+typedef SMBCCTX *(*sched_context_fn)(void);
+
+/* Protocol range connections to server need, "" for the default one */
+typedef void (*sched_range_fn)(const char *server, char *range, size_t size);
+
+/* Make range the one of libsmbclient */
+typedef void (*sched_apply_fn)(SMBCCTX *ctx, const char *range);
+
+/* Creates slots contexts, the first reserved of them only take interactive
+   requests */
+int sched_init(int slots, int reserved, sched_context_fn new_context,
+    sched_range_fn range_of, sched_apply_fn apply);
+void sched_shutdown(void);
+
+int sched_slots(void);
+SMBCCTX *sched_context(int slot);
+pthread_mutex_t *sched_mutex(int slot);
+
+/* Slot of a context from sched_context(), or -1 */
+int sched_find(SMBCCTX *ctx);
+
+/* Wait for a slot (or SCHED_ANY, SCHED_SHARED) for a request to server,
+   cost is the number of bytes it moves. Returns the slot with its mutex
+   locked. server is NULL for work that opens no connections, it runs
+   whatever the protocol range. */
+int sched_begin(const char *server, enum sched_class cls, int slot,
+    size_t cost);
+void sched_end(int slot);
+
+/* For the threads with contexts of their own: wait until connections to
+   server can be opened, the range then stays until sched_leave(). Only the
+   calls that may connect need to be in between. */
+void sched_enter(const char *server);
+void sched_leave(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // SCHEDULER_H
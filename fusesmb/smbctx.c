@@ -17,6 +17,7 @@
  */
 
 
+#include "config.h"
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
@@ -151,7 +152,14 @@ static SMBCCTX *fusesmb_context(smbc_get_auth_data_fn fn)
 SMBCCTX *fusesmb_cache_new_context(config_t *cf)
 {
     fusesmb_auth_fn_cfg = cf;
-    return fusesmb_context(fusesmb_cache_auth_fn);
+    SMBCCTX *ctx = fusesmb_context(fusesmb_cache_auth_fn);
+#ifdef HAVE_LIBSMBCLIENT_PROTOCOLS
+    /* Older libsmbclient stops at NT1 by default, let servers pick SMB2/3.
+       fusesmb itself sets the range per server, see dialect.h. */
+    if (ctx != NULL)
+        smbc_setOptionProtocols(ctx, "NT1", "SMB3");
+#endif
+    return ctx;
 }
 
 SMBCCTX *fusesmb_new_context(config_t *cf, pthread_mutex_t *mutex)
@@ -0,0 +1,176 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "cmap.h"
+#include "stats.h"
+
+struct share_stats {
+    unsigned long cold;
+    unsigned long warm;
+    double cold_ms;             /* totals, averaged when written */
+    double warm_ms;
+    double last_ms;
+};
+
+struct server_stats {
+    char protocol[16];
+    unsigned long iosize;
+};
+
+struct listing {
+    double ms;
+    int warm;
+};
+
+static cmap_t *shares = NULL;
+static cmap_t *servers = NULL;
+static int dirty = 0;
+static pthread_mutex_t dirty_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+static void set_dirty(int value)
+{
+    pthread_mutex_lock(&dirty_mutex);
+    dirty = value;
+    pthread_mutex_unlock(&dirty_mutex);
+}
+
+int stats_init(void)
+{
+    shares = cmap_create(sizeof(struct share_stats), 16);
+    servers = cmap_create(sizeof(struct server_stats), 4);
+    if (shares == NULL || servers == NULL)
+    {
+        stats_free();
+        return -1;
+    }
+    return 0;
+}
+
+void stats_free(void)
+{
+    cmap_destroy(shares);
+    cmap_destroy(servers);
+    shares = NULL;
+    servers = NULL;
+}
+
+double stats_now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+static int add_listing(const char *key, void *value, void *arg)
+{
+    struct share_stats *st = (struct share_stats *)value;
+    struct listing *listing = (struct listing *)arg;
+    (void)key;
+
+    if (listing->warm)
+    {
+        st->warm++;
+        st->warm_ms += listing->ms;
+    }
+    else
+    {
+        st->cold++;
+        st->cold_ms += listing->ms;
+    }
+    st->last_ms = listing->ms;
+    return 0;
+}
+
+void stats_share_listing(const char *share, double ms, int warm)
+{
+    struct listing listing;
+
+    if (shares == NULL)
+        return;
+    listing.ms = ms;
+    listing.warm = warm;
+    if (0 == cmap_update(shares, share, add_listing, &listing))
+        set_dirty(1);
+}
+
+void stats_server_dialect(const char *server, const char *protocol,
+                          size_t iosize)
+{
+    char key[512];
+    struct server_stats st;
+
+    if (servers == NULL)
+        return;
+    memset(&st, 0, sizeof(st));
+    strncpy(st.protocol, protocol[0] ? protocol : "-", sizeof(st.protocol) - 1);
+    st.iosize = iosize;
+    snprintf(key, sizeof(key), "/%s", server);
+    if (0 == cmap_put(servers, key, &st))
+        set_dirty(1);
+}
+
+static int write_share(const char *key, void *value, void *arg)
+{
+    struct share_stats *st = (struct share_stats *)value;
+    FILE *fp = (FILE *)arg;
+
+    fprintf(fp, "%s %lu %.1f %lu %.1f %.1f\n", key,
+            st->cold, st->cold ? st->cold_ms / st->cold : 0.0,
+            st->warm, st->warm ? st->warm_ms / st->warm : 0.0,
+            st->last_ms);
+    return 0;
+}
+
+static int write_server(const char *key, void *value, void *arg)
+{
+    struct server_stats *st = (struct server_stats *)value;
+    FILE *fp = (FILE *)arg;
+
+    fprintf(fp, "%s %s %lu\n", key, st->protocol, st->iosize);
+    return 0;
+}
+
+int stats_write(const char *file)
+{
+    char tmp[1024];
+
+    if (shares == NULL || servers == NULL)
+        return -1;
+    pthread_mutex_lock(&dirty_mutex);
+    int changed = dirty;
+    dirty = 0;
+    pthread_mutex_unlock(&dirty_mutex);
+    if (!changed)
+        return 0;
+
+    snprintf(tmp, sizeof(tmp), "%s.tmp", file);
+    mode_t oldmask = umask(022);
+    FILE *fp = fopen(tmp, "w");
+    umask(oldmask);
+    if (fp == NULL)
+    {
+        set_dirty(1);
+        return -1;
+    }
+    fprintf(fp, "# share cold_listings cold_avg_ms warm_listings "
+                "warm_avg_ms last_ms\n");
+    cmap_remove_if(shares, write_share, fp);
+    fprintf(fp, "# server protocol iosize\n");
+    cmap_remove_if(servers, write_server, fp);
+    if (0 != fclose(fp) || -1 == rename(tmp, file))
+    {
+        unlink(tmp);
+        set_dirty(1);
+        return -1;
+    }
+    return 0;
+}
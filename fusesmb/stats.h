@@ -0,0 +1,45 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Per share statistics of the running fusesmb, written to fusesmb.stats in
+   the settings directory by the cleanup thread. Shares are keyed as
+   /SERVER/SHARE, servers as /SERVER.
+*/
+
+#ifndef STATS_H
+#define STATS_H
+
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+int stats_init(void);
+void stats_free(void);
+
+/* Time from opening the root of a share until its listing was read, warm
+   when the connection to the share was already set up */
+void stats_share_listing(const char *share, double ms, int warm);
+
+/* Dialect and I/O size used with a server */
+void stats_server_dialect(const char *server, const char *protocol,
+    size_t iosize);
+
+/* Rewrite file if anything changed since the last call */
+int stats_write(const char *file);
+
+/* Milliseconds since the epoch, for measuring */
+double stats_now_ms(void);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // STATS_H
@@ -25,8 +25,24 @@
 
 #include "stringlist.h"
 #include <strings.h>
+#include <stdint.h>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
 
 #define NUM_ROWS_PER_MALLOC 128
+#define FIRST_CHUNK_SIZE 4096
+#define MAX_CHUNK_SIZE (1024 * 1024)
+
+/*
+ * Arena chunk, the string data directly follows the header
+ */
+struct sl_chunk {
+    struct sl_chunk *next;
+    size_t size;
+    size_t used;
+};
 
 static int sl_strcmp(const void *p1, const void *p2)
 {
@@ -38,6 +54,284 @@ static int sl_strcasecmp(const void *p1, const void *p2)
     return strcasecmp(*(char * const *)p1, *(char * const *)p2);
 }
 
+/*
+ * ASCII lower case folding as done by strcasecmp() in the C locale,
+ * len includes the terminating zero
+ */
+static void sl_fold(unsigned char *dst, const char *src, size_t len)
+{
+    size_t i = 0;
+#if defined(__SSE2__)
+    const __m128i before_upper = _mm_set1_epi8('A' - 1);
+    const __m128i after_upper = _mm_set1_epi8('Z' + 1);
+    const __m128i to_lower = _mm_set1_epi8('a' - 'A');
+    for (; i + 16 <= len; i += 16)
+    {
+        __m128i c = _mm_loadu_si128((const __m128i *)(src + i));
+        __m128i upper = _mm_and_si128(_mm_cmpgt_epi8(c, before_upper),
+                                      _mm_cmplt_epi8(c, after_upper));
+        c = _mm_add_epi8(c, _mm_and_si128(upper, to_lower));
+        _mm_storeu_si128((__m128i *)(dst + i), c);
+    }
+#endif
+    for (; i < len; i++)
+    {
+        unsigned char c = (unsigned char)src[i];
+        dst[i] = (c >= 'A' && c <= 'Z') ? c + ('a' - 'A') : c;
+    }
+}
+
+/*
+ * FNV-1a over the case folded string
+ */
+static size_t sl_casehash(const char *str)
+{
+    const unsigned char *p = (const unsigned char *)str;
+    unsigned long hash = 2166136261UL;
+    for (; *p; p++)
+    {
+        unsigned char c = *p;
+        if (c >= 'A' && c <= 'Z')
+            c += 'a' - 'A';
+        hash = ((hash ^ c) * 16777619UL) & 0xffffffffUL;
+    }
+    return (size_t)hash;
+}
+
+static void sl_caseindex_put(char **index, size_t size, char *str)
+{
+    size_t slot = sl_casehash(str) & (size - 1);
+    while (index[slot] != NULL)
+        slot = (slot + 1) & (size - 1);
+    index[slot] = str;
+}
+
+/*
+ * (re)build the case insensitive index so that it is at most half full
+ */
+static int sl_caseindex_build(stringlist_t *sl, size_t minsize)
+{
+    size_t size = 16, i;
+    while (size < minsize * 2)
+        size *= 2;
+
+    char **index = (char **)calloc(size, sizeof(char *));
+    if (index == NULL)
+        return -1;
+    for (i=0; i < sl->numlines; i++)
+    {
+        sl_caseindex_put(index, size, sl->lines[i]);
+    }
+    free(sl->caseindex);
+    sl->caseindex = index;
+    sl->caseindex_size = size;
+    return 0;
+}
+
+static void sl_caseindex_free(stringlist_t *sl)
+{
+    free(sl->caseindex);
+    sl->caseindex = NULL;
+    sl->caseindex_size = 0;
+}
+
+/*
+ * keep an existing index up to date, it is dropped if it can't grow
+ */
+static void sl_caseindex_add(stringlist_t *sl, char *str)
+{
+    if (sl->caseindex == NULL)
+        return;
+    if (sl->numlines * 2 > sl->caseindex_size)
+    {
+        if (-1 == sl_caseindex_build(sl, sl->numlines))
+            sl_caseindex_free(sl);
+        return;
+    }
+    sl_caseindex_put(sl->caseindex, sl->caseindex_size, str);
+}
+
+/*
+ * Case folded sort key, sorted with a multikey quicksort so that every
+ * string is folded only once. The quicksort works on eight characters at a
+ * time, which are cached big endian in word.
+ */
+typedef struct {
+    uint64_t word;
+    const unsigned char *key;
+    char *line;
+} sl_sortkey_t;
+
+static uint64_t sl_sortkey_word(const unsigned char *key)
+{
+    uint64_t word = 0;
+    int i;
+    for (i = 0; i < 8; i++)
+    {
+        word <<= 8;
+        if (*key)
+            word |= *key++;
+    }
+    return word;
+}
+
+static void sl_sortkey_swap(sl_sortkey_t *a, size_t i, size_t j)
+{
+    sl_sortkey_t tmp = a[i];
+    a[i] = a[j];
+    a[j] = tmp;
+}
+
+static int sl_sortkey_cmp(const sl_sortkey_t *a, const sl_sortkey_t *b, size_t depth)
+{
+    if (a->word != b->word)
+        return a->word < b->word ? -1 : 1;
+    if ((a->word & 0xff) == 0)
+        return 0;
+    return strcmp((const char *)a->key + depth + 8, (const char *)b->key + depth + 8);
+}
+
+static void sl_mkqsort(sl_sortkey_t *a, size_t n, size_t depth)
+{
+    while (n > 1)
+    {
+        size_t i, j, lt, gt;
+        if (n < 16)
+        {
+            for (i = 1; i < n; i++)
+            {
+                for (j = i; j > 0 && sl_sortkey_cmp(&a[j-1], &a[j], depth) > 0; j--)
+                {
+                    sl_sortkey_swap(a, j, j-1);
+                }
+            }
+            return;
+        }
+
+        /* median of the quartiles as pivot, also behaves on sorted input */
+        uint64_t w1 = a[n/4].word;
+        uint64_t w2 = a[n/2].word;
+        uint64_t w3 = a[n - n/4 - 1].word;
+        uint64_t pivot;
+        if ((w1 <= w2 && w2 <= w3) || (w3 <= w2 && w2 <= w1))
+            pivot = w2;
+        else if ((w2 <= w1 && w1 <= w3) || (w3 <= w1 && w1 <= w2))
+            pivot = w1;
+        else
+            pivot = w3;
+
+        /* three way partition on the current eight characters */
+        lt = 0;
+        i = 0;
+        gt = n;
+        while (i < gt)
+        {
+            uint64_t w = a[i].word;
+            if (w < pivot)
+                sl_sortkey_swap(a, lt++, i++);
+            else if (w > pivot)
+                sl_sortkey_swap(a, i, --gt);
+            else
+                i++;
+        }
+
+        /* equal keys continue with the next eight characters */
+        if ((pivot & 0xff) != 0 && gt - lt > 1)
+        {
+            for (i = lt; i < gt; i++)
+                a[i].word = sl_sortkey_word(a[i].key + depth + 8);
+            sl_mkqsort(a + lt, gt - lt, depth + 8);
+        }
+
+        /* recurse into the smaller part, loop on the larger one */
+        if (lt < n - gt)
+        {
+            sl_mkqsort(a, lt, depth);
+            a += gt;
+            n -= gt;
+        }
+        else
+        {
+            sl_mkqsort(a + gt, n - gt, depth);
+            n = lt;
+        }
+    }
+}
+
+/*
+ * copy a string into the arena, a new chunk twice the size of the
+ * previous one is started when the current chunk is full
+ */
+static char *sl_arena_strdup(stringlist_t *sl, const char *str)
+{
+    size_t len = strlen(str) + 1;
+    struct sl_chunk *chunk = sl->chunks;
+
+    if (chunk == NULL || chunk->size - chunk->used < len)
+    {
+        size_t size = FIRST_CHUNK_SIZE;
+        if (chunk != NULL)
+        {
+            size = chunk->size * 2;
+            if (size > MAX_CHUNK_SIZE)
+                size = MAX_CHUNK_SIZE;
+        }
+        if (size < len)
+            size = len;
+
+        chunk = (struct sl_chunk *)malloc(sizeof(struct sl_chunk) + size);
+        if (chunk == NULL)
+            return NULL;
+        chunk->size = size;
+        chunk->used = 0;
+        chunk->next = sl->chunks;
+        sl->chunks = chunk;
+    }
+
+    char *copy = (char *)(chunk + 1) + chunk->used;
+    memcpy(copy, str, len);
+    chunk->used += len;
+    return copy;
+}
+
+/*
+ * release the arena, keeping the newest (largest) chunk if keep_last is set
+ */
+static void sl_arena_free(stringlist_t *sl, int keep_last)
+{
+    struct sl_chunk *chunk = sl->chunks;
+    if (chunk == NULL)
+        return;
+
+    if (keep_last)
+    {
+        chunk->used = 0;
+        chunk = chunk->next;
+        sl->chunks->next = NULL;
+    }
+    else
+    {
+        sl->chunks = NULL;
+    }
+
+    while (chunk != NULL)
+    {
+        struct sl_chunk *next = chunk->next;
+        free(chunk);
+        chunk = next;
+    }
+}
+
+static void sl_owned_free(stringlist_t *sl)
+{
+    size_t i;
+    for (i=0; i < sl->numowned; i++)
+    {
+        free(sl->owned[i]);
+    }
+    sl->numowned = 0;
+}
+
 /*
  * initialize the stringlist
  */
@@ -50,10 +344,19 @@ stringlist_t *sl_init(void)
 
     sl->lines = (char **)malloc(NUM_ROWS_PER_MALLOC * sizeof(char *));
     if (sl->lines == NULL)
+    {
+        free(sl);
         return NULL;
+    }
     sl->maxlines = NUM_ROWS_PER_MALLOC;
     sl->numlines = 0;
     sl->sorted = 0;
+    sl->chunks = NULL;
+    sl->owned = NULL;
+    sl->numowned = 0;
+    sl->maxowned = 0;
+    sl->caseindex = NULL;
+    sl->caseindex_size = 0;
     return sl;
 }
 /*
@@ -61,56 +364,64 @@ stringlist_t *sl_init(void)
  */
 void sl_free(stringlist_t *sl)
 {
-    size_t i;
     if (sl == NULL)
         return;
-    if (sl->lines)
-    {
-        for (i=0; i < sl_count(sl); i++)
-        {
-            free(sl->lines[i]);
-        }
-        free(sl->lines);
-    }
+    sl_arena_free(sl, 0);
+    sl_owned_free(sl);
+    sl_caseindex_free(sl);
+    free(sl->owned);
+    free(sl->lines);
     free(sl);
 }
 /*
  * add string to stringlist
- * do_malloc: allocate memory for the string
+ * do_malloc: copy the string into the stringlist, otherwise the stringlist
+ *            takes ownership of the malloced string
  */
 int sl_add(stringlist_t *sl, char *str, int do_malloc)
 {
-    /* resize the array if needed */
-    //printf("Inserting %s %i\n", str, sl->numlines);
+    /* resize the array if needed, doubling keeps the copying linear */
     if (sl->numlines == sl->maxlines)
     {
-        //printf("Realloc\n");
         char **newString;
-        newString = (char **)realloc(sl->lines, (sl->maxlines + NUM_ROWS_PER_MALLOC)*sizeof(char *));
+        newString = (char **)realloc(sl->lines, sl->maxlines * 2 * sizeof(char *));
         if (newString == NULL)
         {
-            //printf("Realloc failed\n");
             return -1;
         }
-        sl->maxlines += NUM_ROWS_PER_MALLOC;
+        sl->maxlines *= 2;
         sl->lines = newString;
     }
     if (do_malloc)
     {
-        sl->lines[sl->numlines] = (char *)malloc( (strlen(str)+1) * sizeof(char));
+        sl->lines[sl->numlines] = sl_arena_strdup(sl, str);
         if (NULL == sl->lines[sl->numlines])
         {
             return -1;
         }
-        strcpy(sl->lines[sl->numlines], str);
         sl->numlines++;
         sl->sorted = 0;
+        sl_caseindex_add(sl, sl->lines[sl->numlines - 1]);
         return 0;
-   }
-   sl->lines[sl->numlines] = str;
-   sl->numlines++;
-   sl->sorted = 0;
-   return 0;
+    }
+    if (sl->numowned == sl->maxowned)
+    {
+        size_t maxowned = sl->maxowned ? sl->maxowned * 2 : NUM_ROWS_PER_MALLOC;
+        char **newOwned;
+        newOwned = (char **)realloc(sl->owned, maxowned * sizeof(char *));
+        if (newOwned == NULL)
+        {
+            return -1;
+        }
+        sl->maxowned = maxowned;
+        sl->owned = newOwned;
+    }
+    sl->owned[sl->numowned++] = str;
+    sl->lines[sl->numlines] = str;
+    sl->numlines++;
+    sl->sorted = 0;
+    sl_caseindex_add(sl, str);
+    return 0;
 }
 
 /*
@@ -123,11 +434,9 @@ size_t sl_count(stringlist_t *sl)
 
 void sl_clear(stringlist_t *sl)
 {
-    size_t i;
-    for (i=0; i < sl_count(sl); i++)
-    {
-        free( sl->lines[i] );
-    }
+    sl_caseindex_free(sl);
+    sl_arena_free(sl, 1);
+    sl_owned_free(sl);
     sl->numlines = 0;
 }
 
@@ -168,26 +477,33 @@ char *sl_find(stringlist_t *sl, const char *str)
 }
 
 /*
- * case insensitive search
+ * case insensitive search, using a hashed index of the case folded strings
  */
 char *sl_casefind(stringlist_t *sl, const char *str)
 {
-    /* use binary search if stringlist is case insensitively sorted */
-    if (sl->sorted == 2)
+    if (sl->caseindex == NULL)
     {
-        char **res;
-        if (NULL != (res = (char**)bsearch (&str, sl->lines, sl_count(sl), sizeof(char *), sl_strcasecmp)))
-            return *res;
-        return NULL;
+        if (-1 == sl_caseindex_build(sl, sl_count(sl)))
+        {
+            size_t i;
+            for (i=0; i < sl_count(sl); i++)
+            {
+                if (strcasecmp(sl_item(sl, i), str) == 0)
+                {
+                    return sl_item(sl, i);
+                }
+            }
+            return NULL;
+        }
     }
 
-    size_t i;
-    for (i=0; i < sl_count(sl); i++)
+    size_t mask = sl->caseindex_size - 1;
+    size_t slot = sl_casehash(str) & mask;
+    while (sl->caseindex[slot] != NULL)
     {
-        if (strcasecmp(sl_item(sl, i), str) == 0)
-        {
-            return sl_item(sl, i);
-        }
+        if (strcasecmp(sl->caseindex[slot], str) == 0)
+            return sl->caseindex[slot];
+        slot = (slot + 1) & mask;
     }
     return NULL;
 }
@@ -206,7 +522,44 @@ void sl_sort(stringlist_t *sl)
  */
 void sl_casesort(stringlist_t *sl)
 {
-    qsort(sl->lines, sl_count(sl), sizeof(char *), sl_strcasecmp);
+    size_t i, n = sl_count(sl), keysize = 0;
+    if (n < 2)
+    {
+        sl->sorted = 2;
+        return;
+    }
+
+    for (i=0; i < n; i++)
+        keysize += strlen(sl->lines[i]) + 1;
+
+    sl_sortkey_t *keys = (sl_sortkey_t *)malloc(n * sizeof(sl_sortkey_t));
+    unsigned char *folded = (unsigned char *)malloc(keysize);
+    if (keys == NULL || folded == NULL)
+    {
+        free(keys);
+        free(folded);
+        qsort(sl->lines, n, sizeof(char *), sl_strcasecmp);
+        sl->sorted = 2;
+        return;
+    }
+
+    unsigned char *p = folded;
+    for (i=0; i < n; i++)
+    {
+        size_t len = strlen(sl->lines[i]) + 1;
+        sl_fold(p, sl->lines[i], len);
+        keys[i].key = p;
+        keys[i].word = sl_sortkey_word(p);
+        keys[i].line = sl->lines[i];
+        p += len;
+    }
+
+    sl_mkqsort(keys, n, 0);
+
+    for (i=0; i < n; i++)
+        sl->lines[i] = keys[i].line;
+    free(keys);
+    free(folded);
     sl->sorted = 2;
 }
 #if 0
@@ -235,3 +588,105 @@ void sl_unlock(stringlist_t *sl)
     pthread_mutex_unlock(sl->mutex);
 }
 #endif
+
+#ifdef RUN_BENCHMARK
+
+/*
+ * Microbenchmark, build with:
+ *  gcc -O2 -DRUN_BENCHMARK -o stringlist-bench stringlist.c
+ */
+
+#include <stdio.h>
+#include <sys/time.h>
+
+static double now_ms(void)
+{
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec * 1000.0 + tv.tv_usec / 1000.0;
+}
+
+/* Same pattern as config_read_file() on every reload of fusesmb.conf */
+static void bench_config_reload(int reloads, int lines)
+{
+    char buf[256];
+    int r, i;
+    stringlist_t *sl = sl_init();
+    double start = now_ms();
+
+    for (r = 0; r < reloads; r++)
+    {
+        sl_clear(sl);
+        for (i = 0; i < lines; i++)
+        {
+            if (i % 10 == 0)
+                snprintf(buf, sizeof(buf), "[/SERVER%d]", i);
+            else
+                snprintf(buf, sizeof(buf), "key%d=value number %d", i, i);
+            sl_add(sl, buf, 1);
+        }
+    }
+    printf("config reload: %d x %d lines: %.2f ms\n", reloads, lines,
+        now_ms() - start);
+    sl_free(sl);
+}
+
+/* Same pattern as the share list built up by fusesmb-scan */
+static void bench_scanner(int entries)
+{
+    char buf[256];
+    int i;
+    size_t j, unique = 0;
+    stringlist_t *sl = sl_init();
+    double start = now_ms(), t;
+
+    for (i = 0; i < entries; i++)
+    {
+        snprintf(buf, sizeof(buf), "/WORKGROUP%d/SERVER%05d/share%d",
+            i % 7, (i * 7919) % (entries / 4 + 1), i % 4);
+        sl_add(sl, buf, 1);
+    }
+    t = now_ms();
+    printf("scanner add: %d entries: %.2f ms\n", entries, t - start);
+
+    sl_casesort(sl);
+    for (j = 0; j < sl_count(sl); j++)
+    {
+        if (j > 0 && strcmp(sl_item(sl, j), sl_item(sl, j-1)) == 0)
+            continue;
+        unique++;
+    }
+    printf("scanner sort+dedup: %lu unique: %.2f ms\n", (unsigned long)unique,
+        now_ms() - t);
+
+    /* Same pattern as the ignore list lookups of fusesmb-scan */
+    stringlist_t *queries = sl_init();
+    for (i = 0; i < entries; i++)
+    {
+        snprintf(buf, sizeof(buf), "/workgroup%d/server%05d/share%d",
+            i % 7, i % (entries / 4 + 1), i % 4);
+        sl_add(queries, buf, 1);
+    }
+    t = now_ms();
+    unique = 0;
+    for (j = 0; j < sl_count(queries); j++)
+    {
+        if (NULL != sl_casefind(sl, sl_item(queries, j)))
+            unique++;
+    }
+    printf("scanner casefind: %d lookups, %lu found: %.2f ms\n", entries,
+        (unsigned long)unique, now_ms() - t);
+    sl_free(queries);
+
+    t = now_ms();
+    sl_free(sl);
+    printf("scanner free: %.2f ms\n", now_ms() - t);
+}
+
+int main(void)
+{
+    bench_config_reload(1000, 200);
+    bench_scanner(100000);
+    return 0;
+}
+#endif
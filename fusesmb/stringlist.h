@@ -29,11 +29,25 @@
 #include <string.h>
 #include <stdlib.h>
 
+/*
+ * Copied strings are stored in a list of arena chunks which are released all
+ * at once, strings that were added without copying are freed individually.
+ * caseindex is an open addressing table of the lines hashed by their case
+ * folded value, it is built by the first sl_casefind().
+ */
+struct sl_chunk;
+
 typedef struct stringlist {
     char **lines;
     size_t numlines;
     size_t maxlines;
     char sorted;
+    struct sl_chunk *chunks;
+    char **owned;
+    size_t numowned;
+    size_t maxowned;
+    char **caseindex;
+    size_t caseindex_size;
 } stringlist_t;
 
 stringlist_t *sl_init(void);
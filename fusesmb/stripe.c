@@ -0,0 +1,343 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include "config.h"
+
+#include <errno.h>
+#include <pthread.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include "stripe.h"
+#include "limit.h"
+#include "stats.h"
+#include "debug.h"
+
+struct stripe {
+    pthread_t thread;
+    pthread_mutex_t lock;       /* protects ctx and job */
+    pthread_cond_t cond;
+    SMBCCTX *ctx;               /* created by the worker on first use */
+    struct stripe_job *job;
+    int started;
+    int quit;
+    time_t last_used;
+};
+
+static struct stripe stripes[STRIPE_MAX];
+static stripe_context_fn new_stripe_context;
+static pthread_mutex_t stripes_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_mutex_t done_mutex = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t done_cond = PTHREAD_COND_INITIALIZER;
+static int running = 0;
+
+static void close_file(SMBCCTX *ctx, SMBCFILE *file)
+{
+#ifdef HAVE_LIBSMBCLIENT_CLOSE_FN
+    ctx->close_fn(ctx, file);
+#else
+    ctx->close(ctx, file);
+#endif
+}
+
+/*
+ * Called with the stripe locked
+ */
+static void run_job(struct stripe *s, struct stripe_job *job)
+{
+    char server[256];
+    double start;
+    size_t done = 0;
+
+    job->result = -1;
+    if (s->ctx == NULL && NULL == (s->ctx = new_stripe_context()))
+    {
+        job->error = ENOMEM;
+        return;
+    }
+    if (*job->file == NULL &&
+        NULL == (*job->file = s->ctx->open(s->ctx, job->url, job->flags, 0)))
+    {
+        job->error = errno;
+        return;
+    }
+    if (s->ctx->lseek(s->ctx, *job->file, job->offset, SEEK_SET) == (off_t)-1)
+        goto failed;
+
+    limit_url_server(job->url, server, sizeof(server));
+    limit_begin(server, job->size);
+    start = stats_now_ms();
+    while (done < job->size)
+    {
+        ssize_t ret;
+        if (job->write)
+            ret = s->ctx->write(s->ctx, *job->file, job->buf + done,
+                                job->size - done);
+        else
+            ret = s->ctx->read(s->ctx, *job->file, job->buf + done,
+                               job->size - done);
+        if (ret < 0)
+        {
+            limit_end(server);
+            goto failed;
+        }
+        /* End of file */
+        if (ret == 0)
+            break;
+        done += ret;
+    }
+    limit_end(server);
+    job->ms = stats_now_ms() - start;
+    job->result = done;
+    return;
+
+failed:
+    /* The handle falls back to its own connection for this part */
+    job->error = errno;
+    close_file(s->ctx, *job->file);
+    *job->file = NULL;
+}
+
+static void *stripe_thread(void *data)
+{
+    struct stripe *s = (struct stripe *)data;
+
+    pthread_mutex_lock(&s->lock);
+    while (1)
+    {
+        while (!s->quit && s->job == NULL)
+            pthread_cond_wait(&s->cond, &s->lock);
+        if (s->job == NULL)
+            break;
+
+        struct stripe_job *job = s->job;
+        run_job(s, job);
+        s->job = NULL;
+        s->last_used = time(NULL);
+        /* Wake up anyone waiting for this stripe to become free */
+        pthread_cond_broadcast(&s->cond);
+
+        pthread_mutex_lock(&done_mutex);
+        (*job->pending)--;
+        pthread_cond_broadcast(&done_cond);
+        pthread_mutex_unlock(&done_mutex);
+    }
+    pthread_mutex_unlock(&s->lock);
+    return NULL;
+}
+
+void stripe_init(stripe_context_fn new_context)
+{
+    int i;
+
+    new_stripe_context = new_context;
+    for (i = 0; i < STRIPE_MAX; i++)
+    {
+        pthread_mutex_init(&stripes[i].lock, NULL);
+        pthread_cond_init(&stripes[i].cond, NULL);
+        stripes[i].ctx = NULL;
+        stripes[i].job = NULL;
+        stripes[i].started = 0;
+        stripes[i].quit = 0;
+    }
+    running = 1;
+}
+
+void stripe_shutdown(void)
+{
+    int i;
+
+    pthread_mutex_lock(&stripes_mutex);
+    running = 0;
+    for (i = 0; i < STRIPE_MAX; i++)
+    {
+        pthread_mutex_lock(&stripes[i].lock);
+        stripes[i].quit = 1;
+        pthread_cond_broadcast(&stripes[i].cond);
+        pthread_mutex_unlock(&stripes[i].lock);
+    }
+    for (i = 0; i < STRIPE_MAX; i++)
+    {
+        if (stripes[i].started)
+            pthread_join(stripes[i].thread, NULL);
+        stripes[i].started = 0;
+        if (stripes[i].ctx != NULL)
+            smbc_free_context(stripes[i].ctx, 1);
+        stripes[i].ctx = NULL;
+    }
+    pthread_mutex_unlock(&stripes_mutex);
+}
+
+/*
+ * Workers are started when first needed, most setups never stripe
+ */
+static int start_stripes(int count)
+{
+    int i;
+
+    pthread_mutex_lock(&stripes_mutex);
+    for (i = 0; i < count; i++)
+    {
+        if (stripes[i].started)
+            continue;
+        if (!running || 0 != pthread_create(&stripes[i].thread, NULL,
+                                            stripe_thread, &stripes[i]))
+            break;
+        stripes[i].started = 1;
+    }
+    pthread_mutex_unlock(&stripes_mutex);
+    return i;
+}
+
+void stripe_run(struct stripe_job *jobs, int count)
+{
+    int i, pending = 0;
+
+    if (count > STRIPE_MAX)
+        count = STRIPE_MAX;
+    int started = start_stripes(count);
+    for (i = started; i < count; i++)
+    {
+        jobs[i].result = -1;
+        jobs[i].error = EAGAIN;
+    }
+
+    for (i = 0; i < started; i++)
+    {
+        struct stripe *s = &stripes[i];
+        jobs[i].pending = &pending;
+
+        pthread_mutex_lock(&done_mutex);
+        pending++;
+        pthread_mutex_unlock(&done_mutex);
+
+        pthread_mutex_lock(&s->lock);
+        /* Another transfer may be using the stripe */
+        while (s->job != NULL)
+            pthread_cond_wait(&s->cond, &s->lock);
+        s->job = &jobs[i];
+        pthread_cond_broadcast(&s->cond);
+        pthread_mutex_unlock(&s->lock);
+    }
+
+    pthread_mutex_lock(&done_mutex);
+    while (pending > 0)
+        pthread_cond_wait(&done_cond, &done_mutex);
+    pthread_mutex_unlock(&done_mutex);
+}
+
+void stripe_close(int index, SMBCFILE *file)
+{
+    struct stripe *s = &stripes[index];
+
+    pthread_mutex_lock(&s->lock);
+    if (s->ctx != NULL)
+        close_file(s->ctx, file);
+    pthread_mutex_unlock(&s->lock);
+}
+
+void stripe_maintain(int idle)
+{
+    time_t now = time(NULL);
+    int i;
+
+    for (i = 0; i < STRIPE_MAX; i++)
+    {
+        struct stripe *s = &stripes[i];
+        pthread_mutex_lock(&s->lock);
+        /* Connections with files still open on them are kept */
+        if (s->ctx != NULL && s->job == NULL && now - s->last_used >= idle)
+            s->ctx->callbacks.purge_cached_fn(s->ctx);
+        pthread_mutex_unlock(&s->lock);
+    }
+}
+
+#ifdef RUN_BENCHMARK
+
+/*
+ * Sequential read throughput with 1 to STRIPE_MAX stripes, against a file on
+ * a (local) smbd:
+ *  gcc -O2 -c handle.c limit.c throughput.c blockcache.c blocksum.c \
+ *      dircache.c scheduler.c stats.c cmap.c ohash.c
+ *  gcc -O2 -DRUN_BENCHMARK -o stripe-bench stripe.c handle.o limit.o \
+ *      throughput.o blockcache.o blocksum.o dircache.o scheduler.o stats.o \
+ *      cmap.o ohash.o -lsmbclient -lpthread
+ *  SMB_USER=user SMB_PASSWORD=secret ./stripe-bench smb://127.0.0.1/share/big.iso
+ */
+
+#include <fcntl.h>
+#include "handle.h"
+
+static void bench_auth_fn(const char *server, const char *share,
+                          char *workgroup, int wgmaxlen,
+                          char *username, int unmaxlen,
+                          char *password, int pwmaxlen)
+{
+    (void)server;
+    (void)share;
+    (void)workgroup;
+    (void)wgmaxlen;
+    if (getenv("SMB_USER") != NULL)
+        strncpy(username, getenv("SMB_USER"), unmaxlen - 1);
+    if (getenv("SMB_PASSWORD") != NULL)
+        strncpy(password, getenv("SMB_PASSWORD"), pwmaxlen - 1);
+}
+
+static SMBCCTX *bench_context(void)
+{
+    SMBCCTX *ctx = smbc_new_context();
+    if (ctx == NULL)
+        return NULL;
+    ctx->callbacks.auth_fn = bench_auth_fn;
+    return smbc_init_context(ctx);
+}
+
+int main(int argc, char *argv[])
+{
+    static char buf[128 * 1024];
+    pthread_mutex_t lock = PTHREAD_MUTEX_INITIALIZER;
+    int n;
+
+    if (argc < 2)
+    {
+        fprintf(stderr, "usage: %s smb://server/share/file\n", argv[0]);
+        return 1;
+    }
+    SMBCCTX *ctx = bench_context();
+    if (ctx == NULL)
+        return 1;
+    stripe_init(bench_context);
+
+    for (n = 1; n <= STRIPE_MAX; n *= 2)
+    {
+        pthread_mutex_lock(&lock);
+        smb_handle_t *h = handle_open(ctx, &lock, argv[1], O_RDONLY, 0);
+        if (h == NULL)
+        {
+            perror(argv[1]);
+            return 1;
+        }
+        handle_set_stripes(h, n);
+
+        off_t total = 0;
+        ssize_t ret;
+        double t = stats_now_ms();
+        /* Same request size as the FUSE layer uses */
+        while ((ret = handle_read(h, buf, sizeof(buf), total)) > 0)
+            total += ret;
+        t = stats_now_ms() - t;
+        handle_close(h);
+        pthread_mutex_unlock(&lock);
+
+        printf("%d stripe(s): %8.1f MB/s (%lld bytes)\n", n,
+               total / 1048576.0 / (t / 1000.0), (long long)total);
+    }
+    stripe_shutdown();
+    smbc_free_context(ctx, 1);
+    return 0;
+}
+
+#endif /* RUN_BENCHMARK */
@@ -0,0 +1,61 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Extra connections for large sequential transfers. Each stripe is a
+   libsmbclient context of its own, so with its own connection to the server,
+   driven by a worker thread. A transfer split over several stripes keeps
+   that many requests on the wire at the same time.
+*/
+
+#ifndef STRIPE_H
+#define STRIPE_H
+
+#include <sys/types.h>
+#include <libsmbclient.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define STRIPE_MAX 8
+
+struct stripe_job {
+    SMBCFILE **file;            /* the file on this stripe, opened on demand */
+    const char *url;
+    int flags;
+    int write;
+    char *buf;
+    size_t size;
+    off_t offset;
+    ssize_t result;             /* bytes transferred, or -1 */
+    int error;
+    double ms;                  /* time the transfer took */
+    int *pending;               /* private */
+};
+
+typedef SMBCCTX *(*stripe_context_fn)(void);
+
+void stripe_init(stripe_context_fn new_context);
+void stripe_shutdown(void);
+
+/* Run jobs[i] on stripe i, all at once. Returns when all of them are done,
+   short reads only happen at the end of the file. */
+void stripe_run(struct stripe_job *jobs, int count);
+
+/* Close a file opened on stripe index by a job */
+void stripe_close(int index, SMBCFILE *file);
+
+/* Close the connections of stripes unused for idle seconds */
+void stripe_maintain(int idle);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // STRIPE_H
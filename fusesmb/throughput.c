@@ -0,0 +1,144 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+#include "cmap.h"
+#include "throughput.h"
+
+#define DECAY 0.95              /* weight of the older samples per sample */
+#define MIN_WEIGHT 4.0          /* samples before trusting the fit */
+#define BDP_FACTOR 4            /* a request is a fifth round trip, 80% busy */
+
+/* Exponentially weighted sums for a least squares fit of ms over KiB */
+struct share_throughput {
+    double n;
+    double x;
+    double y;
+    double xx;
+    double xy;
+};
+
+struct sample {
+    double kib;
+    double ms;
+};
+
+static cmap_t *shares = NULL;
+static char last_share[512];
+static pthread_mutex_t last_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+int throughput_init(void)
+{
+    shares = cmap_create(sizeof(struct share_throughput), 16);
+    return shares == NULL ? -1 : 0;
+}
+
+void throughput_free(void)
+{
+    cmap_destroy(shares);
+    shares = NULL;
+}
+
+/*
+ * /SERVER/SHARE of smb://SERVER/SHARE/...
+ */
+static void share_key(const char *url, char *key, size_t size)
+{
+    const char *start = url, *end;
+
+    if (0 == strncmp(start, "smb://", 6))
+        start += 6;
+    end = strchr(start, '/');
+    if (end != NULL)
+        end = strchr(end + 1, '/');
+    if (end == NULL)
+        end = start + strlen(start);
+    snprintf(key, size, "/%.*s", (int)(end - start), start);
+}
+
+static int add_sample(const char *key, void *value, void *arg)
+{
+    struct share_throughput *tp = (struct share_throughput *)value;
+    struct sample *s = (struct sample *)arg;
+    (void)key;
+
+    tp->n = tp->n * DECAY + 1;
+    tp->x = tp->x * DECAY + s->kib;
+    tp->y = tp->y * DECAY + s->ms;
+    tp->xx = tp->xx * DECAY + s->kib * s->kib;
+    tp->xy = tp->xy * DECAY + s->kib * s->ms;
+    return 0;
+}
+
+void throughput_sample(const char *url, size_t bytes, double ms)
+{
+    char key[512];
+    struct sample s;
+
+    if (shares == NULL)
+        return;
+    share_key(url, key, sizeof(key));
+    s.kib = bytes / 1024.0;
+    s.ms = ms;
+    cmap_update(shares, key, add_sample, &s);
+
+    if (bytes > 0)
+    {
+        pthread_mutex_lock(&last_mutex);
+        strcpy(last_share, key);
+        pthread_mutex_unlock(&last_mutex);
+    }
+}
+
+static size_t chunk_of(const char *key, size_t fallback)
+{
+    struct share_throughput tp;
+    size_t chunk = THROUGHPUT_MIN_CHUNK;
+
+    if (shares == NULL || -1 == cmap_get(shares, key, &tp) ||
+        tp.n < MIN_WEIGHT)
+        return fallback;
+
+    double mx = tp.x / tp.n, my = tp.y / tp.n;
+    double var = tp.xx / tp.n - mx * mx;
+    /* All requests of about the same size, nothing to fit a line to */
+    if (var < 1.0)
+        return fallback;
+    double slope = (tp.xy / tp.n - mx * my) / var;     /* ms per KiB */
+    double latency = my - slope * mx;                   /* ms */
+
+    if (latency <= 0)
+        return THROUGHPUT_MIN_CHUNK;
+    if (slope <= 0)
+        return THROUGHPUT_MAX_CHUNK;
+
+    /* Powers of two, so the size doesn't change with every sample */
+    double want = latency / slope * 1024 * BDP_FACTOR;
+    while (chunk < THROUGHPUT_MAX_CHUNK && chunk * 2 <= want)
+        chunk *= 2;
+    return chunk;
+}
+
+size_t throughput_chunk(const char *url, size_t fallback)
+{
+    char key[512];
+
+    share_key(url, key, sizeof(key));
+    return chunk_of(key, fallback);
+}
+
+size_t throughput_io_size(size_t fallback)
+{
+    char key[512];
+
+    pthread_mutex_lock(&last_mutex);
+    strcpy(key, last_share);
+    pthread_mutex_unlock(&last_mutex);
+    if (key[0] == '\0')
+        return fallback;
+    return chunk_of(key, fallback);
+}
@@ -0,0 +1,48 @@
+/*
+ * Copyright 2026 FuseSMB-Haiku contributors
+ * All rights reserved. Distributed under the terms of the MIT license.
+ */
+
+/* Throughput and latency of the connections to each share. Every request
+   is a sample of how long it took for how many bytes, a line fitted through
+   the recent ones gives the latency (metadata requests, moving nothing,
+   pin it down) and the bandwidth (the slope). Their product is what has to
+   be on the wire to keep a connection busy, requests are sized to a few
+   times that.
+*/
+
+#ifndef THROUGHPUT_H
+#define THROUGHPUT_H
+
+#include <sys/types.h>
+
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+
+#define THROUGHPUT_MIN_CHUNK (64 * 1024)
+#define THROUGHPUT_MAX_CHUNK (8 * 1024 * 1024)
+
+int throughput_init(void);
+void throughput_free(void);
+
+/* A request on a connection to the share of url moved bytes in ms, 0 bytes
+   for metadata */
+void throughput_sample(const char *url, size_t bytes, double ms);
+
+/* Request size for one connection to the share of url, fallback until
+   something was measured */
+size_t throughput_chunk(const char *url, size_t fallback);
+
+/* Request size of the share used last */
+size_t throughput_io_size(size_t fallback);
+
+
+#ifdef __cplusplus
+} // extern "C"
+#endif
+
+
+#endif // THROUGHPUT_H